@@ -61,690 +61,9955 @@
  *          in its own function.
  *		    In tokenise, check to see if the command being entered is an alias. If so, read the command 
  *          which is aliased and call tokenise once again with this aliased command.
+ *
+ * v1.1 16/10/2026  Added a command lookup cache in the style of the bash hash builtin. The first time
+ *          a command is launched its PATH search result is stored in a hash table, after that
+ *          createProcess() runs it with execve directly instead of letting execvp walk every PATH
+ *          directory. The cache is cleared by setpath and can be listed, cleared and pre-warmed
+ *          with the new hash builtin.
+ *
+ * v1.2 16/10/2026  Added process launch backends. Commands are now started through launch() which
+ *          can use posix_spawn (the default), vfork or the original fork, so launching no longer
+ *          copies the page tables of a large shell. The environment passed to execve is built once
+ *          and reused until PATH or the environment changes. The launcher builtin shows or selects
+ *          the backend so launch latency can be compared.
+ *
+ * v1.3 16/10/2026  Added pipelines. The pipe operator is no longer thrown away by the tokeniser,
+ *          instead run_pipeline() splits the command line into stages, connects them with
+ *          pipe2(O_CLOEXEC) pipes, starts every stage at once in a shared process group and waits
+ *          for the whole group. Builtins can be used as pipeline stages. The pipesize builtin
+ *          raises the pipe capacity with F_SETPIPE_SZ for high-volume pipelines.
+ *
+ * v1.4 16/10/2026  Added job control. Every command now runs as a job in its own process group,
+ *          a trailing & leaves it running in the background and the jobs, fg, bg and wait
+ *          builtins manage it. Children are reaped by an event loop which watches a pidfd per
+ *          child and a signalfd for SIGCHLD through epoll, so nothing on the prompt path blocks
+ *          and the exit status of one child can no longer be lost while waiting for another.
+ *
+ * v1.5 16/10/2026  Added the parallel builtin. It reads argument lines from a file or stdin, splits
+ *          them into batches which fit within ARG_MAX and keeps up to one command per online core
+ *          running from a ready queue, without the extra processes of xargs -P. Output of each batch
+ *          is collected and written whole, either as batches finish or in input order, and a
+ *          throughput summary is printed at the end.
+ *
+ * v1.6 16/10/2026  Added non-interactive modes: 'bashshell script.sh', 'bashshell -c "cmd"' and
+ *          commands piped into stdin. These modes skip the banner, prompt and history, keep the
+ *          working directory and exit with the status of the last command. All input now goes
+ *          through a large buffered reader with no limit on line length, replacing fgets and the
+ *          "file name too big" check. A word starting with '#' begins a comment.
+ *
+ * v1.7 16/10/2026  Replaced the tokeniser's allocations with a per-line arena. Alias expansions and
+ *          copies of the line are carved out of arena blocks which are kept and reset once per
+ *          input line, so parsing a command does no malloc once the shell has warmed up and
+ *          nothing leaks. cmdStr is now a growable, NULL terminated vector, which removes the
+ *          MAX_ARGS limit on the number of arguments.
+ *
+ * v1.8 16/10/2026  Replaced the shifting history array with a ring buffer. Its capacity is taken
+ *          from HISTSIZE (default 20) and can be hundreds of thousands of entries, adding an entry
+ *          is constant time and evicted entries are freed. Each new command is appended to the
+ *          history file as it is entered with fdatasync batched, and the file is compacted to the
+ *          in-memory history once it has grown to twice the capacity, so exit no longer rewrites it.
+ *
+ * v1.9 16/10/2026  Replaced the fixed array of 10 aliases with an open addressing hash table of owned
+ *          strings which grows as needed. Each alias keeps its command split into words, so expanding
+ *          it pushes those words without parsing them again. Aliases may now name other aliases and
+ *          expand in turn, add_alias() refuses any alias which would lead back to itself.
+ *
+ * v1.10 16/10/2026 Replaced the strcmp chain in commands() with a dispatch table of builtin
+ *          descriptors looked up through a perfect hash, each descriptor carrying the argument
+ *          counts its builtin accepts so the checks are no longer written out by hand. Added
+ *          echo, true, false, test, [, printf, export, unset and type as builtins, so these
+ *          trivial commands no longer cost a fork and exec.
+ *
+ * v1.11 16/10/2026 Added 'history search <pattern>', which lists the commands containing pattern
+ *          most recent first, and '!?pattern?', which runs the most recent of them. Both use a
+ *          trigram index over history that is updated as commands are added and evicted, so
+ *          searching a history of hundreds of thousands of commands stays fast.
+ *
+ * v1.12 16/10/2026 open_history() now maps the history file and scans back from its end with
+ *          memrchr() for the commands it keeps, which are used in place in the mapping instead of
+ *          being read and copied line by line, so start-up time no longer grows with the size of
+ *          the history file.
+ *
+ * v1.13 16/10/2026 History can now be shared by many shells running at once. Each command is
+ *          appended as one O_APPEND write of a ': time:session;command' record, and commands added
+ *          by other sessions are read in from the end of the file before history or !N runs.
+ *          Compaction keeps the last commands of the file rather than of one session and runs under
+ *          an exclusive flock, while appends hold a shared one and reopen the file if it has been
+ *          replaced, so no session loses another's commands.
+ *
+ * v1.14 16/10/2026 Children are now reaped with wait4() and their resource usage kept. The new time
+ *          prefix runs a command line and reports its wall clock, user and system time, peak
+ *          resident size and context switches without starting /usr/bin/time. Every command run
+ *          is also added to per-command statistics of its count, mean, median and 99th percentile
+ *          latency and peak size, which the new stats builtin prints.
+ *
+ * v1.15 16/10/2026 Added a Makefile and a benchmark suite, run with 'make bench', which times start-up,
+ *          batch throughput of builtins and external commands, tokenise(), alias_check(),
+ *          add_history() and loading and saving large history files, and writes the results as
+ *          JSON. Defining SHELL_NO_MAIN leaves out main() so the benchmarks can call the shell's
+ *          functions directly.
+ *
+ * v1.16 16/10/2026 In -c and script modes the last command, when it is a plain external command
+ *          and no jobs are left, is now run with execve() in place of the shell instead of being
+ *          forked and waited for, saving a fork and a process for every wrapper invocation.
+ *
+ * v1.17 16/10/2026 Added '<', '>' and '>>' redirection, which the tokeniser used to throw away. Files
+ *          are opened for each stage of a job and handed to it like pipes, and builtins run in the
+ *          shell with stdin and stdout moved onto the files for their duration. Added cat and cp as
+ *          builtins which move data between descriptors inside the kernel with copy_file_range,
+ *          sendfile or splice, whichever the descriptors allow, falling back to read and write
+ *          through a large buffer, so copying a large file costs no process and no user space copy.
+ *
+ * v1.18 16/10/2026 Added a line editor for the interactive prompt, with cursor movement, the usual
+ *          Emacs keys, history browsing with the arrow keys and tab completion of command names and
+ *          paths. Command names come from a prefix trie of the executables on PATH which is built on
+ *          first use, reads each directory with bulk getdents64 calls and rereads a directory only
+ *          when its modification time changes. The trie is dropped when PATH is changed.
+ *
+ * v1.19 16/10/2026 Words holding '*', '?' or a '[...]' class are now expanded by tokenise() into the
+ *          paths they match, sorted, and left as they are when nothing matches. Each component of
+ *          the pattern is compiled into a bit-parallel NFA which tests a name in one pass without
+ *          backtracking, directories are read with bulk getdents64 calls and only the matching names
+ *          are kept, so expanding in a directory of hundreds of thousands of entries stays fast.
+ *
+ * v1.20 16/10/2026 Added the memo builtin, which runs an external command once and replays its stdout,
+ *          stderr and exit status from a cache in HOME while its arguments, working directory, PATH,
+ *          the variables and input files declared with -e and -f and the command's own executable
+ *          are unchanged. Files are fingerprinted by inode, size and modification time. The cache
+ *          is kept under MEMOSIZE bytes by evicting the least recently used results.
+ *
+ * v1.21 16/10/2026 Added a server mode. 'bashshell --server socket' warms up once, running any commands
+ *          or script given, then listens on a Unix domain socket with a pool of workers forked from it
+ *          and waiting for connections. 'bashshell --connect socket -c commands' sends the commands with
+ *          the client's working directory, environment and stdin, stdout and stderr, passed as SCM_RIGHTS,
+ *          and exits with their status. Each worker serves one request and exits while the server forks
+ *          its replacement, so requests cost no process start and cannot affect each other.
+ *
+ * v1.22 17/10/2026 Added a script language: NAME=value assignments, $NAME, ${NAME} and $? in words,
+ *          if/elif/else/fi on exit statuses, while, until and 'for NAME in words' loops with break and
+ *          continue, and the source builtin. A statement is compiled once into instructions whose
+ *          words are already split and whose variables are resolved to slots, so each run of a loop
+ *          body only fills in values instead of tokenising lines again. Compiled scripts are cached
+ *          by the hash of their text, so sourcing an unchanged file or repeating a block skips parsing.
+ *
+ * v1.23 17/10/2026 Added the run prefix, which starts a command line with a CPU set, nice value,
+ *          SCHED_BATCH or SCHED_IDLE policy, I/O priority and resource limits applied in each child
+ *          before exec, so jobs need no taskset, nice or ionice wrapper processes. 'run -d' makes the
+ *          settings the default for every job and 'run -r' spreads background and parallel jobs over
+ *          the CPUs in turn. Commands with settings are started with vfork, as posix_spawn cannot
+ *          apply them.
+ *
+ * v1.24 17/10/2026 Added execution tracing. SHELL_TRACE=file or 'trace on file' records timed spans for
+ *          reading, tokenising, alias expansion, script compiles, builtins, process launches, job waits
+ *          and history file I/O in a ring buffer, which a flusher thread writes out as JSON lines or
+ *          in the Chrome trace format. Spans are only timed while tracing, so it costs one flag test
+ *          when off, and a full ring drops and counts events instead of stalling the shell.
+ *
+ * v1.25 17/10/2026 Added here-documents (<<EOF, with <<'EOF' leaving variables unexpanded) and
+ *          here-strings (<<< word). Their text reaches the command's stdin through a pipe, or a memfd
+ *          when it is larger than HEREDOC_PIPE_MAX, so no temporary file or feeding process is used.
+ *          Compiled scripts keep here-document bodies in place in their text.
  */
 
-#define VERSION "Simple_Shell_V1_0, Last Update 13/04/2014\n"
+#define VERSION "Simple_Shell_V1_25, Last Update 17/10/2026\n"
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <spawn.h>
+#include <sched.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/sendfile.h>
+#include <stdio_ext.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <poll.h>
+#include <pthread.h>
 
-/* Maximum number of arguments per line */
-#define MAX_ARGS 50
 /* Maximum length of an input */
 #define MAX_LEN  514
 /* Set of delimiters used to tokenize string */
-#define DELIMS " <>|\t\r\n"
+#define DELIMS " \t\r\n"
+/* Set of operators which are tokens of their own, '>' may be doubled */
+#define OPERATORS "|&<>"
 /* Shell prompt */
 #define prompt "> "
+/* History file, kept in the HOME directory */
+#define HISTORY_FILE ".hist_list"
+/* Lock file serialising compaction of the history file with appends */
+#define HISTORY_LOCK ".hist_list.lock"
+/* Number of commands remembered when HISTSIZE is not set */
+#define HISTORY_DEFAULT 20
+/* Appends to the history file between each fdatasync */
+#define HISTORY_SYNC_BATCH 32
+/* Seconds an append may wait for an fdatasync of the history file */
+#define HISTORY_SYNC_INTERVAL 5
+/* Alias table is grown before it gets fuller than this */
+#define ALIAS_LOAD_PERCENT 70
+/* Number of slots in the builtin dispatch table, a power of two */
+#define BUILTIN_SLOTS 128
+/* Number of buckets in the command lookup cache */
+#define HASH_SIZE 256
+
+/* Process launch backends */
+#define LAUNCH_FORK  0
+#define LAUNCH_VFORK 1
+#define LAUNCH_SPAWN 2
+
+/* Settings made by the run builtin, bits of Sched.set */
+#define RUN_CPUS   1
+#define RUN_NICE   2
+#define RUN_POLICY 4
+#define RUN_IOPRIO 8
+#define RUN_SPREAD 16
+/* Arguments of ioprio_set(), as in linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_IDLE        3
+
+/* States of a process in a job */
+#define PROC_RUNNING 0
+#define PROC_STOPPED 1
+#define PROC_DONE    2
 
-/* The following macro is used to purge unwanted input */
-#define FLUSH_STDIN(x) while((x=fgetc(stdin)) != EOF && x!='\n');
+/* Number of latest runs of a command kept for its latency percentiles */
+#define STATS_WINDOW 128
+/* Size of each block of the per-line arena */
+#define ARENA_BLOCK (64 * 1024)
+/* Size of each read made by the input reader */
+#define READ_CHUNK (256 * 1024)
+/* Most bytes moved by each system call of cat and cp */
+#define COPY_CHUNK (1024 * 1024)
+/* Cache of the memo builtin, kept in the HOME directory */
+#define MEMO_DIR ".memo_cache"
+/* Bytes the memo cache may hold when MEMOSIZE is not set */
+#define MEMO_DEFAULT_SIZE (256LL * 1024 * 1024)
+/* First bytes of every memo cache entry */
+#define MEMO_MAGIC "SHMEMO1"
+/* Compiled scripts kept before the cache is emptied */
+#define SCRIPT_CACHE_MAX 256
+/* Part of a compiled word standing for $? */
+#define VAR_STATUS -1
+
+/* Keywords of the script language, indexes of script_keywords[] */
+#define KW_IF       0
+#define KW_ELIF     1
+#define KW_ELSE     2
+#define KW_FI       3
+#define KW_WHILE    4
+#define KW_UNTIL    5
+#define KW_FOR      6
+#define KW_DO       7
+#define KW_DONE     8
+#define KW_THEN     9
+#define KW_BREAK    10
+#define KW_CONTINUE 11
+
+/* Operations of compiled scripts */
+#define OP_RUN        0
+#define OP_ASSIGN     1
+#define OP_JUMP       2
+#define OP_JUMP_FALSE 3
+#define OP_JUMP_TRUE  4
+#define OP_FOR        5
+#define OP_NEXT       6
+#define OP_END        7
+#define OP_ZERO       8
+
+/* First word of every request to a server */
+#define SERVER_MAGIC 0x31485a53u
+/* Largest request a server accepts */
+#define SERVER_MAX_REQUEST (64 * 1024 * 1024)
+/* Size of each getdents64 read of a directory */
+#define DIR_BUFFER (64 * 1024)
+/* Largest here-document written to a pipe rather than a memfd */
+#define HEREDOC_PIPE_MAX (64 * 1024)
+/* Operator put in place of '<<' when the delimiter is quoted, so the
+ * body is taken as it is */
+#define HEREDOC_LITERAL "<<'"
+/* Events the trace ring holds, a power of two */
+#define TRACE_EVENTS 65536
+/* Bytes of detail kept with each trace event */
+#define TRACE_DETAIL 48
+/* Interval between writes of the trace file */
+#define TRACE_FLUSH_MS 50
+/* Trace output gathered before each write */
+#define TRACE_BUFFER (64 * 1024)
+/* Characters which end a word being completed */
+#define WORD_BREAKS " \t|&<>"
 /* Size macro: Used to determine the size of an array */
 #define SIZE(x) (sizeof(x)/sizeof(x[0]))
+/* Start and end a traced span, costing only a test of tracing when it is off */
+#define TRACE_START(t) ((t) = tracing ? trace_clock() : 0)
+#define TRACE_END(t, name, detail, value) \
+    do{ if((t) != 0 && tracing) trace_event(name, t, detail, value); }while(0)
 
 /* Structure which contains:
  * - alias name;
- * - corresponding command. */
+ * - corresponding command;
+ * - the command split into words, and the storage for those words. */
 typedef struct{
 	char * alias_name;
 	char * alias_cmd;
+	char ** alias_argv;
+	char * alias_words;
 } Alias;
 
-/* Array to store commands history. */
-char *history[MAX_LEN];
-/* Array to store parsed command line */
-char *cmdStr[MAX_ARGS];
+/* Structure which contains:
+ * - command name;
+ * - full path the command was found at;
+ * - number of times the cached path has been used;
+ * - next entry in the same bucket. */
+typedef struct HashEntry{
+	char * name;
+	char * path;
+	int hits;
+	struct HashEntry * next;
+} HashEntry;
+
+/* Structure which contains the settings the run builtin applies to a
+ * command before exec:
+ * - RUN_* bits of the settings in use;
+ * - CPUs it may run on, nice value, scheduling policy and I/O priority;
+ * - bits of run_limits[] in use and the limits to set. */
+typedef struct{
+	int set;
+	cpu_set_t cpus;
+	int nice;
+	int policy;
+	int ioprio;
+	int limits;
+	struct rlimit limit[RLIM_NLIMITS];
+} Sched;
+
+/* Structure which contains everything needed to start a command:
+ * - full path of the executable;
+ * - argument vector passed to it;
+ * - descriptors to use as stdin and stdout, -1 to inherit the shell's;
+ * - process group to join, 0 for a new group, -1 to stay in the shell's;
+ * - run settings to apply and the CPU picked for it, -1 for none. */
+typedef struct{
+	const char * path;
+	char ** argv;
+	int fd_in;
+	int fd_out;
+	pid_t pgid;
+	const Sched * sched;
+	int cpu;
+} Launch;
+
+/* Structure which contains the statistics of one command:
+ * - command name;
+ * - number of runs, their total time in seconds and peak resident size in KB;
+ * - latencies of the last STATS_WINDOW runs, as a ring;
+ * - next entry in the same bucket. */
+typedef struct CmdStats{
+	char * name;
+	long count;
+	double total;
+	long peak_rss;
+	double window[STATS_WINDOW];
+	struct CmdStats * next;
+} CmdStats;
+
+/* Structure which contains one process of a job:
+ * - process id and the pidfd watching it, -1 if none;
+ * - wait status and resource usage once it has finished;
+ * - PROC_* state;
+ * - when it was started and the statistics of its command;
+ * - job it belongs to. */
+typedef struct{
+	pid_t pid;
+	int pidfd;
+	int status;
+	struct rusage usage;
+	int state;
+	struct timespec started;
+	CmdStats * stats;
+	struct Job * job;
+} Proc;
+
+/* Structure which contains a pipeline started by the shell:
+ * - job number and process group;
+ * - its processes, how many have not finished and how many are running;
+ * - whether it runs in the background and whether the user was told it stopped;
+ * - terminal modes to restore when it is brought back to the foreground,
+ *   and whether it held the terminal when it stopped so they were saved;
+ * - command line for reporting. */
+typedef struct Job{
+	int id;
+	pid_t pgid;
+	Proc * procs;
+	int nprocs;
+	int alive;
+	int running;
+	int background;
+	int stopped;
+	struct termios tmodes;
+	int tmodes_saved;
+	char * cmd;
+} Job;
+
+/* Structure which contains a buffered line reader:
+ * - descriptor to read from, -1 when reading from a string;
+ * - buffer with its size, the unread data and how much of it has been searched;
+ * - whether the end of input has been reached. */
+typedef struct{
+	int fd;
+	char * buf;
+	size_t size;
+	size_t start;
+	size_t end;
+	size_t scanned;
+	int eof;
+} Reader;
+
+/* Structure which contains one block of an arena:
+ * - next block in the chain;
+ * - size of the block and how much of it is in use;
+ * - the memory handed out. */
+typedef struct ArenaBlock{
+	struct ArenaBlock * next;
+	size_t size;
+	size_t used;
+	char data[];
+} ArenaBlock;
+
+/* Structure which contains an arena: a chain of blocks which are
+ * handed out in order and all reused after a reset. */
+typedef struct{
+	ArenaBlock * head;
+	ArenaBlock * current;
+} Arena;
+
+/* Structure which contains a point in an arena to go back to:
+ * - block in use and how much of it was used. */
+typedef struct{
+	ArenaBlock * block;
+	size_t used;
+} ArenaMark;
+
+/* Structure which contains the state of a scan over a command line:
+ * - where the next token starts;
+ * - operator overwritten to terminate the last word, returned next. */
+typedef struct{
+	char * next;
+	char * held;
+} Scanner;
+
+/* Structure which contains a builtin command:
+ * - name it is invoked by and the prefix of its error messages;
+ * - least and most arguments it takes, -1 for no limit;
+ * - function which runs it. */
+typedef struct{
+	const char * name;
+	const char * tag;
+	int min_args;
+	int max_args;
+	void (* run)();
+} Builtin;
+
+/* Structure which contains the state of a test expression:
+ * - its words and how many there are;
+ * - the next word to evaluate;
+ * - whether the expression was malformed. */
+typedef struct{
+	char ** argv;
+	int end;
+	int pos;
+	int error;
+} Test;
+
+/* Structure which contains the history entries holding one trigram:
+ * - the trigram, its three characters packed into the low 24 bits;
+ * - numbers of the entries holding it, oldest first, in use from start;
+ * - number of entries in the list and room for them. */
+typedef struct{
+	unsigned int trigram;
+	unsigned int * seqs;
+	int start;
+	int len;
+	int cap;
+} Posting;
+
+/* Structure which contains a directory of PATH in the executable index:
+ * - its path and the modification time it was read at;
+ * - names of the executables in it, each NUL terminated, their length and room;
+ * - whether it has been read. */
+typedef struct{
+	char * path;
+	struct timespec mtime;
+	char * names;
+	size_t names_len;
+	size_t names_cap;
+	int scanned;
+} PathDir;
+
+/* Structure which contains a node of the executable trie:
+ * - character leading to it;
+ * - first child and next sibling, siblings in character order, 0 for none;
+ * - number of PATH directories holding the name ending here;
+ * - number of names ending in its subtree. */
+typedef struct{
+	char c;
+	int child;
+	int sibling;
+	int count;
+	int live;
+} TrieNode;
+
+/* Structure which contains a directory entry as getdents64 returns it:
+ * - inode and offset of the next entry;
+ * - length of this entry, its DT_* type and name. */
+typedef struct{
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} DirEntry;
+
+/* Structure which contains a path being completed:
+ * - the word typed and how much of it names the directory;
+ * - the start of the name in that directory and its length. */
+typedef struct{
+	const char * word;
+	size_t dir_len;
+	const char * base;
+	size_t base_len;
+} PathQuery;
+
+/* Structure which contains one component of a glob pattern compiled
+ * into an NFA with a state per element, run as a bitset:
+ * - number of elements, the accepting state being one past them,
+ *   and the number of 64 bit words in a set of states;
+ * - for each byte, the states whose element accepts it;
+ * - the states whose element is '*', which also accept nothing;
+ * - whether a leading '.' must be matched by a '.';
+ * - two sets of states to run the NFA in. */
+typedef struct{
+	int len;
+	int words;
+	uint64_t * accept;
+	uint64_t * star;
+	int hide_dots;
+	uint64_t * current;
+	uint64_t * next;
+} Glob;
+
+/* Structure which contains a directory being matched against a pattern:
+ * - the compiled component;
+ * - path of the directory, with room to add a name, and its length;
+ * - whether this is the last component, whose matches are pushed as words;
+ * - otherwise the matching subdirectories, how many and room for them. */
+typedef struct{
+	Glob * glob;
+	char * path;
+	size_t len;
+	int last;
+	char ** dirs;
+	int dir_count;
+	int dir_cap;
+} GlobScan;
+
+/* Structure which contains the header of a memo cache entry, which is
+ * followed by the key, the command's stdout and its stderr:
+ * - MEMO_MAGIC;
+ * - lengths of the key, the stdout and the stderr;
+ * - exit status of the command. */
+typedef struct{
+	char magic[8];
+	uint64_t key_len;
+	uint64_t out_len;
+	uint64_t err_len;
+	int32_t status;
+} MemoHeader;
+
+/* Structure which contains an entry of the memo cache:
+ * - its file name, size and when it was last used. */
+typedef struct{
+	char * name;
+	off_t size;
+	struct timespec used;
+} MemoEntry;
+
+/* Structure which contains the entries found in the memo cache:
+ * - the entries, how many there are and room for them;
+ * - their total size. */
+typedef struct{
+	MemoEntry * entries;
+	int count;
+	int cap;
+	off_t total;
+} MemoScan;
+
+/* Structure which contains the state of the line editor:
+ * - line being edited, its length, room and the cursor position;
+ * - keys read but not yet handled, how many and how many are used;
+ * - history entry shown, history_counter for the new line, and the new line
+ *   kept aside while browsing;
+ * - whether the last key was Tab. */
+typedef struct{
+	char * line;
+	size_t len;
+	size_t cap;
+	size_t pos;
+	char keys[256];
+	int keys_len;
+	int keys_pos;
+	int browse;
+	char * draft;
+	int tabbed;
+} Editor;
+
+/* Structure which starts a request to a server:
+ * - SERVER_MAGIC;
+ * - length of the payload following it. */
+typedef struct{
+	uint32_t magic;
+	uint32_t length;
+} ServerRequest;
+
+/* Structure which contains a shell variable:
+ * - its name and its value, both owned, the value NULL while unset. */
+typedef struct{
+	char * name;
+	char * value;
+} Var;
+
+/* Structure which contains one piece of a word of a compiled script:
+ * - text used as it is and its length, or
+ * - the shell variable put in its place, VAR_STATUS for $?. */
+typedef struct{
+	const char * text;
+	int len;
+	int var;
+} Part;
+
+/* Structure which contains a word of a compiled script:
+ * - its text as written;
+ * - first of its parts and how many, 0 if it holds no variables;
+ * - whether it is a glob pattern. */
+typedef struct{
+	char * text;
+	int part;
+	int parts;
+	int glob;
+} Word;
+
+/* Structure which contains an instruction of a compiled script:
+ * - OP_* operation and whether the status of its command is negated;
+ * - instruction jumped to;
+ * - shell variable and for loop it uses;
+ * - first of its words and how many. */
+typedef struct{
+	unsigned char op;
+	unsigned char negate;
+	int target;
+	int var;
+	int loop;
+	int word;
+	int words;
+} Instr;
+
+/* Structure which contains a compiled script, cached by the hash of its text:
+ * - hash, length and a copy of the text it was compiled from;
+ * - the copy split into words in place, which its words point into;
+ * - instructions, words and parts, each with its length and capacity;
+ * - number of for loops, runs of it in progress and the next script
+ *   in its bucket. */
+typedef struct Script{
+	uint64_t hash;
+	size_t len;
+	char * source;
+	char * text;
+	Instr * code;
+	int code_len;
+	int code_cap;
+	Word * words;
+	int word_len;
+	int word_cap;
+	Part * parts;
+	int part_len;
+	int part_cap;
+	int loops;
+	int running;
+	struct Script * next;
+} Script;
+
+/* Structure which contains a for loop of a running script:
+ * - words it goes through, how many and the next one. */
+typedef struct{
+	char ** items;
+	int count;
+	int next;
+} Loop;
+
+/* Structure which contains a loop being compiled:
+ * - instruction continue jumps to;
+ * - its for loop, -1 for while and until;
+ * - last break made out of it, breaks are chained through their targets
+ *   until the end of the loop is known;
+ * - loop it is nested in. */
+typedef struct LoopScope{
+	int top;
+	int loop;
+	int breaks;
+	struct LoopScope * outer;
+} LoopScope;
+
+/* Structure which contains the state of the script compiler:
+ * - script being compiled and the start of its next line;
+ * - number of the current line, its words and its KW_* keyword;
+ * - innermost loop being compiled, and whether an error was found. */
+typedef struct{
+	Script * script;
+	char * next;
+	int line;
+	char ** tokens;
+	int token_len;
+	int token_cap;
+	int keyword;
+	LoopScope * scope;
+	int error;
+} Compiler;
+
+/* Structure which contains an event of the trace:
+ * - when its span started and how long it took, in nanoseconds;
+ * - its name, a constant string;
+ * - a number and text telling what it worked on. */
+typedef struct{
+	uint64_t start;
+	uint64_t duration;
+	const char * name;
+	long value;
+	char detail[TRACE_DETAIL];
+} TraceEvent;
+
+/* Ring buffer to store commands history, oldest entry at history_head. */
+char **history;
+int history_capacity;
+int history_head;
+/* Growable NULL terminated vector holding the parsed command line */
+char **cmdStr;
+size_t cmd_len;
+size_t cmd_cap;
+/* Arena for the current command line, reset before each line is read */
+Arena line_arena;
+
+/* Hash table of aliases, alias_capacity is a power of two */
+Alias *alias_table;
+int alias_capacity;
+
+/* Command lookup cache, chained by bucket */
+HashEntry *hash_table[HASH_SIZE];
 
-/* Array of aliases, which size is 10 */
-Alias alias_array[10];
+extern char **environ;
+
+/* Backend used by launch() to start commands */
+int launcher = LAUNCH_SPAWN;
+/* Names of the launch backends, indexed by LAUNCH_* */
+const char *launcher_names[] = {"fork", "vfork", "spawn"};
+/* Environment handed to launched commands, NULL until built */
+char **launch_envp;
+/* Settings the run builtin applies to every job, and those of the
+ * command line being run */
+Sched run_defaults;
+Sched *launch_sched = &run_defaults;
+/* Jobs spread over the CPUs so far */
+unsigned int spread_next;
+/* Resources run -l can limit */
+const struct{
+	const char * name;
+	int resource;
+} run_limits[] = {{"as", RLIMIT_AS}, {"core", RLIMIT_CORE}, {"cpu", RLIMIT_CPU}, {"data", RLIMIT_DATA},
+                  {"fsize", RLIMIT_FSIZE}, {"memlock", RLIMIT_MEMLOCK}, {"nofile", RLIMIT_NOFILE},
+                  {"nproc", RLIMIT_NPROC}, {"rss", RLIMIT_RSS}, {"stack", RLIMIT_STACK}};
+/* Scheduling policies run -s can select */
+const struct{
+	const char * name;
+	int policy;
+} sched_policies[] = {{"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}};
+/* Names of the I/O priority classes, indexed by class */
+const char *ioprio_classes[] = {"none", "rt", "be", "idle"};
+/* Error from a failed exec in a vfork child, which shares our memory */
+volatile int vfork_errno;
+/* Signals the shell handles itself, reset to default in children */
+int job_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+/* Capacity requested for pipeline pipes, 0 for the system default */
+int pipe_size;
+/* Set when the shell is reading commands from a terminal */
+int interactive;
+/* Terminal modes of the shell, restored when a foreground job ends */
+struct termios shell_tmodes;
+
+/* Exit status of the last command */
+int last_status;
+/* Set when -c or a script may run its last command in place of the shell,
+ * and while running that command */
+int tail_calls;
+int exec_last;
+
+/* Table of jobs in the order they were started */
+Job **job_table;
+int job_count;
+int job_capacity;
+/* Statistics of each command run, chained by bucket */
+CmdStats *stats_table[HASH_SIZE];
+/* Resource usage of the foreground jobs finished since time last cleared it */
+struct rusage job_usage;
+
+/* Event loop watching child pidfds and the SIGCHLD signalfd */
+int epoll_fd = -1;
+int sigchld_fd = -1;
 
 /* Counter of total number of aliases */
 int alias_counter;
 /* Counter of total number of commands stored in history */
 int history_counter;
+/* Number of commands ever stored, the next entry's number in the index */
+unsigned int history_total;
+/* Trigram index over history, trigram_capacity is a power of two */
+Posting *trigram_table;
+int trigram_capacity;
+int trigram_count;
+/* History file open for appending, its full path and how many lines it holds */
+int history_fd = -1;
+char *history_path;
+long history_lines;
+/* How much of the history file has been read and the last record read,
+ * lock file guarding it and the session id marking this shell's records */
+off_t history_seen;
+char *history_last;
+int history_lock_fd = -1;
+uint64_t history_session;
+/* Private mapping of the history file holding loaded commands, and how
+ * many commands in history still point into it */
+char *history_map;
+size_t history_map_size;
+int history_mapped;
+/* Appends since the history file was last synced, and when that was */
+int history_unsynced;
+time_t history_synced;
+
+/* Directories of PATH in the executable index, NULL until completion needs them */
+PathDir *path_dirs;
+int path_dir_count;
+/* Prefix trie of the executables on PATH, node 0 is the root */
+TrieNode *exec_trie;
+int trie_len;
+int trie_cap;
+/* Candidates found by the last completion, sorted */
+char **completions;
+int completion_count;
+int completion_cap;
+/* Line editor used at the prompt */
+Editor editor;
+/* Commands the memo builtin replayed and ran this session */
+int memo_hits;
+int memo_misses;
+/* Shell variables in the order they were first used, and an open addressing
+ * index of them holding position + 1, var_slots is a power of two */
+Var *vars;
+int var_count;
+int var_cap;
+int *var_index;
+int var_slots;
+/* Compiled scripts, chained by bucket of the hash of their text */
+Script *script_cache[HASH_SIZE];
+int script_count;
+/* Set when exit runs in a compiled script, to stop the shell */
+int shell_exit;
+/* Keywords of the script language, indexed by KW_* */
+const char *script_keywords[] = {"if", "elif", "else", "fi", "while", "until", "for", "do", "done",
+                                 "then", "break", "continue"};
+
+/* Set while tracing, the ring of events the flusher thread writes out,
+ * the next slot to fill and to write, and the events dropped when full */
+int tracing;
+TraceEvent *trace_ring;
+uint64_t trace_head;
+uint64_t trace_tail;
+unsigned long trace_dropped;
+/* Trace file and whether it takes the Chrome format, the flusher's
+ * output buffer and the process the events are from */
+int trace_fd = -1;
+int trace_chrome;
+char *trace_buf;
+size_t trace_buf_len;
+pid_t trace_pid;
+/* Flusher thread, woken early to stop it */
+pthread_t trace_thread;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t trace_wake = PTHREAD_COND_INITIALIZER;
+int trace_stopping;
 
 void commands();
+unsigned int hash_string(const char *str);
+void scan_init(Scanner *scan, char *input);
+char *scan_token(Scanner *scan);
+void events_forget();
+void hash_clear();
+void env_changed();
+const Builtin *find_builtin(const char *name);
+char *history_entry(int n);
+void *arena_alloc(Arena *arena, size_t size);
+uint64_t trace_clock();
+void trace_event(const char *name, uint64_t start, const char *detail, long value);
+void store_history(char *entry);
+void exec_index_reset();
+int has_glob(const char *word);
+int expand_glob(char *word);
+int is_redirect(const char *word);
+int has_heredoc(const char *line);
+int scan_dir(const char *path, void (*visit)(int, DirEntry *, void *), void *arg);
+char *read_line(Reader *in);
+int write_all(int fd, const char *buf, size_t len);
+char *expand_vars(char *word);
+int find_var(const char *name, size_t len, int create);
+void drop_var(const char *name);
 
 /* Synopsis:
  * void reset_cmdstr()
  *
  * Description:
- * The function deletes all content of cmdStr[]
- * by setting each element to NULL.
+ * The function empties cmdStr[]. The vector keeps its capacity
+ * so later command lines can reuse it.
  *
  * Returns:
  * The function has return type void.
  */
 void reset_cmdstr() {
 
-	int i = 0;
-	while(cmdStr[i] != NULL) {
-		cmdStr[i] = NULL;
-		i++;
+	if(cmdStr == NULL) {
+		cmd_cap = 64;
+		cmdStr = malloc(cmd_cap * sizeof(char *));
 	}
+	cmd_len = 0;
+	cmdStr[0] = NULL;
 }
 
-/* Alias Commands */
-
 /* Synopsis:
- * int alias_check(char *alias)
+ * void push_cmdstr(char *word)
  *
  * Description:
- * The function checks whether the alias user wants to use
- * has already been used by comparing desired alias
- * to each alias in alias_array[].
+ * The function appends word to cmdStr[], growing the vector
+ * when it is full, and keeps it NULL terminated.
  *
  * Returns:
- * Index of this alias in alias_array[] if alias has already been used.
- * -1 if alias has not been used.
+ * The function has return type void.
  */
-int alias_check(char *alias){
-    int i = 0;
-	while(i < alias_counter){
-		char *check = alias_array[i].alias_name;
-		if(strcmp(check, alias) == 0)
-			return i;
-        i++;
+void push_cmdstr(char *word) {
+
+	if(cmd_len + 1 >= cmd_cap) {
+		cmd_cap *= 2;
+		cmdStr = realloc(cmdStr, cmd_cap * sizeof(char *));
 	}
-	return -1;
+	cmdStr[cmd_len++] = word;
+	cmdStr[cmd_len] = NULL;
 }
 
+/* Memory Arena */
+
 /* Synopsis:
- * void print_alias()
+ * void *arena_alloc(Arena *arena, size_t size)
  *
  * Description:
- * The function prints out all aliases and their corresponding
- * commands stored in alias_array[]. If there are no aliases
- * then error message is printed out.
+ * The function hands out size bytes from the arena. Blocks left
+ * over from before the last reset are reused before any new block
+ * is allocated, requests larger than a block get a block of their own.
  *
  * Returns:
- * The function has return type void.
+ * Pointer to the memory, valid until the arena is reset.
  */
-void print_alias(){
-	int i = 0;
-	if(alias_counter == 0)
-		puts("Error: There are no aliases recognized.");
-	while(i < alias_counter){
-		printf("Alias: %s\tCommand: %s\n", alias_array[i].alias_name, alias_array[i].alias_cmd);
-		i++;
-	}
+void *arena_alloc(Arena *arena, size_t size){
+    ArenaBlock *block = arena->current, *fresh;
+    size_t block_size;
+
+    size = (size + 15) & ~(size_t)15; /* Keep every allocation aligned. */
+    while(block != NULL && block->used + size > block->size){
+        if(block->next == NULL)
+            break;
+        block = block->next;
+        block->used = 0; /* Not touched since the last reset. */
+    }
+
+    if(block == NULL || block->used + size > block->size){
+        block_size = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        fresh = malloc(sizeof(ArenaBlock) + block_size);
+        fresh->size = block_size;
+        fresh->used = 0;
+        if(block == NULL){
+            fresh->next = NULL;
+            arena->head = fresh;
+        }
+        else{ /* Link in after the current block so it is reused next time. */
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        block = fresh;
+    }
+
+    arena->current = block;
+    block->used += size;
+    return block->data + block->used - size;
 }
 
 /* Synopsis:
- * void add_alias()
+ * char *arena_strdup(Arena *arena, const char *str)
  *
  * Description:
- * The function adds new alias with its corresponding command
- * to alias_array[].Several checks are done before adding:
- * - Whether there is a valid number of parameters
- * - Whether user is not trying to create alias equal
- *   to the command name;
- * - Whether user is not trying to create an alias for alias;
- * - Whether user is not trying to use already used alias;
- * - Whether the maximum number of aliases is reached.
- * If successful, new alias is created and counter is incremented.
+ * The function copies str into the arena.
  *
  * Returns:
- * The function has return type void.
+ * The copy, valid until the arena is reset.
  */
-void add_alias(){
-
-    int i, index;
-	/* Check to prevent invalid number of arguments and 
-	 * prevent having alias same as command name. */
-	if(cmdStr[2] == NULL || strcmp(cmdStr[1], cmdStr[2]) == 0){
-		puts("Error: Invalid alias");
-		return;
-	}
-
-	/* Check whether aliased command is not an alias itself. */
-	index = alias_check(cmdStr[2]);
-
-   	if(index >= 0) /* If the command is an alias itself .. */
-		puts("Error: Cannot give an alias to an existing alias."); /* .. display error message. */
-
-	else{
-		/* Check whether desired alias has been already used. */
-		index = alias_check(cmdStr[1]);
-
-		if(index >= 0){ /* The alias has been used, so ..
-				 *display appropriate message .. */
-			puts("Warning: An alias with this name already exists. Proceeding to overwrite."); 
-
-			/* .. and override the previous one. */
-			alias_array[index].alias_name = cmdStr[1];
-			i = 2;
-			/* Delete old command. */
-			strcpy(alias_array[index].alias_cmd, "");
-           		/* Add new command with all its parameters. */
-			while(cmdStr[i] != NULL){
-				strcat(alias_array[index].alias_cmd, cmdStr[i]);
-				strcat(alias_array[index].alias_cmd, " ");
-				i++;
-			}
-		}
-
-		else{ /* Alias can be used. */
-
-			/* Check whether the maximum number of aliases is reached. */
-			if(alias_counter >= SIZE(alias_array)){
-				puts("Error: Alias list is full.");
-				return;
-			}
-			/* Add new alias and corresponding command with its parameters. */
-			alias_array[alias_counter].alias_name = cmdStr[1];
-            		i = 2;
-			strcpy(alias_array[alias_counter].alias_cmd, "");
-
-			while(cmdStr[i] != NULL){
-				strcat(alias_array[alias_counter].alias_cmd, cmdStr[i]);
-				strcat(alias_array[alias_counter].alias_cmd, " ");
-				i++;
-			}
-			alias_counter++; /* Increment total number of aliases. */
-		}
-	}
+char *arena_strdup(Arena *arena, const char *str){
+    size_t len = strlen(str) + 1;
+    return memcpy(arena_alloc(arena, len), str, len);
 }
 
 /* Synopsis:
- * void alias()
+ * void arena_reset(Arena *arena)
  *
  * Description:
- * The function checks what user intended to do,
- * add new alias or print all aliases.
- * This is done by checking whether 'aliases' is followed 
- * by any parameters and then appropriate function is called.
+ * The function releases everything handed out by the arena at
+ * once. The blocks are kept for reuse.
  *
  * Returns:
  * The function has return type void.
  */
-void alias(){
-
-	if(cmdStr[1] == NULL)
-		print_alias();
+void arena_reset(Arena *arena){
+    arena->current = arena->head;
+    if(arena->head != NULL)
+        arena->head->used = 0;
+}
 
-	else
-		add_alias();
+/* Synopsis:
+ * ArenaMark arena_mark(Arena *arena)
+ *
+ * Description:
+ * The function notes how much of the arena is handed out.
+ *
+ * Returns:
+ * The mark, for arena_release().
+ */
+ArenaMark arena_mark(Arena *arena){
+    ArenaMark mark;
 
+    mark.block = arena->current;
+    mark.used = arena->current != NULL ? arena->current->used : 0;
+    return mark;
 }
 
 /* Synopsis:
- * void remove_alias()
+ * void arena_release(Arena *arena, ArenaMark mark)
  *
  * Description:
- * The function removes alias from alias_array[] if it is present
- * or displays error message if it is not.
+ * The function releases everything handed out by the arena since
+ * mark was taken, keeping what was handed out before it.
  *
  * Returns:
  * The function has return type void.
  */
-void remove_alias(){
-    int i, index;
-	if(cmdStr[1] == NULL) /* Check if valid number of parameters. */
-		puts("Error: No alias selected");
-	else{
-		/* Get index of alias in alias_check[] if it is there. */
-		index = alias_check(cmdStr[1]);
-		/* If alias is in array remove it and shift all subsequent 
-		 * aliases by 1 to the beginning of array. */
-		if(index >= 0){
-            		i=index+1;
-			while(i<alias_counter){
-	 			strcpy(alias_array[i-1].alias_name, alias_array[i].alias_name);
-				strcpy(alias_array[i-1].alias_cmd,alias_array[i].alias_cmd);
-				i++;
- 			}
-			alias_counter--;
-		}
-		else
-			puts("Error: Alias does not exist.");
-	}
+void arena_release(Arena *arena, ArenaMark mark){
+    if(mark.block == NULL){
+        arena_reset(arena);
+        return;
+    }
+    arena->current = mark.block;
+    mark.block->used = mark.used;
 }
 
+/* Tracing */
+
 /* Synopsis:
- * int tokenise(char *input)
+ * uint64_t trace_clock()
  *
  * Description:
- * The function takes user input and parses into tokens.
+ * The function reads the monotonic clock used for trace events.
  *
  * Returns:
- * 0 
- * 1
- * 2
+ * The time in nanoseconds.
  */
-int tokenise(char *input){
+uint64_t trace_clock(){
+    struct timespec ts;
 
- 	char *temp, *token, *inputCopy = malloc(sizeof(input));
-    	int index, i;
-    	strcpy(inputCopy, input);
-
-    	cmdStr[0] = malloc(sizeof(cmdStr[0]));
- 	cmdStr[0] = strtok(input, DELIMS);
-
- 	if(cmdStr[0] == NULL)
- 		return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
 
- 	/* If the input includes an alias invoke, then it must be processed. */
- 	index = alias_check(cmdStr[0]);
-    
- 	if(index >= 0){
- 		temp = malloc(sizeof(temp));
- 		strcpy(temp, alias_array[index].alias_cmd);
- 		while ( (token = strtok(NULL, DELIMS) ) != NULL) {
- 			strcat(temp, " ");
- 			strcat(temp, token);
- 		}
- 		return tokenise(temp);
- 	}
+/* Synopsis:
+ * void trace_event(const char *name, uint64_t start, const char *detail, long value)
+ *
+ * Description:
+ * The function records a span which began at start and ends now in
+ * the trace ring, for the flusher thread to write out. Only the shell
+ * adds events and only the flusher removes them, so the ring needs
+ * no lock. When the flusher has fallen a whole ring behind the event
+ * is dropped and counted rather than making the shell wait. detail is
+ * copied, cut to TRACE_DETAIL - 1 characters.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trace_event(const char *name, uint64_t start, const char *detail, long value){
+    uint64_t head = trace_head, tail = __atomic_load_n(&trace_tail, __ATOMIC_ACQUIRE);
+    TraceEvent *event;
 
-    	i = 1;
- 	while ( (token = strtok(NULL, DELIMS) ) != NULL) {
+    if(head - tail >= TRACE_EVENTS){
+        trace_dropped++;
+        return;
+    }
+    event = &trace_ring[head & (TRACE_EVENTS - 1)];
+    event->start = start;
+    event->duration = trace_clock() - start;
+    event->name = name;
+    event->value = value;
+    strncpy(event->detail, detail != NULL ? detail : "", TRACE_DETAIL - 1);
+    event->detail[TRACE_DETAIL - 1] = '\0';
+    __atomic_store_n(&trace_head, head + 1, __ATOMIC_RELEASE);
+}
 
- 		cmdStr[i] = malloc(sizeof(cmdStr[i]));
- 		strcpy(cmdStr[i], token);
- 		i++;
+/* Synopsis:
+ * void trace_flush()
+ *
+ * Description:
+ * The function writes the trace output gathered in trace_buf to the
+ * trace file. The buffer is the flusher's own rather than a stdio
+ * one, so children forked meanwhile have nothing to write out when
+ * they exit.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trace_flush(){
+    size_t done = 0;
+    ssize_t n;
 
- 		if (i >= 50) {
- 			puts("Error: Too many parameters\n");
- 			return 0;
- 		}
- 	}
- 	return 1;
+    while(done < trace_buf_len){
+        if((n = write(trace_fd, trace_buf + done, trace_buf_len - done)) < 0){
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    trace_buf_len = 0;
 }
 
-/* Command Functions */
-
 /* Synopsis:
- * void pwd()
+ * void trace_write(TraceEvent *event)
  *
  * Description:
- * The function prints out current working directory.
+ * The function adds event to the trace output, as a complete ("X")
+ * event of the Chrome trace format or as one JSON line.
  *
  * Returns:
- * The function has return type void
+ * The function has return type void.
  */
-void pwd(){
-    char cwd[1024];
-    if (getcwd(cwd, sizeof(cwd)) != NULL)
-        fprintf(stdout, "%s\n", cwd);
+void trace_write(TraceEvent *event){
+    char detail[TRACE_DETAIL * 6], *out = detail;
+    unsigned char *c;
+
+    for(c = (unsigned char *)event->detail; *c != '\0'; c++){
+        if(*c == '"' || *c == '\\')
+            *out++ = '\\';
+        if(*c < 0x20)
+            out += sprintf(out, "\\u%04x", *c);
+        else
+            *out++ = *c;
+    }
+    *out = '\0';
+
+    if(trace_buf_len + sizeof(detail) + 256 > TRACE_BUFFER)
+        trace_flush();
+    if(trace_chrome)
+        trace_buf_len += sprintf(trace_buf + trace_buf_len, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"detail\":\"%s\",\"value\":%ld}},\n",
+                event->name, event->start / 1e3, event->duration / 1e3, (int)trace_pid, (int)trace_pid,
+                detail, event->value);
     else
-        perror("getcwd() error");
+        trace_buf_len += sprintf(trace_buf + trace_buf_len, "{\"ts_ns\":%llu,\"dur_ns\":%llu,\"name\":\"%s\","
+                "\"pid\":%d,\"detail\":\"%s\",\"value\":%ld}\n", (unsigned long long)event->start,
+                (unsigned long long)event->duration, event->name, (int)trace_pid, detail, event->value);
 }
 
 /* Synopsis:
- * void cd()
+ * void *trace_flusher(void *arg)
  *
  * Description:
- * The function changes working directory to either HOME directory if
- * no extra parameters provided or to working directory provided
- * by the user.
+ * The function is the flusher thread. Every TRACE_FLUSH_MS, or at
+ * once when tracing stops, it writes out the events in the ring and
+ * frees their slots.
  *
  * Returns:
- * The function has return type void
+ * NULL once tracing has stopped and every event is written.
  */
-void cd(){
-    errno = 0;
-    if (!cmdStr[2]){ /* Check if not too many arguments provided. */
-        if (!cmdStr[1]) { /* Check if new directory chosen. */
-            chdir(getenv("HOME")); /* If no, change to HOME directory. */
-            if (errno != 0 ){
-                perror("Error changing dir");
-            } 
-	    else{
-                pwd(); /* Print new working directory. */
-            }
-        }
-   	else {
-            chdir(cmdStr[1]); /* Change to working directory provided by user. */
-            if (errno != 0 ){
-                perror("Error changing dir");
-            }
-	    else{
-                pwd();
-            }
+void *trace_flusher(void *arg){
+    struct timespec wake;
+    uint64_t head, tail = trace_tail;
+    int stopping;
+
+    (void)arg;
+    pthread_mutex_lock(&trace_lock);
+    do{
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+        wake.tv_sec += wake.tv_nsec / 1000000000L;
+        wake.tv_nsec %= 1000000000L;
+        if(!trace_stopping)
+            pthread_cond_timedwait(&trace_wake, &trace_lock, &wake);
+        stopping = trace_stopping;
+        pthread_mutex_unlock(&trace_lock);
+
+        head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+        for(; tail != head; tail++){
+            trace_write(&trace_ring[tail & (TRACE_EVENTS - 1)]);
+            if((tail & 255) == 255) /* Hand slots back as we go. */
+                __atomic_store_n(&trace_tail, tail + 1, __ATOMIC_RELEASE);
         }
-    }
-    else{
-        printf("chdir: Error too many arguments\n");
-    }
-    return;
+        __atomic_store_n(&trace_tail, tail, __ATOMIC_RELEASE);
+        trace_flush();
+
+        pthread_mutex_lock(&trace_lock);
+    } while(!stopping);
+    pthread_mutex_unlock(&trace_lock);
+    return NULL;
 }
 
 /* Synopsis:
- * void add_history(char *input)
+ * void trace_forked()
  *
  * Description:
- * The function adds new command to the history. If history is full,
- * then first command in history is removed, the rest of the commands are shifted
- * to the beginning of the array and new command is added to the end of the array.
+ * The function runs in the child of every fork. The flusher thread
+ * is not copied, so the child must not add events its parent would
+ * never see.
  *
  * Returns:
  * The function has return type void.
  */
-void add_history(char *input){
-    /* If history is full .. */
-    if (history_counter == 20){
-	/* .. then shift all commands except first one
-	 * to the beginning of the array .. */
-        int i = 0;
-        while (i < 19){
-            history[i] = history[i+1];
-            i++;
-        }
-		/* .. and add new command to the end of the array. */
-        history[19] = NULL;
-        history[19] = strdup(input);
-    }
-    /* If history is not full then add command. */
-    history[history_counter] = strdup(input);
-    /* If history is not full, increment counter. */
-    if (history_counter < 20)
-        history_counter++;
+void trace_forked(){
+    tracing = 0;
+    trace_fd = -1;
 }
 
 /* Synopsis:
- * void invoke_history()
+ * void trace_stop()
  *
  * Description:
- * The function invokes and runs a command from history.
- * '!!' runs last command
- * '!<no.>' runs command specified by <no.>.
+ * The function stops tracing, waits for the flusher thread to write
+ * out the remaining events and closes the trace file. It is also run
+ * at exit.
  *
  * Returns:
  * The function has return type void.
  */
-void invoke_history(){
-    if(!cmdStr[1]){ /* Check if valid number of arguments. */
-        char *input = NULL, *copy = NULL;
+void trace_stop(){
+    if(!tracing)
+        return;
+    tracing = 0;
+    pthread_mutex_lock(&trace_lock);
+    trace_stopping = 1;
+    pthread_cond_signal(&trace_wake);
+    pthread_mutex_unlock(&trace_lock);
+    pthread_join(trace_thread, NULL);
+
+    if(trace_chrome)
+        trace_buf_len += sprintf(trace_buf + trace_buf_len, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"bashshell\",\"dropped\":%lu}}\n]\n", (int)trace_pid, trace_dropped);
+    else if(trace_dropped > 0)
+        trace_buf_len += sprintf(trace_buf + trace_buf_len, "{\"name\":\"dropped\",\"pid\":%d,\"value\":%lu}\n",
+                (int)trace_pid, trace_dropped);
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+/* Synopsis:
+ * int trace_start(const char *path, int chrome)
+ *
+ * Description:
+ * The function starts tracing to the file path, in the Chrome trace
+ * format if chrome is set or as JSON lines otherwise, and starts the
+ * flusher thread. Tracing already in progress is stopped first.
+ *
+ * Returns:
+ * 0 if tracing started.
+ * -1 with errno set otherwise.
+ */
+int trace_start(const char *path, int chrome){
+    static int registered;
+    int err;
+
+    trace_stop();
+    if((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    if(trace_ring == NULL){
+        trace_ring = malloc(TRACE_EVENTS * sizeof(TraceEvent));
+        trace_buf = malloc(TRACE_BUFFER);
+    }
+    if(!registered){
+        pthread_atfork(NULL, NULL, trace_forked);
+        atexit(trace_stop);
+        registered = 1;
+    }
+    trace_chrome = chrome;
+    trace_pid = getpid();
+    trace_head = trace_tail = 0;
+    trace_dropped = 0;
+    trace_stopping = 0;
+    trace_buf_len = 0;
+    if(chrome)
+        trace_buf_len = sprintf(trace_buf, "[\n");
+    if((err = pthread_create(&trace_thread, NULL, trace_flusher, NULL)) != 0){
+        close(trace_fd);
+        trace_fd = -1;
+        errno = err;
+        return -1;
+    }
+    tracing = 1;
+    return 0;
+}
+
+/* Synopsis:
+ * void trace()
+ *
+ * Description:
+ * The function implements the trace builtin.
+ * 'trace on file [jsonl|chrome]' starts tracing to file.
+ * 'trace off' stops it and writes out what is left.
+ * 'trace' tells whether tracing is on and how many events were dropped.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trace(){
+    int chrome = 0;
+
+    if(cmdStr[1] == NULL){
+        if(tracing)
+            printf("tracing, %llu events, %lu dropped\n", (unsigned long long)trace_head, trace_dropped);
+        else
+            puts("not tracing");
+    }
+    else if(strcmp(cmdStr[1], "off") == 0 && cmdStr[2] == NULL)
+        trace_stop();
+    else if(strcmp(cmdStr[1], "on") == 0 && cmdStr[2] != NULL &&
+            (cmdStr[3] == NULL || ((chrome = strcmp(cmdStr[3], "chrome") == 0) || strcmp(cmdStr[3], "jsonl") == 0))){
+        if(trace_start(cmdStr[2], chrome) < 0){
+            printf("TRACE: Error %s: %s\n", cmdStr[2], strerror(errno));
+            last_status = 1;
+        }
+    }
+    else{
+        puts("TRACE: Usage: trace [on file [jsonl|chrome] | off]");
+        last_status = 2;
+    }
+}
+
+/* Synopsis:
+ * void trace_env()
+ *
+ * Description:
+ * The function starts tracing at startup when SHELL_TRACE names a
+ * file, in the format SHELL_TRACE_FORMAT gives, jsonl by default.
+ * Both are then removed from the environment, so a shell started by
+ * this one does not truncate the same file.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trace_env(){
+    const char *path = getenv("SHELL_TRACE"), *format = getenv("SHELL_TRACE_FORMAT");
+
+    if(path == NULL || *path == '\0')
+        return;
+    if(trace_start(path, format != NULL && strcmp(format, "chrome") == 0) < 0)
+        fprintf(stderr, "SHELL_TRACE: %s: %s\n", path, strerror(errno));
+    unsetenv("SHELL_TRACE");
+    unsetenv("SHELL_TRACE_FORMAT");
+}
+
+/* Alias Commands */
+
+/* Synopsis:
+ * int alias_check(char *alias)
+ *
+ * Description:
+ * The function checks whether the alias user wants to use
+ * has already been used by looking it up in alias_table[],
+ * an open addressing hash table probed linearly from the
+ * slot the name hashes to.
+ *
+ * Returns:
+ * Slot of this alias in alias_table[] if alias has already been used.
+ * -1 if alias has not been used.
+ */
+int alias_check(char *alias){
+    int i;
+
+    if(alias_counter == 0)
+        return -1;
+    i = hash_string(alias) & (alias_capacity - 1);
+	while(alias_table[i].alias_name != NULL){
+		if(strcmp(alias_table[i].alias_name, alias) == 0)
+			return i;
+        i = (i + 1) & (alias_capacity - 1);
+	}
+	return -1;
+}
+
+/* Synopsis:
+ * int alias_slot(const char *alias)
+ *
+ * Description:
+ * The function finds the slot of alias_table[] where alias is stored
+ * or should be stored, growing the table first if it is over
+ * ALIAS_LOAD_PERCENT full so probe sequences stay short.
+ *
+ * Returns:
+ * Slot for alias.
+ */
+int alias_slot(const char *alias){
+    Alias *old = alias_table;
+    int old_capacity = alias_capacity, i, j;
+
+    if((alias_counter + 1) * 100 >= alias_capacity * ALIAS_LOAD_PERCENT){
+        alias_capacity = alias_capacity ? alias_capacity * 2 : 16;
+        alias_table = calloc(alias_capacity, sizeof(Alias));
+        for(i = 0; i < old_capacity; i++){
+            if(old[i].alias_name == NULL)
+                continue;
+            j = hash_string(old[i].alias_name) & (alias_capacity - 1);
+            while(alias_table[j].alias_name != NULL)
+                j = (j + 1) & (alias_capacity - 1);
+            alias_table[j] = old[i];
+        }
+        free(old);
+    }
+
+    i = hash_string(alias) & (alias_capacity - 1);
+    while(alias_table[i].alias_name != NULL && strcmp(alias_table[i].alias_name, alias) != 0)
+        i = (i + 1) & (alias_capacity - 1);
+    return i;
+}
+
+/* Synopsis:
+ * void free_alias(Alias *entry)
+ *
+ * Description:
+ * The function releases the strings owned by an alias and
+ * marks its slot empty.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void free_alias(Alias *entry){
+	free(entry->alias_name);
+	free(entry->alias_cmd);
+	free(entry->alias_words);
+	free(entry->alias_argv);
+	memset(entry, 0, sizeof(Alias));
+}
+
+/* Synopsis:
+ * int compare_alias(const void *a, const void *b)
+ *
+ * Description:
+ * The function orders aliases by name for qsort().
+ *
+ * Returns:
+ * Result of comparing the names with strcmp().
+ */
+int compare_alias(const void *a, const void *b){
+	return strcmp((*(Alias * const *)a)->alias_name, (*(Alias * const *)b)->alias_name);
+}
+
+/* Synopsis:
+ * void print_alias()
+ *
+ * Description:
+ * The function prints out all aliases and their corresponding
+ * commands stored in alias_table[] in order of name. If there
+ * are no aliases then error message is printed out.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void print_alias(){
+	Alias **sorted;
+	int i, n = 0;
+
+	if(alias_counter == 0){
+		puts("Error: There are no aliases recognized.");
+		return;
+	}
+	sorted = malloc(alias_counter * sizeof(Alias *));
+	for(i = 0; i < alias_capacity; i++)
+		if(alias_table[i].alias_name != NULL)
+			sorted[n++] = &alias_table[i];
+	qsort(sorted, n, sizeof(Alias *), compare_alias);
+	for(i = 0; i < n; i++)
+		printf("Alias: %s\tCommand: %s\n", sorted[i]->alias_name, sorted[i]->alias_cmd);
+	free(sorted);
+}
+
+/* Synopsis:
+ * int alias_loops(const char *name, const char *word)
+ *
+ * Description:
+ * The function follows the chain of aliases starting at word, the
+ * first word of a new command for alias name, to check whether it
+ * leads back to name. Aliases are checked as they are added, so an
+ * existing chain never loops and is at most alias_counter long.
+ *
+ * Returns:
+ * 1 if aliasing word as name would create a cycle.
+ * 0 otherwise.
+ */
+int alias_loops(const char *name, const char *word){
+	int index, depth;
+
+	for(depth = 0; depth <= alias_counter; depth++){
+		if(strcmp(word, name) == 0)
+			return 1;
+		if((index = alias_check((char *)word)) < 0)
+			return 0;
+		word = alias_table[index].alias_argv[0];
+	}
+	return 1;
+}
+
+/* Synopsis:
+ * void set_alias(int index)
+ *
+ * Description:
+ * The function stores cmdStr[1] as the name and the remaining
+ * words of cmdStr[] as the command of alias_table[index]. Both
+ * are copied, as cmdStr[] only points into the input line. The
+ * command is also kept as a copy of its words so expanding the
+ * alias needs no parsing. The words are not split again, as a
+ * variable or file name may have put spaces in one.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void set_alias(int index){
+	Alias entry;
+	size_t len = 1;
+	char *cmd, *words;
+	int i, n;
+
+	for(i = 2; cmdStr[i] != NULL; i++)
+		len += strlen(cmdStr[i]) + 1;
+
+	/* Build the new entry before freeing the old one, cmdStr[] may point into it. */
+	entry.alias_name = strdup(cmdStr[1]);
+	entry.alias_cmd = cmd = malloc(len);
+	entry.alias_words = words = malloc(len);
+	entry.alias_argv = malloc((i - 1) * sizeof(char *));
+	*cmd = '\0';
+	/* Add new command with all its parameters. */
+	for(n = 0, i = 2; cmdStr[i] != NULL; i++){
+		cmd = stpcpy(stpcpy(cmd, cmdStr[i]), " ");
+		entry.alias_argv[n++] = words;
+		words = stpcpy(words, cmdStr[i]) + 1;
+	}
+	entry.alias_argv[n] = NULL;
+
+	if(alias_table[index].alias_name == NULL)
+		alias_counter++; /* Increment total number of aliases. */
+	else
+		free_alias(&alias_table[index]);
+	alias_table[index] = entry;
+}
+
+/* Synopsis:
+ * void add_alias()
+ *
+ * Description:
+ * The function adds new alias with its corresponding command
+ * to alias_table[]. Several checks are done before adding:
+ * - Whether there is a valid number of parameters
+ * - Whether user is not trying to create alias equal
+ *   to the command name;
+ * - Whether the aliased command leads back to the alias
+ *   through other aliases;
+ * - Whether user is not trying to use already used alias.
+ * If successful, new alias is created and counter is incremented.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_alias(){
+
+	/* Check to prevent invalid number of arguments and 
+	 * prevent having alias same as command name. */
+	if(cmdStr[2] == NULL || strcmp(cmdStr[1], cmdStr[2]) == 0){
+		puts("Error: Invalid alias");
+		return;
+	}
+
+	/* Aliases may name other aliases, as long as they don't loop. */
+	if(alias_loops(cmdStr[1], cmdStr[2])){
+		puts("Error: Alias would create a cycle.");
+		return;
+	}
+
+	/* Check whether desired alias has been already used. */
+	if(alias_check(cmdStr[1]) >= 0) /* The alias has been used, so display appropriate message .. */
+		puts("Warning: An alias with this name already exists. Proceeding to overwrite."); 
+
+	/* .. and add or override it. */
+	set_alias(alias_slot(cmdStr[1]));
+}
+
+/* Synopsis:
+ * void alias()
+ *
+ * Description:
+ * The function checks what user intended to do,
+ * add new alias or print all aliases.
+ * This is done by checking whether 'aliases' is followed 
+ * by any parameters and then appropriate function is called.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void alias(){
+
+	if(cmdStr[1] == NULL)
+		print_alias();
+
+	else
+		add_alias();
+
+}
+
+/* Synopsis:
+ * void remove_alias()
+ *
+ * Description:
+ * The function removes alias from alias_table[] if it is present
+ * or displays error message if it is not. Entries after it in
+ * the same probe sequence are moved back so no tombstones are
+ * needed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void remove_alias(){
+    int i, j, home, index;
+
+	/* Get slot of alias in alias_table[] if it is there. */
+	index = alias_check(cmdStr[1]);
+	if(index >= 0){
+		free_alias(&alias_table[index]);
+		alias_counter--;
+		/* Backward shift: pull later entries into the hole when
+		 * the hole lies between their home slot and where they are. */
+		i = index;
+		j = index;
+		while(1){
+			j = (j + 1) & (alias_capacity - 1);
+			if(alias_table[j].alias_name == NULL)
+				break;
+			home = hash_string(alias_table[j].alias_name) & (alias_capacity - 1);
+			if(((j - home) & (alias_capacity - 1)) >= ((j - i) & (alias_capacity - 1))){
+				alias_table[i] = alias_table[j];
+				memset(&alias_table[j], 0, sizeof(Alias));
+				i = j;
+			}
+		}
+	}
+	else{
+		puts("Error: Alias does not exist.");
+		last_status = 1;
+	}
+}
+
+/* Synopsis:
+ * int expand_alias(char *word, int depth)
+ *
+ * Description:
+ * The function appends the stored words of alias word to cmdStr[].
+ * If the first of those words is an alias too it is expanded in
+ * turn. depth guards against loops, which add_alias() refuses.
+ *
+ * Returns:
+ * 1 if word was an alias and has been expanded.
+ * 0 if word is not an alias.
+ */
+int expand_alias(char *word, int depth){
+	char **words;
+	int index;
+
+	if(depth > alias_counter || (index = alias_check(word)) < 0)
+		return 0;
+	words = alias_table[index].alias_argv;
+	if(!expand_alias(words[0], depth + 1))
+		push_cmdstr(words[0]);
+	while(*++words != NULL)
+		push_cmdstr(*words);
+	return 1;
+}
+
+/* Synopsis:
+ * void scan_init(Scanner *scan, char *input)
+ *
+ * Description:
+ * The function starts a scan over input. Words are terminated in
+ * place, so input is modified by the scan.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void scan_init(Scanner *scan, char *input){
+    scan->next = input;
+    scan->held = NULL;
+}
+
+/* Synopsis:
+ * char *scan_operator(char **pos)
+ *
+ * Description:
+ * The function reads the operator at *pos and moves *pos past it.
+ * '>>', '<<' and '<<<' are read as one operator.
+ *
+ * Returns:
+ * The operator as a constant string.
+ */
+char *scan_operator(char **pos){
+    char op = *(*pos)++;
+
+    if(op == '>' && **pos == '>'){
+        (*pos)++;
+        return ">>";
+    }
+    if(op == '<' && **pos == '<'){
+        if(*++(*pos) != '<')
+            return "<<";
+        (*pos)++;
+        return "<<<";
+    }
+    return op == '|' ? "|" : op == '&' ? "&" : op == '<' ? "<" : ">";
+}
+
+/* Synopsis:
+ * char *scan_token(Scanner *scan)
+ *
+ * Description:
+ * The function splits a command line into tokens in the same way as
+ * strtok() does with DELIMS, except that the pipe, background and
+ * redirection operators are returned as tokens of their own even when
+ * not surrounded by spaces. A '\' before a space, tab or operator
+ * keeps that character in the word and is removed.
+ *
+ * Returns:
+ * The next token.
+ * NULL at the end of the line.
+ */
+char *scan_token(Scanner *scan){
+    char *start, *end, *out;
+
+    if(scan->held != NULL){
+        start = scan->held;
+        scan->held = NULL;
+        return start;
+    }
+
+    scan->next += strspn(scan->next, DELIMS);
+    if(*scan->next == '\0' || *scan->next == '#') /* A word starting with '#' begins a comment. */
+        return NULL;
+    if(strchr(OPERATORS, *scan->next) != NULL)
+        return scan_operator(&scan->next);
+
+    start = out = scan->next;
+    for(;;){
+        end = scan->next + strcspn(scan->next, "\\" DELIMS OPERATORS);
+        if(out != scan->next) /* Only after an escape. */
+            memmove(out, scan->next, end - scan->next);
+        out += end - scan->next;
+        scan->next = end;
+        if(*end != '\\')
+            break;
+        if(end[1] != '\0' && strchr(DELIMS OPERATORS, end[1]) != NULL) /* Escaped, part of the word. */
+            end++;
+        *out++ = *end;
+        scan->next = end + 1;
+    }
+    if(*end != '\0' && strchr(OPERATORS, *end) != NULL)
+        scan->held = scan_operator(&scan->next);
+    else if(*end != '\0')
+        scan->next++;
+    *out = '\0';
+    return start;
+}
+
+/* Synopsis:
+ * int tokenise(char *input)
+ *
+ * Description:
+ * The function takes user input and parses it into tokens in
+ * cmdStr[], expanding an alias in the first word and wildcards
+ * in the others, except in history invocations and file names
+ * of redirections.
+ *
+ * Returns:
+ * 0 if the line has no tokens.
+ * 1 if cmdStr[] holds the command.
+ */
+int tokenise(char *input){
+
+ 	char *token;
+ 	Scanner scan;
+ 	int history_line;
+ 	uint64_t started, alias_started;
+
+ 	TRACE_START(started);
+ 	reset_cmdstr();
+ 	scan_init(&scan, input);
+ 	if((token = scan_token(&scan)) == NULL)
+ 		return 0;
+
+ 	/* If the input includes an alias invoke, then its stored words are used. */
+ 	if(token[0] != '!')
+ 		token = expand_vars(token);
+ 	TRACE_START(alias_started);
+ 	if(!expand_alias(token, 0))
+ 		push_cmdstr(token);
+ 	else
+ 		TRACE_END(alias_started, "alias", token, cmd_len);
+
+ 	/* Tokens live in the input line, which outlives the command. */
+ 	history_line = cmdStr[0][0] == '!';
+ 	while ( (token = scan_token(&scan) ) != NULL){
+ 		if (!history_line)
+ 			token = expand_vars(token);
+ 		if (history_line || is_redirect(cmdStr[cmd_len - 1]) || !has_glob(token) || expand_glob(token) == 0)
+ 			push_cmdstr(token);
+ 	}
+ 	TRACE_END(started, "tokenise", cmdStr[0], cmd_len);
+ 	return 1;
+}
+
+/* Command Functions */
+
+/* Synopsis:
+ * void getpath()
+ *
+ * Description:
+ * The function prints out the current PATH.
+ *
+ * Returns:
+ * The function has return type void
+ */
+void getpath(){
+    printf("%s\n",getenv("PATH"));
+}
+
+/* Synopsis:
+ * void setpath()
+ *
+ * Description:
+ * The function sets PATH to the path provided by the user and
+ * drops the command lookups made with the old one.
+ *
+ * Returns:
+ * The function has return type void
+ */
+void setpath(){
+    const char *path=cmdStr[1];
+    if(setenv("PATH",path,1)<0){
+        perror("Error setting path: ");
+        last_status = 1;
+    }
+    else{
+        hash_clear(); /* Cached lookups belong to the old PATH. */
+        env_changed();
+    }
+}
+
+/* Synopsis:
+ * void pwd()
+ *
+ * Description:
+ * The function prints out current working directory.
+ *
+ * Returns:
+ * The function has return type void
+ */
+void pwd(){
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        fprintf(stdout, "%s\n", cwd);
+    else
+        perror("getcwd() error");
+}
+
+/* Synopsis:
+ * void cd()
+ *
+ * Description:
+ * The function changes working directory to either HOME directory if
+ * no extra parameters provided or to working directory provided
+ * by the user.
+ *
+ * Returns:
+ * The function has return type void
+ */
+void cd(){
+    errno = 0;
+    if (!cmdStr[1]) { /* Check if new directory chosen. */
+        chdir(getenv("HOME")); /* If no, change to HOME directory. */
+        if (errno != 0 ){
+            perror("Error changing dir");
+            last_status = 1;
+        } 
+        else{
+            pwd(); /* Print new working directory. */
+        }
+    }
+    else {
+        chdir(cmdStr[1]); /* Change to working directory provided by user. */
+        if (errno != 0 ){
+            perror("Error changing dir");
+            last_status = 1;
+        }
+        else{
+            pwd();
+        }
+    }
+    return;
+}
+
+/* History Index */
+
+/* Synopsis:
+ * unsigned int trigram_hash(unsigned int trigram)
+ *
+ * Description:
+ * The function spreads the bits of a packed trigram for use as
+ * a slot number in trigram_table[].
+ *
+ * Returns:
+ * The hash of trigram.
+ */
+unsigned int trigram_hash(unsigned int trigram){
+    unsigned int hash = trigram * 2654435761u;
+    return hash ^ (hash >> 15);
+}
+
+/* Synopsis:
+ * Posting *trigram_find(unsigned int trigram)
+ *
+ * Description:
+ * The function looks up the posting list of trigram.
+ *
+ * Returns:
+ * The posting list of trigram.
+ * NULL if no entry in history has held trigram.
+ */
+Posting *trigram_find(unsigned int trigram){
+    unsigned int i;
+
+    if(trigram_capacity == 0)
+        return NULL;
+    i = trigram_hash(trigram) & (trigram_capacity - 1);
+    while(trigram_table[i].trigram != 0){
+        if(trigram_table[i].trigram == trigram)
+            return &trigram_table[i];
+        i = (i + 1) & (trigram_capacity - 1);
+    }
+    return NULL;
+}
+
+/* Synopsis:
+ * void prune_posting(Posting *posting)
+ *
+ * Description:
+ * The function drops the entries which have left the history ring
+ * from the front of a posting list, moving the rest down once
+ * half of the list is unused.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void prune_posting(Posting *posting){
+    unsigned int oldest = history_total - history_counter;
+
+    while(posting->start < posting->len && posting->seqs[posting->start] < oldest)
+        posting->start++;
+    if(posting->start > 0 && posting->start * 2 >= posting->len){
+        memmove(posting->seqs, posting->seqs + posting->start,
+                (posting->len - posting->start) * sizeof(unsigned int));
+        posting->len -= posting->start;
+        posting->start = 0;
+    }
+}
+
+/* Synopsis:
+ * void rebuild_index(int capacity)
+ *
+ * Description:
+ * The function moves every posting list into a new trigram_table[]
+ * of capacity slots, pruning each one first and freeing those left
+ * empty, so trigrams no longer in history stop taking up memory.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void rebuild_index(int capacity){
+    Posting *old = trigram_table;
+    int old_capacity = trigram_capacity, i;
+    unsigned int j;
+
+    trigram_table = calloc(capacity, sizeof(Posting));
+    trigram_capacity = capacity;
+    trigram_count = 0;
+    for(i = 0; i < old_capacity; i++){
+        if(old[i].trigram == 0)
+            continue;
+        prune_posting(&old[i]);
+        if(old[i].start == old[i].len){
+            free(old[i].seqs);
+            continue;
+        }
+        j = trigram_hash(old[i].trigram) & (capacity - 1);
+        while(trigram_table[j].trigram != 0)
+            j = (j + 1) & (capacity - 1);
+        trigram_table[j] = old[i];
+        trigram_count++;
+    }
+    free(old);
+}
+
+/* Synopsis:
+ * Posting *trigram_slot(unsigned int trigram)
+ *
+ * Description:
+ * The function finds the posting list of trigram, adding an empty
+ * one if there is none. The table is rebuilt with twice the slots
+ * before it gets ALIAS_LOAD_PERCENT full.
+ *
+ * Returns:
+ * The posting list of trigram.
+ */
+Posting *trigram_slot(unsigned int trigram){
+    unsigned int i;
+
+    if((trigram_count + 1) * 100 >= trigram_capacity * ALIAS_LOAD_PERCENT)
+        rebuild_index(trigram_capacity ? trigram_capacity * 2 : 1024);
+
+    i = trigram_hash(trigram) & (trigram_capacity - 1);
+    while(trigram_table[i].trigram != 0 && trigram_table[i].trigram != trigram)
+        i = (i + 1) & (trigram_capacity - 1);
+    if(trigram_table[i].trigram == 0){
+        trigram_table[i].trigram = trigram;
+        trigram_count++;
+    }
+    return &trigram_table[i];
+}
+
+/* Synopsis:
+ * void index_history(const char *entry, unsigned int seq)
+ *
+ * Description:
+ * The function adds history entry number seq to the posting list
+ * of every trigram in it. Entries are numbered in the order they
+ * are stored, so each list stays sorted oldest first.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void index_history(const char *entry, unsigned int seq){
+    const unsigned char *text = (const unsigned char *)entry;
+    unsigned int trigram;
+    Posting *posting;
+
+    if(text[0] == '\0' || text[1] == '\0')
+        return;
+    for(; text[2] != '\0'; text++){
+        trigram = text[0] << 16 | text[1] << 8 | text[2];
+        posting = trigram_slot(trigram);
+        prune_posting(posting);
+        /* Skip a trigram this entry has already added. */
+        if(posting->len > posting->start && posting->seqs[posting->len - 1] == seq)
+            continue;
+        if(posting->len == posting->cap){
+            posting->cap = posting->cap ? posting->cap * 2 : 4;
+            posting->seqs = realloc(posting->seqs, posting->cap * sizeof(unsigned int));
+        }
+        posting->seqs[posting->len++] = seq;
+    }
+}
+
+/* Synopsis:
+ * int search_history(const char *pattern, int (*visit)(int, void *), void *arg)
+ *
+ * Description:
+ * The function finds the commands in history which contain pattern
+ * and calls visit with the number of each, counting from 0 for the
+ * oldest, and arg, newest first until visit returns 0. Candidates are
+ * taken in one pass down the shortest posting list of the pattern's
+ * trigrams, the other lists being walked down alongside it, and are
+ * confirmed with strstr(). Patterns shorter than a trigram are
+ * searched for directly.
+ *
+ * Returns:
+ * Number of matching commands visited.
+ */
+int search_history(const char *pattern, int (*visit)(int, void *), void *arg){
+    const unsigned char *text = (const unsigned char *)pattern;
+    unsigned int oldest = history_total - history_counter, seq;
+    size_t len = strlen(pattern);
+    Posting **postings, *posting, *rarest = NULL;
+    int npostings = 0, found = 0, *next, i, j, k;
+
+    if(len < 3){
+        for(i = history_counter - 1; i >= 0; i--)
+            if(strstr(history_entry(i), pattern) != NULL && (found++, !visit(i, arg)))
+                break;
+        return found;
+    }
+
+    /* The lists and a position in each, in one allocation. */
+    postings = arena_alloc(&line_arena, (len - 2) * (sizeof(Posting *) + sizeof(int)));
+    next = (int *)(postings + (len - 2));
+    for(; text[2] != '\0'; text++){
+        if((posting = trigram_find(text[0] << 16 | text[1] << 8 | text[2])) == NULL)
+            return 0;
+        prune_posting(posting);
+        for(j = 0; j < npostings && postings[j] != posting; j++)
+            ;
+        if(j < npostings)
+            continue;
+        next[npostings] = posting->len - 1;
+        postings[npostings++] = posting;
+        if(rarest == NULL || posting->len - posting->start < rarest->len - rarest->start)
+            rarest = posting;
+    }
+
+    for(k = rarest->len - 1; k >= rarest->start; k--){
+        seq = rarest->seqs[k];
+        if(seq >= oldest + history_counter)
+            continue;
+        for(j = 0; j < npostings; j++){
+            posting = postings[j];
+            while(next[j] >= posting->start && posting->seqs[next[j]] > seq)
+                next[j]--;
+            if(next[j] < posting->start)
+                return found; /* No older entry holds this trigram. */
+            if(posting->seqs[next[j]] != seq)
+                break;
+        }
+        if(j == npostings && strstr(history_entry(seq - oldest), pattern) != NULL && (found++, !visit(seq - oldest, arg)))
+            break;
+    }
+    return found;
+}
+
+/* Synopsis:
+ * char *history_entry(int n)
+ *
+ * Description:
+ * The function finds the nth command in history, counting from 0
+ * for the oldest.
+ *
+ * Returns:
+ * The command.
+ */
+char *history_entry(int n){
+    return history[(history_head + n) % history_capacity];
+}
+
+/* Synopsis:
+ * void free_history(char *entry)
+ *
+ * Description:
+ * The function releases a command dropped from history. Commands
+ * loaded from the history file live in its mapping and are not
+ * freed, the mapping is unmapped once none of them is left.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void free_history(char *entry){
+    if (entry >= history_map && entry < history_map + history_map_size){
+        if (--history_mapped == 0){
+            munmap(history_map, history_map_size);
+            history_map = NULL;
+            history_map_size = 0;
+        }
+    }
+    else
+        free(entry);
+}
+
+/* Synopsis:
+ * void store_history(char *entry)
+ *
+ * Description:
+ * The function puts entry at the end of the history ring, which
+ * takes ownership of it. If history is full the oldest command is
+ * freed and its slot reused, so no entries are moved.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void store_history(char *entry){
+    if (history_counter == history_capacity){
+        free_history(history[history_head]);
+        history[history_head] = entry;
+        history_head = (history_head + 1) % history_capacity;
+        /* Once per ring's worth of evictions, drop index entries
+         * for commands no longer in history. */
+        if ((history_total + 1) % history_capacity == 0)
+            rebuild_index(trigram_capacity);
+    }
+    else {
+        history[(history_head + history_counter) % history_capacity] = entry;
+        history_counter++;
+    }
+    index_history(entry, history_total++);
+}
+
+/* Synopsis:
+ * void sync_history()
+ *
+ * Description:
+ * The function flushes appended commands to disk.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void sync_history(){
+    uint64_t started;
+
+    if (history_fd >= 0 && history_unsynced > 0){
+        TRACE_START(started);
+        fdatasync(history_fd);
+        TRACE_END(started, "history_sync", history_path, history_unsynced);
+    }
+    history_unsynced = 0;
+    history_synced = time(NULL);
+}
+
+/* Synopsis:
+ * char *history_command(char *record, uint64_t *session)
+ *
+ * Description:
+ * The function splits a line of the history file of the form
+ * ': <time>:<session>;<command>' into its command and session.
+ * Lines without the prefix, as older shells wrote them, are taken
+ * as a command from no session.
+ *
+ * Returns:
+ * Pointer to the command within record.
+ */
+char *history_command(char *record, uint64_t *session){
+    char *end;
+
+    *session = 0;
+    if (record[0] != ':' || record[1] != ' ' || !isdigit((unsigned char)record[2]))
+        return record;
+    strtol(record + 2, &end, 10);
+    if (*end != ':' || !isxdigit((unsigned char)end[1]))
+        return record;
+    *session = strtoull(end + 1, &end, 16);
+    if (*end != ';'){
+        *session = 0;
+        return record;
+    }
+    return end + 1;
+}
+
+/* Synopsis:
+ * void reopen_history()
+ *
+ * Description:
+ * The function opens the history file again after another session
+ * has compacted it and renamed a new file over the one this shell
+ * had open. The new file holds the tail of the old one, so reading
+ * resumes after the last record this shell read if it is still
+ * there and from the start of the file if it was trimmed away.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void reopen_history(){
+    struct stat st;
+    char *map, *pos, *start;
+    size_t last_len;
+    int fd;
+
+    if ((fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0)
+        return;
+    close(history_fd);
+    history_fd = fd;
+    history_unsynced = 0;
+    history_lines = history_counter;
+    history_seen = 0;
+    if (history_last == NULL || fstat(fd, &st) < 0 || st.st_size == 0 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        return;
+
+    /* Look for the last record read, newest first. */
+    last_len = strlen(history_last);
+    for (pos = map + st.st_size; pos > map; pos = start){
+        start = memrchr(map, '\n', pos - 1 - map);
+        start = start != NULL ? start + 1 : map;
+        if (pos[-1] == '\n' && (size_t)(pos - 1 - start) == last_len &&
+            memcmp(start, history_last, last_len) == 0){
+            history_seen = pos - map;
+            break;
+        }
+        if (start == map)
+            break;
+    }
+    munmap(map, st.st_size);
+}
+
+/* Synopsis:
+ * void merge_history()
+ *
+ * Description:
+ * The function adds the commands other sessions have appended to the
+ * history file since it was last read. Only the size of the file is
+ * checked when nothing has been added, and only the new records are
+ * read when something has. Records of this session are already in
+ * history and skipped.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void merge_history(){
+    struct stat st;
+    char *buf, *line, *newline, *command, *last = NULL;
+    uint64_t session;
+    ssize_t got;
+
+    if (history_fd < 0 || fstat(history_fd, &st) < 0)
+        return;
+    if (st.st_nlink == 0){
+        reopen_history();
+        if (fstat(history_fd, &st) < 0)
+            return;
+    }
+    if (st.st_size <= history_seen)
+        return;
+
+    buf = malloc(st.st_size - history_seen);
+    if ((got = pread(history_fd, buf, st.st_size - history_seen, history_seen)) <= 0){
+        free(buf);
+        return;
+    }
+    for (line = buf; (newline = memchr(line, '\n', buf + got - line)) != NULL; line = newline + 1){
+        *newline = '\0';
+        last = line;
+        command = history_command(line, &session);
+        if (session != history_session){
+            store_history(strdup(command));
+            history_lines++;
+        }
+    }
+    history_seen += line - buf;
+    if (last != NULL){
+        free(history_last);
+        history_last = strdup(last);
+    }
+    free(buf);
+}
+
+/* Synopsis:
+ * void trim_history()
+ *
+ * Description:
+ * The function rewrites the history file to hold only its last
+ * history_capacity records, whichever sessions wrote them. The tail
+ * is found by scanning back through a mapping of the file and is
+ * copied whole into a new file, which is renamed over the old one so
+ * a crash leaves one or the other intact. The caller holds the lock.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trim_history(){
+    char *tmp_path, *map, *end, *pos, *newline;
+    struct stat st;
+    ssize_t done, got;
+    int fd, count = 0;
+
+    if ((fd = open(history_path, O_RDONLY | O_CLOEXEC)) < 0)
+        return;
+    if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+        close(fd);
+        return;
+    }
+    close(fd);
+    end = map + st.st_size;
+
+    pos = end[-1] == '\n' ? end - 1 : end;
+    while (count < history_capacity && pos > map){
+        newline = memrchr(map, '\n', pos - map);
+        pos = newline != NULL ? newline : map;
+        count++;
+    }
+    history_lines = count;
+    if (pos == map){ /* Another session has just compacted it. */
+        munmap(map, st.st_size);
+        return;
+    }
+    pos++;
+
+    tmp_path = malloc(strlen(history_path) + 5);
+    sprintf(tmp_path, "%s.tmp", history_path);
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) >= 0){
+        for (done = 0; done < end - pos; done += got)
+            if ((got = write(fd, pos + done, end - pos - done)) <= 0)
+                break;
+        if (done == end - pos && fdatasync(fd) == 0 && rename(tmp_path, history_path) == 0){
+            reopen_history();
+            history_lines = count;
+        }
+        else
+            unlink(tmp_path);
+        close(fd);
+    }
+    free(tmp_path);
+    munmap(map, st.st_size);
+}
+
+/* Synopsis:
+ * void compact_history()
+ *
+ * Description:
+ * The function compacts the history file under an exclusive lock, after
+ * reading in any commands other sessions have added, so appends by other
+ * sessions wait for it and none of them is lost.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compact_history(){
+    uint64_t started;
+
+    TRACE_START(started);
+    if (history_lock_fd < 0 || flock(history_lock_fd, LOCK_EX) < 0)
+        return;
+    merge_history();
+    trim_history();
+    flock(history_lock_fd, LOCK_UN);
+    TRACE_END(started, "history_compact", history_path, history_lines);
+}
+
+/* Synopsis:
+ * void add_history(char *input)
+ *
+ * Description:
+ * The function adds new command to the history, after any that other
+ * sessions have added, and appends it to the history file as a record
+ * stamped with the time and session, in a single O_APPEND write so
+ * records of concurrent sessions never mix.
+ * The append holds a shared lock so it cannot land in a file being
+ * replaced by compaction. The file is synced every HISTORY_SYNC_BATCH
+ * commands or once HISTORY_SYNC_INTERVAL seconds have passed since the
+ * last sync, whichever comes first, and compacted once
+ * it holds twice as many commands as are kept.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_history(char *input){
+    struct stat st;
+    char *record;
+    int len, written;
+    uint64_t started;
+
+    /* Commands other sessions added come first, as they do in the file. */
+    merge_history();
+    store_history(strdup(input));
+    if (history_fd < 0)
+        return;
+
+    TRACE_START(started);
+    record = arena_alloc(&line_arena, strlen(input) + 48);
+    len = sprintf(record, ": %ld:%llx;%s\n", (long)time(NULL), (unsigned long long)history_session, input);
+    if (history_lock_fd >= 0)
+        flock(history_lock_fd, LOCK_SH);
+    if (fstat(history_fd, &st) == 0 && st.st_nlink == 0)
+        reopen_history();
+    written = write(history_fd, record, len);
+    if (history_lock_fd >= 0)
+        flock(history_lock_fd, LOCK_UN);
+    TRACE_END(started, "history_append", input, written);
+    if (written != len)
+        return;
+    history_lines++;
+
+    if (++history_unsynced >= HISTORY_SYNC_BATCH || time(NULL) - history_synced >= HISTORY_SYNC_INTERVAL)
+        sync_history();
+    if (history_lines >= 2L * history_capacity)
+        compact_history();
+}
+
+/* Synopsis:
+ * char *join_words(char **words)
+ *
+ * Description:
+ * The function joins a NULL terminated list of words with
+ * single spaces into a string carved from the line arena.
+ *
+ * Returns:
+ * The joined string.
+ */
+char *join_words(char **words){
+    size_t len = 1;
+    char *joined;
+    int i;
+
+    for(i = 0; words[i] != NULL; i++)
+        len += strlen(words[i]) + 1;
+    joined = arena_alloc(&line_arena, len);
+    joined[0] = '\0';
+    for(i = 0; words[i] != NULL; i++){
+        if(i > 0)
+            strcat(joined, " ");
+        strcat(joined, words[i]);
+    }
+    return joined;
+}
+
+/* Synopsis:
+ * int first_match(int n, void *arg)
+ *
+ * Description:
+ * The function is the visitor of search_history() keeping the
+ * newest match, in the int arg points to.
+ *
+ * Returns:
+ * 0 to stop the search.
+ */
+int first_match(int n, void *arg){
+    *(int *)arg = n;
+    return 0;
+}
+
+/* Synopsis:
+ * void invoke_history()
+ *
+ * Description:
+ * The function invokes and runs a command from history.
+ * '!!' runs last command
+ * '!<no.>' runs command specified by <no.>.
+ * '!?<pattern>?' runs the most recent command containing <pattern>.
+ * A here-document command is refused, as its body is not in history.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void invoke_history(){
+    char *pattern;
+    size_t len;
+    int index;
+
+    merge_history();
+
+    /* The pattern of '!?' may hold spaces, so take every word. */
+    if(strncmp("!?", cmdStr[0], 2) == 0){
+        pattern = join_words(cmdStr) + 2;
+        len = strlen(pattern);
+        if(len > 0 && pattern[len - 1] == '?')
+            pattern[--len] = '\0';
+        if(len == 0){
+            puts("Error: Invalid history invocation.");
+            return;
+        }
+        if(search_history(pattern, first_match, &index) == 0){
+            puts("Error: No command in history matches.");
+            return;
+        }
+        if(has_heredoc(history_entry(index))){
+            puts("Error: Here-documents can't be run from history.");
+            return;
+        }
+        if(tokenise(arena_strdup(&line_arena, history_entry(index))) == 1)
+            commands();
+        else
+            puts("Error: Invalid history invocation.");
+        return;
+    }
+
+    if(!cmdStr[1]){ /* Check if valid number of arguments. */
+        char *input = NULL, *copy = NULL;
+
+        if(history_counter == 0){
+            puts("Error: No commands in history.");
+            return;
+        }
+		/* Check if run last command. */
+        if(strncmp("!!",cmdStr[0], 2) == 0){
+            input = history_entry(history_counter - 1);
+        }
+        else { /* Run command specified by user. */
+            char *num = strtok(cmdStr[0], "!\n ");
+            int index = atoi(num);
+            if (index > 0){
+                if (index <= history_counter) {
+                    input = history_entry(index-1);
+                } else {
+                    puts("Error: History number out of bounds.");
+                    return;
+                }
+            }else {
+                puts("Error: Invalid history invocation.");
+                return;
+            }
+        }
+        if(has_heredoc(input)){
+            puts("Error: Here-documents can't be run from history.");
+            return;
+        }
+        copy = arena_strdup(&line_arena, input);
+        if (tokenise(copy) == 1)
+            commands();
+        else
+            puts("Error: Invalid history invocation.");
+    }
+    else{
+        puts("HISTORY: Error too many arguments");
+    }
+    return;
+}
+
+/* Synopsis:
+ * int print_match(int n, void *arg)
+ *
+ * Description:
+ * The function is the visitor of search_history() printing each
+ * match with the number it can be invoked by.
+ *
+ * Returns:
+ * 1 to carry on searching.
+ */
+int print_match(int n, void *arg){
+    (void)arg;
+    printf("[%d]> %s\n", n + 1, history_entry(n));
+    return 1;
+}
+
+/* Synopsis:
+ * void list_history()
+ *
+ * Description:
+ * The function implements the history builtin.
+ * 'history' prints out every command in history with
+ * the number it can be invoked by.
+ * 'history search <pattern>' prints the commands containing
+ * <pattern>, most recent first.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void list_history(){
+    char *pattern;
+    int count;
+
+    merge_history();
+    if(cmdStr[1] == NULL){
+        for(count = 0; count < history_counter; count++)
+            printf("[%d]> %s\n", count + 1, history_entry(count));
+        return;
+    }
+    if(strcmp(cmdStr[1], "search") != 0){
+        puts("HISTORY: Error too many arguments.");
+        last_status = 2;
+        return;
+    }
+    if(cmdStr[2] == NULL){
+        puts("HISTORY: Not enough arguments.");
+        last_status = 2;
+        return;
+    }
+
+    pattern = join_words(&cmdStr[2]);
+    last_status = search_history(pattern, print_match, NULL) > 0 ? 0 : 1;
+}
+
+/* Synopsis:
+ * void load_history(int fd)
+ *
+ * Description:
+ * The function fills history with the last commands in the history
+ * file open on fd. The file is mapped privately and scanned back
+ * from its end with memrchr() until history is full, so only the
+ * pages holding those commands are touched. Each newline is
+ * overwritten with a terminator and the commands are used where
+ * they lie in the mapping with their record prefix skipped, a last
+ * line without a newline is copied.
+ * How many lines the rest of the file holds is estimated from the
+ * length of the commands read.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void load_history(int fd){
+    struct stat st;
+    char *end, *pos, *newline, *start, *copy, **lines;
+    uint64_t session;
+    int count = 0, i;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+        return;
+    history_seen = st.st_size;
+    history_map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (history_map == MAP_FAILED){
+        history_map = NULL;
+        return;
+    }
+    history_map_size = st.st_size;
+    end = history_map + st.st_size;
+
+    /* Find the start of each of the last history_capacity lines. */
+    lines = malloc(history_capacity * sizeof(char *));
+    pos = end[-1] == '\n' ? end - 1 : end;
+    while (count < history_capacity && pos > history_map){
+        newline = memrchr(history_map, '\n', pos - history_map);
+        start = newline != NULL ? newline + 1 : history_map;
+        if (count == 0)
+            history_last = strndup(start, pos - start);
+        if (pos < end){
+            *pos = '\0';
+            lines[count++] = history_command(start, &session);
+        }
+        else{ /* No room to terminate it in the mapping. */
+            copy = strndup(start, end - start);
+            start = history_command(copy, &session);
+            memmove(copy, start, strlen(start) + 1);
+            lines[count++] = copy;
+        }
+        pos = newline != NULL ? newline : history_map;
+    }
+
+    for (i = count - 1; i >= 0; i--){
+        if (lines[i] >= history_map && lines[i] < end)
+            history_mapped++;
+        store_history(lines[i]);
+    }
+    free(lines);
+
+    history_lines = count;
+    if (pos > history_map)
+        history_lines += (long)((double)(pos - history_map) * count / (end - pos));
+    if (history_mapped == 0){
+        munmap(history_map, history_map_size);
+        history_map = NULL;
+        history_map_size = 0;
+    }
+}
+
+/* Synopsis:
+ * void open_history()
+ *
+ * Description:
+ * The function sizes the history ring from HISTSIZE, creates new file
+ * at HOME directory to store history if the file has not been created,
+ * otherwise loads the last commands in the file into history. The file
+ * is then kept open so new commands can be appended to it.
+ *
+ * Returns:
+ * The function has return type void
+ */
+void open_history(){
+	char *size = getenv("HISTSIZE");
+	struct timeval now;
+	uint64_t started;
+
+	TRACE_START(started);
+	history_capacity = size != NULL ? atoi(size) : HISTORY_DEFAULT;
+	if (history_capacity < 1)
+		history_capacity = HISTORY_DEFAULT;
+	history = malloc(history_capacity * sizeof(char *));
+	history_head = history_counter = 0;
+
+	history_path = malloc(strlen(getenv("HOME")) + strlen(HISTORY_LOCK) + 2);
+	sprintf(history_path, "%s/%s", getenv("HOME"), HISTORY_LOCK);
+	history_lock_fd = open(history_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	sprintf(history_path, "%s/%s", getenv("HOME"), HISTORY_FILE);
+	/* The pid keeps concurrent shells apart and is never 0, the start time
+	 * tells apart shells given the same pid in turn. */
+	gettimeofday(&now, NULL);
+	history_session = (uint64_t)getpid() << 32 | (uint32_t)(now.tv_sec * 1000000 + now.tv_usec);
+
+	/* Create a new file. */
+	if((history_fd = open(history_path, O_RDWR | O_APPEND | O_CLOEXEC)) < 0){
+		puts("Creating new history file at HOME directory.");
+		history_fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	}
+
+	/* File exists, load it. */
+	else
+		load_history(history_fd);
+
+	history_synced = time(NULL);
+	TRACE_END(started, "history_load", history_path, history_counter);
+}
+
+/* Synopsis:
+ * void save_history()
+ *
+ * Description:
+ * The function makes sure every command appended to the history
+ * file is on disk and closes it. Commands are written as they are
+ * entered, so nothing is rewritten here.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void save_history(){
+	uint64_t started;
+
+	if (history_fd < 0)
+		return;
+	TRACE_START(started);
+	sync_history();
+	close(history_fd);
+	history_fd = -1;
+	if (history_lock_fd >= 0)
+		close(history_lock_fd);
+	history_lock_fd = -1;
+	TRACE_END(started, "history_save", history_path, history_counter);
+}
+
+/* Command Lookup Cache */
+
+/* Synopsis:
+ * unsigned int hash_string(const char *str)
+ *
+ * Description:
+ * The function computes the FNV-1a hash of a string.
+ *
+ * Returns:
+ * The hash value of str.
+ */
+unsigned int hash_string(const char *str){
+    unsigned int h = 2166136261u;
+    while(*str){
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Synopsis:
+ * char *search_path(const char *name)
+ *
+ * Description:
+ * The function walks each directory of PATH looking for an
+ * executable regular file called name.
+ *
+ * Returns:
+ * A newly allocated full path to the executable.
+ * NULL if the command could not be found.
+ */
+char *search_path(const char *name){
+    const char *path = getenv("PATH"), *dir, *end;
+    size_t name_len = strlen(name), dir_len;
+    struct stat st;
+    char *full;
+
+    if(path == NULL)
+        path = "/bin:/usr/bin";
+
+    for(dir = path; ; dir = end + 1){
+        end = strchr(dir, ':');
+        if(end == NULL)
+            end = dir + strlen(dir);
+        dir_len = end - dir;
+
+        full = malloc(dir_len + name_len + 3);
+        if(dir_len == 0) /* An empty PATH entry means the current directory. */
+            strcpy(full, ".");
+        else{
+            memcpy(full, dir, dir_len);
+            full[dir_len] = '\0';
+        }
+        strcat(full, "/");
+        strcat(full, name);
+
+        if(stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0)
+            return full;
+        free(full);
+
+        if(*end == '\0')
+            break;
+    }
+    return NULL;
+}
+
+/* Synopsis:
+ * HashEntry *hash_find(const char *name)
+ *
+ * Description:
+ * The function looks up name in the command lookup cache.
+ *
+ * Returns:
+ * The cache entry for name.
+ * NULL if name is not cached.
+ */
+HashEntry *hash_find(const char *name){
+    HashEntry *entry = hash_table[hash_string(name) % HASH_SIZE];
+    while(entry != NULL){
+        if(strcmp(entry->name, name) == 0)
+            return entry;
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+/* Synopsis:
+ * const char *find_command(const char *name)
+ *
+ * Description:
+ * The function resolves a command name to the path it should be
+ * executed from. Names containing a '/' are used as they are,
+ * other names are taken from the lookup cache or searched for in
+ * PATH and added to the cache when found.
+ *
+ * Returns:
+ * Path of the command. The string is owned by the cache (or is name itself)
+ * and must not be freed.
+ * NULL if the command could not be found.
+ */
+const char *find_command(const char *name){
+    HashEntry *entry;
+    char *path;
+    unsigned int bucket;
+
+    if(strchr(name, '/') != NULL)
+        return name;
+
+    if((entry = hash_find(name)) != NULL){
+        entry->hits++;
+        return entry->path;
+    }
+
+    if((path = search_path(name)) == NULL)
+        return NULL;
+
+    /* Remember where the command was found for next time. */
+    bucket = hash_string(name) % HASH_SIZE;
+    entry = malloc(sizeof(HashEntry));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 1;
+    entry->next = hash_table[bucket];
+    hash_table[bucket] = entry;
+    return entry->path;
+}
+
+/* Synopsis:
+ * void hash_forget(const char *name)
+ *
+ * Description:
+ * The function removes a single command from the lookup cache,
+ * used when its cached path no longer exists.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void hash_forget(const char *name){
+    HashEntry **link = &hash_table[hash_string(name) % HASH_SIZE], *entry;
+    while((entry = *link) != NULL){
+        if(strcmp(entry->name, name) == 0){
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+/* Synopsis:
+ * void hash_clear()
+ *
+ * Description:
+ * The function removes every entry from the command lookup cache.
+ * It is called whenever PATH changes.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void hash_clear(){
+    HashEntry *entry, *next;
+    int i;
+    for(i = 0; i < HASH_SIZE; i++){
+        for(entry = hash_table[i]; entry != NULL; entry = next){
+            next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+        hash_table[i] = NULL;
+    }
+    exec_index_reset(); /* Completion's view of PATH goes with it. */
+}
+
+/* Synopsis:
+ * void hash()
+ *
+ * Description:
+ * The function implements the hash builtin.
+ * 'hash' lists the cached commands with their hit counts.
+ * 'hash -r' clears the cache.
+ * 'hash <name>...' looks up each name and adds it to the cache.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void hash(){
+    HashEntry *entry;
+    int i, empty = 1;
+
+    if(cmdStr[1] == NULL){
+        for(i = 0; i < HASH_SIZE; i++){
+            for(entry = hash_table[i]; entry != NULL; entry = entry->next){
+                if(empty)
+                    puts("hits\tcommand");
+                printf("%4d\t%s\n", entry->hits, entry->path);
+                empty = 0;
+            }
+        }
+        if(empty)
+            puts("hash: hash table empty");
+    }
+    else if(strcmp(cmdStr[1], "-r") == 0){
+        if(cmdStr[2] != NULL)
+            puts("HASH: Error too many arguments.");
+        else
+            hash_clear();
+    }
+    else{
+        for(i = 1; cmdStr[i] != NULL; i++){
+            if(strchr(cmdStr[i], '/') != NULL)
+                continue;
+            if(hash_find(cmdStr[i]) == NULL && find_command(cmdStr[i]) == NULL){
+                printf("hash: %s: not found\n", cmdStr[i]);
+                continue;
+            }
+            /* Pre-warming should not count as a use. */
+            hash_find(cmdStr[i])->hits = 0;
+        }
+    }
+}
+
+/* Scheduling Controls */
+
+/* Synopsis:
+ * int parse_cpus(const char *list, cpu_set_t *cpus)
+ *
+ * Description:
+ * The function reads a CPU list such as "0-3,6", as taskset -c
+ * takes it, into cpus.
+ *
+ * Returns:
+ * 0 if the list is valid.
+ * -1 otherwise.
+ */
+int parse_cpus(const char *list, cpu_set_t *cpus){
+    long first, last;
+    char *end;
+
+    CPU_ZERO(cpus);
+    while(1){
+        first = last = strtol(list, &end, 10);
+        if(end == list || first < 0)
+            return -1;
+        if(*end == '-'){
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if(end == list)
+                return -1;
+        }
+        if(last < first || last >= CPU_SETSIZE)
+            return -1;
+        for(; first <= last; first++)
+            CPU_SET(first, cpus);
+        if(*end == '\0')
+            return 0;
+        if(*end != ',')
+            return -1;
+        list = end + 1;
+    }
+}
+
+/* Synopsis:
+ * int parse_limit(const char *arg, Sched *sched)
+ *
+ * Description:
+ * The function reads NAME=VALUE, where NAME is a resource from
+ * run_limits[] and VALUE a number, which may end in K, M or G, or
+ * unlimited, and adds the limit to sched. The soft and hard limits
+ * are both set, as ulimit does.
+ *
+ * Returns:
+ * 0 if the limit is valid.
+ * -1 otherwise.
+ */
+int parse_limit(const char *arg, Sched *sched){
+    const char *equals = strchr(arg, '=');
+    unsigned long long value;
+    char *end;
+    int i;
+
+    if(equals == NULL)
+        return -1;
+    for(i = 0; i < (int)SIZE(run_limits); i++)
+        if(strlen(run_limits[i].name) == (size_t)(equals - arg) && strncmp(run_limits[i].name, arg, equals - arg) == 0)
+            break;
+    if(i == (int)SIZE(run_limits))
+        return -1;
+
+    if(strcmp(equals + 1, "unlimited") == 0)
+        value = RLIM_INFINITY;
+    else{
+        value = strtoull(equals + 1, &end, 10);
+        if(end == equals + 1)
+            return -1;
+        switch(*end){
+        case 'G': value *= 1024;
+            /* fall through */
+        case 'M': value *= 1024;
+            /* fall through */
+        case 'K': value *= 1024;
+            end++;
+        }
+        if(*end != '\0')
+            return -1;
+    }
+    sched->limits |= 1 << i;
+    sched->limit[i].rlim_cur = sched->limit[i].rlim_max = value;
+    return 0;
+}
+
+/* Synopsis:
+ * int parse_sched(int *i, Sched *sched)
+ *
+ * Description:
+ * The function reads the options of the run builtin from cmdStr[*i]
+ * on into sched, leaving *i at the first word which is not one:
+ * -c cpus, -n nice, -s other|batch|idle, -i class[:level], -l NAME=VALUE
+ * and -r. Errors are reported.
+ *
+ * Returns:
+ * 0 if the options are valid.
+ * -1 otherwise.
+ */
+int parse_sched(int *i, Sched *sched){
+    char *opt, *arg, *end;
+    long level;
+    int j;
+
+    for(; (opt = cmdStr[*i]) != NULL && opt[0] == '-' && opt[1] != '\0' && opt[2] == '\0'; (*i)++){
+        if(opt[1] == 'r'){
+            sched->set |= RUN_SPREAD;
+            continue;
+        }
+        if((arg = cmdStr[*i + 1]) == NULL){
+            printf("RUN: Error %s needs a value.\n", opt);
+            return -1;
+        }
+        (*i)++;
+        switch(opt[1]){
+        case 'c':
+            if(parse_cpus(arg, &sched->cpus) < 0 || CPU_COUNT(&sched->cpus) == 0){
+                printf("RUN: Error invalid CPU list %s.\n", arg);
+                return -1;
+            }
+            sched->set |= RUN_CPUS;
+            break;
+        case 'n':
+            sched->nice = (int)strtol(arg, &end, 10);
+            if(end == arg || *end != '\0' || sched->nice < -20 || sched->nice > 19){
+                printf("RUN: Error invalid nice value %s.\n", arg);
+                return -1;
+            }
+            sched->set |= RUN_NICE;
+            break;
+        case 's':
+            for(j = 0; j < (int)SIZE(sched_policies); j++)
+                if(strcmp(arg, sched_policies[j].name) == 0)
+                    break;
+            if(j == (int)SIZE(sched_policies)){
+                printf("RUN: Error unknown policy %s, use other, batch or idle.\n", arg);
+                return -1;
+            }
+            sched->policy = sched_policies[j].policy;
+            sched->set |= RUN_POLICY;
+            break;
+        case 'i':
+            level = 4;
+            for(j = 1; j < (int)SIZE(ioprio_classes); j++)
+                if(strncmp(arg, ioprio_classes[j], strlen(ioprio_classes[j])) == 0 &&
+                   (arg[strlen(ioprio_classes[j])] == '\0' || arg[strlen(ioprio_classes[j])] == ':'))
+                    break;
+            end = j < (int)SIZE(ioprio_classes) ? arg + strlen(ioprio_classes[j]) : arg;
+            if(*end == ':')
+                level = strtol(end + 1, &end, 10);
+            if(j == (int)SIZE(ioprio_classes) || *end != '\0' || level < 0 || level > 7){
+                printf("RUN: Error invalid I/O priority %s, use rt, be or idle with an optional :0-7.\n", arg);
+                return -1;
+            }
+            sched->ioprio = j << IOPRIO_CLASS_SHIFT | (j == IOPRIO_IDLE ? 0 : level);
+            sched->set |= RUN_IOPRIO;
+            break;
+        case 'l':
+            if(parse_limit(arg, sched) < 0){
+                printf("RUN: Error invalid limit %s.\n", arg);
+                return -1;
+            }
+            break;
+        default:
+            printf("RUN: Error unknown option %s.\n", opt);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Synopsis:
+ * int apply_sched(const Sched *sched, int cpu)
+ *
+ * Description:
+ * The function applies the settings in sched to the calling
+ * process, which is a child about to exec. cpu, if not -1, is the
+ * one CPU picked for it by next_cpu() and replaces the CPU set.
+ * The policy is set before the nice value, which it would reset.
+ *
+ * Returns:
+ * 0 once every setting is applied.
+ * -1 with errno set if one could not be.
+ */
+int apply_sched(const Sched *sched, int cpu){
+    struct sched_param param;
+    cpu_set_t one;
+    int i;
+
+    if(cpu >= 0){
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if(sched_setaffinity(0, sizeof(one), &one) < 0)
+            return -1;
+    }
+    else if((sched->set & RUN_CPUS) && sched_setaffinity(0, sizeof(sched->cpus), &sched->cpus) < 0)
+        return -1;
+    if(sched->set & RUN_POLICY){
+        memset(&param, 0, sizeof(param));
+        if(sched_setscheduler(0, sched->policy, &param) < 0)
+            return -1;
+    }
+    if((sched->set & RUN_NICE) && setpriority(PRIO_PROCESS, 0, sched->nice) < 0)
+        return -1;
+    if((sched->set & RUN_IOPRIO) && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, sched->ioprio) < 0)
+        return -1;
+    for(i = 0; i < (int)SIZE(run_limits); i++)
+        if((sched->limits & 1 << i) && setrlimit(run_limits[i].resource, &sched->limit[i]) < 0)
+            return -1;
+    return 0;
+}
+
+/* Synopsis:
+ * int sched_empty(const Launch *job)
+ *
+ * Description:
+ * The function checks whether job is started with no run settings
+ * to apply, so it can be started in any way.
+ *
+ * Returns:
+ * 1 if there is nothing to apply.
+ * 0 otherwise.
+ */
+int sched_empty(const Launch *job){
+    return job->cpu < 0 && (job->sched->set & ~RUN_SPREAD) == 0 && job->sched->limits == 0;
+}
+
+/* Synopsis:
+ * int next_cpu(const Sched *sched)
+ *
+ * Description:
+ * The function picks the CPU for the next background or parallel
+ * job when sched spreads jobs, going round the CPUs of its CPU set,
+ * or those the shell may use, in turn.
+ *
+ * Returns:
+ * The CPU.
+ * -1 if jobs are not spread.
+ */
+int next_cpu(const Sched *sched){
+    cpu_set_t allowed;
+    int n, cpu;
+
+    if(!(sched->set & RUN_SPREAD))
+        return -1;
+    if(sched->set & RUN_CPUS)
+        allowed = sched->cpus;
+    else if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return -1;
+    if((n = CPU_COUNT(&allowed)) == 0)
+        return -1;
+    n = spread_next++ % n;
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if(CPU_ISSET(cpu, &allowed) && n-- == 0)
+            return cpu;
+    return -1;
+}
+
+/* Synopsis:
+ * void print_sched(const Sched *sched)
+ *
+ * Description:
+ * The function prints the settings in sched as the run options
+ * which would make them.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void print_sched(const Sched *sched){
+    int i, first;
+
+    printf("run -d");
+    if(sched->set & RUN_CPUS){
+        printf(" -c ");
+        for(i = 0, first = 1; i < CPU_SETSIZE; i++){
+            if(!CPU_ISSET(i, &sched->cpus) || (i > 0 && CPU_ISSET(i - 1, &sched->cpus)))
+                continue;
+            printf(first ? "%d" : ",%d", i);
+            first = 0;
+            if(i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, &sched->cpus)){
+                while(i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, &sched->cpus))
+                    i++;
+                printf("-%d", i);
+            }
+        }
+    }
+    if(sched->set & RUN_NICE)
+        printf(" -n %d", sched->nice);
+    if(sched->set & RUN_POLICY)
+        for(i = 0; i < (int)SIZE(sched_policies); i++)
+            if(sched_policies[i].policy == sched->policy)
+                printf(" -s %s", sched_policies[i].name);
+    if(sched->set & RUN_IOPRIO){
+        i = sched->ioprio >> IOPRIO_CLASS_SHIFT;
+        if(i == IOPRIO_IDLE)
+            printf(" -i %s", ioprio_classes[i]);
+        else
+            printf(" -i %s:%d", ioprio_classes[i], sched->ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+    }
+    for(i = 0; i < (int)SIZE(run_limits); i++){
+        if(!(sched->limits & 1 << i))
+            continue;
+        if(sched->limit[i].rlim_cur == RLIM_INFINITY)
+            printf(" -l %s=unlimited", run_limits[i].name);
+        else
+            printf(" -l %s=%llu", run_limits[i].name, (unsigned long long)sched->limit[i].rlim_cur);
+    }
+    if(sched->set & RUN_SPREAD)
+        printf(" -r");
+    printf("\n");
+}
+
+/* Synopsis:
+ * void run_command()
+ *
+ * Description:
+ * The function implements the run prefix. 'run [options] command'
+ * runs the command line with the options added to the defaults,
+ * applied in each child before exec:
+ * -c cpus          CPUs it may run on, e.g. 0-3,6
+ * -n nice          nice value, -20 to 19
+ * -s policy        scheduling policy, other, batch or idle
+ * -i class[:level] I/O priority, rt, be or idle, level 0 (highest) to 7
+ * -l NAME=VALUE    resource limit, e.g. nofile=1024 or as=4G
+ * -r               background and parallel jobs go round the CPUs
+ * 'run -d [options]' makes the options the defaults for every job,
+ * 'run -d' alone clears them and 'run' alone prints them.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_command(){
+    Sched sched = run_defaults, *saved;
+    int i = 1, j;
+
+    if(cmdStr[1] == NULL){
+        print_sched(&run_defaults);
+        return;
+    }
+    if(strcmp(cmdStr[1], "-d") == 0){
+        memset(&sched, 0, sizeof(sched));
+        i = 2;
+        if(parse_sched(&i, &sched) < 0 || cmdStr[i] != NULL){
+            if(cmdStr[i] != NULL)
+                puts("RUN: Error -d takes no command.");
+            last_status = 2;
+            return;
+        }
+        run_defaults = sched;
+        return;
+    }
+    if(parse_sched(&i, &sched) < 0){
+        last_status = 2;
+        return;
+    }
+    if(cmdStr[i] == NULL){
+        puts("RUN: Error no command given.");
+        last_status = 2;
+        return;
+    }
+
+    /* Drop the word 'run' and its options and run the rest as a command line. */
+    for(j = 0; j + i <= (int)cmd_len; j++)
+        cmdStr[j] = cmdStr[j + i];
+    cmd_len -= i;
+    saved = launch_sched;
+    launch_sched = &sched;
+    commands();
+    launch_sched = saved;
+}
+
+/* Process Launching */
+
+/* Synopsis:
+ * char **build_envp()
+ *
+ * Description:
+ * The function returns the environment array passed to launched
+ * commands. The array and its strings are copied into a single
+ * block the first time it is needed and reused until env_changed()
+ * is called.
+ *
+ * Returns:
+ * NULL terminated array of "NAME=value" strings.
+ */
+char **build_envp(){
+    size_t count = 0, bytes = 0, len;
+    char *strings;
+    int i;
+
+    if(launch_envp != NULL)
+        return launch_envp;
+
+    for(i = 0; environ[i] != NULL; i++){
+        count++;
+        bytes += strlen(environ[i]) + 1;
+    }
+    launch_envp = malloc((count + 1) * sizeof(char *) + bytes);
+    strings = (char *)(launch_envp + count + 1);
+    for(i = 0; environ[i] != NULL; i++){
+        len = strlen(environ[i]) + 1;
+        memcpy(strings, environ[i], len);
+        launch_envp[i] = strings;
+        strings += len;
+    }
+    launch_envp[count] = NULL;
+    return launch_envp;
+}
+
+/* Synopsis:
+ * void env_changed()
+ *
+ * Description:
+ * The function discards the cached launch environment so the
+ * next launch picks up the change.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void env_changed(){
+    free(launch_envp);
+    launch_envp = NULL;
+}
+
+/* Synopsis:
+ * void launch_init(Launch *job, char **argv)
+ *
+ * Description:
+ * The function prepares job to run argv with the shell's own
+ * stdin, stdout and process group and the run settings in effect.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void launch_init(Launch *job, char **argv){
+    job->path = NULL;
+    job->argv = argv;
+    job->fd_in = -1;
+    job->fd_out = -1;
+    job->pgid = -1;
+    job->sched = launch_sched;
+    job->cpu = -1;
+}
+
+/* Synopsis:
+ * int child_setup(Launch *job)
+ *
+ * Description:
+ * The function runs in a forked child before exec. It joins the
+ * job's process group, moves the job's descriptors onto stdin and
+ * stdout, restores default handling of the shell's signals and an
+ * empty signal mask and applies the job's run settings.
+ *
+ * Returns:
+ * 0 if the child is ready to exec.
+ * -1 with errno set if a run setting could not be applied.
+ */
+int child_setup(Launch *job){
+    sigset_t mask;
+    int i;
+
+    if(job->pgid >= 0)
+        setpgid(0, job->pgid);
+    if(job->fd_in >= 0)
+        dup2(job->fd_in, STDIN_FILENO);
+    if(job->fd_out >= 0)
+        dup2(job->fd_out, STDOUT_FILENO);
+    for(i = 0; i < (int)SIZE(job_signals); i++)
+        signal(job_signals[i], SIG_DFL);
+    sigemptyset(&mask); /* The shell blocks SIGCHLD for its signalfd. */
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    return apply_sched(job->sched, job->cpu);
+}
+
+/* Synopsis:
+ * void shell_args(char **args, const char *path, char **argv)
+ *
+ * Description:
+ * The function fills args, which has room for two more words than
+ * argv, with the words running path as a /bin/sh script, as execvp
+ * does for a file without a '#!' line.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void shell_args(char **args, const char *path, char **argv){
+    int i;
+
+    args[0] = "/bin/sh";
+    args[1] = (char *)path;
+    for(i = 1; argv[i] != NULL; i++)
+        args[i + 1] = argv[i];
+    args[i + 1] = NULL;
+}
+
+/* Synopsis:
+ * void exec_file(const char *path, char **argv, char **envp)
+ *
+ * Description:
+ * The function executes path, running it with /bin/sh when the
+ * kernel does not recognise its format. It does no allocation, so
+ * a vfork child may call it.
+ *
+ * Returns:
+ * The function only returns if path could not be run, with errno set.
+ */
+void exec_file(const char *path, char **argv, char **envp){
+    int argc;
+
+    execve(path, argv, envp);
+    if(errno != ENOEXEC)
+        return;
+    for(argc = 0; argv[argc] != NULL; argc++)
+        ;
+    {
+        char *args[argc + 2];
+
+        shell_args(args, path, argv);
+        execve(args[0], args, envp);
+    }
+    errno = ENOEXEC;
+}
+
+/* Synopsis:
+ * pid_t launch(Launch *job)
+ *
+ * Description:
+ * The function starts job->path with job->argv using the backend
+ * selected by the launcher builtin:
+ * - spawn uses posix_spawn, which shares the address space with the child
+ *   until exec and reports exec failures back to the caller; as it cannot
+ *   apply run settings, commands which have some use vfork instead;
+ * - vfork suspends the shell until the child has exec'd or failed;
+ * - fork copies the shell, exec failures are reported by the child.
+ * Each runs a file the kernel cannot execute with /bin/sh, as execvp does.
+ *
+ * Returns:
+ * Process id of the child.
+ * -1 with errno set if the command could not be started.
+ */
+pid_t launch(Launch *job){
+    char **envp = build_envp();
+    pid_t pid;
+    int err, i;
+
+    if(launcher == LAUNCH_SPAWN && sched_empty(job)){
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        sigset_t defaults, mask;
+        short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+        posix_spawn_file_actions_init(&actions);
+        if(job->fd_in >= 0)
+            posix_spawn_file_actions_adddup2(&actions, job->fd_in, STDIN_FILENO);
+        if(job->fd_out >= 0)
+            posix_spawn_file_actions_adddup2(&actions, job->fd_out, STDOUT_FILENO);
+
+        posix_spawnattr_init(&attr);
+        sigemptyset(&defaults);
+        for(i = 0; i < (int)SIZE(job_signals); i++)
+            sigaddset(&defaults, job_signals[i]);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        if(job->pgid >= 0){
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attr, job->pgid);
+        }
+        posix_spawnattr_setflags(&attr, flags);
+
+        err = posix_spawn(&pid, job->path, &actions, &attr, job->argv, envp);
+        if(err == ENOEXEC){
+            for(i = 0; job->argv[i] != NULL; i++)
+                ;
+            {
+                char *args[i + 2];
+
+                shell_args(args, job->path, job->argv);
+                err = posix_spawn(&pid, args[0], &actions, &attr, args, envp);
+            }
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        if(err != 0){
+            errno = err;
+            return -1;
+        }
+        return pid;
+    }
+
+    if(launcher != LAUNCH_FORK){
+        vfork_errno = 0;
+        if((pid = vfork()) == 0){
+            if(child_setup(job) == 0)
+                exec_file(job->path, job->argv, envp);
+            vfork_errno = errno; /* Memory is shared, so the parent sees this. */
+            _exit(127);
+        }
+        if(pid > 0 && vfork_errno != 0){
+            waitpid(pid, NULL, 0);
+            errno = vfork_errno;
+            return -1;
+        }
+        return pid;
+    }
+
+    if((pid = fork()) == 0){
+        if(child_setup(job) < 0){
+            perror("Error");
+            exit(1);
+        }
+        exec_file(job->path, job->argv, envp);
+        if(errno == ENOENT) /* Cached path went stale, fall back to a full search. */
+            execvp(job->argv[0], job->argv);
+        perror("Error");
+        exit(1);
+    }
+    return pid;
+}
+
+/* Synopsis:
+ * void set_launcher()
+ *
+ * Description:
+ * The function implements the launcher builtin.
+ * 'launcher' prints the backend in use.
+ * 'launcher fork|vfork|spawn' selects the backend.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void set_launcher(){
+    int i;
+
+    if(cmdStr[1] == NULL){
+        printf("%s\n", launcher_names[launcher]);
+        return;
+    }
+    for(i = 0; i < (int)SIZE(launcher_names); i++){
+        if(strcmp(cmdStr[1], launcher_names[i]) == 0){
+            launcher = i;
+            return;
+        }
+    }
+    puts("LAUNCHER: Error unknown backend, use fork, vfork or spawn.");
+}
+
+/* Synopsis:
+ * pid_t start_command(Launch *job)
+ *
+ * Description:
+ * The function resolves job->argv[0] through the lookup cache and
+ * launches it. If the cached path has gone stale the command is
+ * searched for again. Errors are reported to the user.
+ *
+ * Returns:
+ * Process id of the child.
+ * -1 if the command could not be started.
+ */
+pid_t start_command(Launch *job){
+    pid_t pid;
+    char *name = job->argv[0];
+
+    if ((job->path = find_command(name)) == NULL) { /* Resolve before launching so the result is cached. */
+        fprintf(stderr, "%s: command not found\n", name);
+        return -1;
+    }
+
+    if ((pid = launch(job)) < 0 && errno == ENOENT && job->path != name) {
+        /* Cached path went stale, search PATH again. */
+        hash_forget(name);
+        if ((job->path = find_command(name)) == NULL) {
+            fprintf(stderr, "%s: command not found\n", name);
+            return -1;
+        }
+        pid = launch(job);
+    }
+    if (pid < 0)
+        perror("Error");
+    return pid;
+}
+
+/* Redirection */
+
+/* Synopsis:
+ * int is_redirect(const char *word)
+ *
+ * Description:
+ * The function checks whether word is a redirection operator. The
+ * whole word is compared, as a here-document may start with '<'.
+ *
+ * Returns:
+ * 1 if word is '<', '>', '>>', '<<' or '<<<'.
+ * 0 otherwise.
+ */
+int is_redirect(const char *word){
+    if(word[0] != '<' && word[0] != '>')
+        return 0;
+    return word[1] == '\0' || strcmp(word, ">>") == 0 || strcmp(word, "<<") == 0 ||
+           strcmp(word, "<<<") == 0 || strcmp(word, HEREDOC_LITERAL) == 0;
+}
+
+/* Synopsis:
+ * int has_heredoc(const char *line)
+ *
+ * Description:
+ * The function checks whether line redirects a here-document. Only
+ * the '<<WORD' line is kept in history, not the body after it.
+ *
+ * Returns:
+ * 1 if line holds a '<<' operator.
+ * 0 otherwise.
+ */
+int has_heredoc(const char *line){
+    Scanner scan;
+    char *token;
+
+    scan_init(&scan, arena_strdup(&line_arena, line));
+    while((token = scan_token(&scan)) != NULL)
+        if(strcmp(token, "<<") == 0)
+            return 1;
+    return 0;
+}
+
+/* Synopsis:
+ * int heredoc_quoted(char *word)
+ *
+ * Description:
+ * The function takes the quotes off a here-document delimiter
+ * written as 'word' or "word", in place.
+ *
+ * Returns:
+ * 1 if the delimiter was quoted, so the body is taken as it is.
+ * 0 if it was not, so variables in the body are expanded.
+ */
+int heredoc_quoted(char *word){
+    size_t len = strlen(word);
+
+    if(len < 2 || (word[0] != '\'' && word[0] != '"') || word[len - 1] != word[0])
+        return 0;
+    memmove(word, word + 1, len - 2);
+    word[len - 2] = '\0';
+    return 1;
+}
+
+/* Synopsis:
+ * int heredoc_fd(const char *text, int newline)
+ *
+ * Description:
+ * The function puts text, followed by a newline if newline is set,
+ * where a command can read it as its stdin, with nothing written to
+ * disk and no process to feed it. Text which fits is written to a
+ * pipe, larger text to a memfd. The pipe is written without blocking,
+ * so when it holds less than HEREDOC_PIPE_MAX the memfd is used.
+ *
+ * Returns:
+ * A close-on-exec descriptor reading text from its start.
+ * -1 with errno set if it could not be made.
+ */
+int heredoc_fd(const char *text, int newline){
+    size_t len = strlen(text);
+    int fds[2], fd;
+
+    if(len + newline <= HEREDOC_PIPE_MAX && pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0){
+        if(write_all(fds[1], text, len) == 0 && write_all(fds[1], "\n", newline) == 0){
+            close(fds[1]);
+            fcntl(fds[0], F_SETFL, 0);
+            return fds[0];
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    if((fd = memfd_create("heredoc", MFD_CLOEXEC)) < 0)
+        return -1;
+    if(write_all(fd, text, len) < 0 || write_all(fd, "\n", newline) < 0 || lseek(fd, 0, SEEK_SET) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Synopsis:
+ * char *command_word(char **argv)
+ *
+ * Description:
+ * The function finds the command name in argv, skipping the
+ * redirections which may come before it.
+ *
+ * Returns:
+ * The first word which is not a redirection or its file.
+ * NULL if argv holds only redirections.
+ */
+char *command_word(char **argv){
+    int i;
+
+    for(i = 0; argv[i] != NULL && is_redirect(argv[i]); i += 2)
+        if(argv[i + 1] == NULL)
+            return NULL;
+    return argv[i];
+}
+
+/* Synopsis:
+ * int has_redirect(char **argv)
+ *
+ * Description:
+ * The function checks whether argv holds any redirection.
+ *
+ * Returns:
+ * 1 if it does.
+ * 0 otherwise.
+ */
+int has_redirect(char **argv){
+    int i;
+
+    for(i = 0; argv[i] != NULL; i++)
+        if(is_redirect(argv[i]))
+            return 1;
+    return 0;
+}
+
+/* Synopsis:
+ * int open_redirects(char **argv, int *fd_in, int *fd_out)
+ *
+ * Description:
+ * The function opens the file named after each redirection in argv
+ * and removes both words, leaving the command and its arguments.
+ * '<' opens the file for reading, '>' truncates or creates it and
+ * '>>' appends to it. '<<' reads the here-document which follows it
+ * and '<<<' the word which follows it and a newline, from a pipe or
+ * memfd. Every file is opened, but a later redirection of the same
+ * stream replaces an earlier one. The files are opened close-on-exec,
+ * the caller moves them onto stdin and stdout.
+ *
+ * Returns:
+ * 0 with the files to use in *fd_in and *fd_out, -1 where there is none.
+ * -1 if a file name is missing or a file cannot be opened, nothing is left open.
+ */
+int open_redirects(char **argv, int *fd_in, int *fd_out){
+    int i, j = 0, fd, flags, *target, result = -1;
+
+    *fd_in = *fd_out = -1;
+    for(i = 0; ; i++){
+        if(argv[i] == NULL){
+            result = 0;
+            break;
+        }
+        if(!is_redirect(argv[i])){
+            argv[j++] = argv[i];
+            continue;
+        }
+        if(argv[i + 1] == NULL || is_redirect(argv[i + 1])){
+            fprintf(stderr, "Error: Missing file name after '%s'.\n", argv[i]);
+            break;
+        }
+        if(argv[i][0] == '<' && argv[i][1] == '<'){
+            target = fd_in;
+            if((fd = heredoc_fd(argv[i + 1], argv[i][2] == '<')) < 0){
+                fprintf(stderr, "Error: here-document: %s\n", strerror(errno));
+                break;
+            }
+        }
+        else{
+            if(argv[i][0] == '<'){
+                flags = O_RDONLY;
+                target = fd_in;
+            }
+            else{
+                flags = O_WRONLY | O_CREAT | (argv[i][1] == '>' ? O_APPEND : O_TRUNC);
+                target = fd_out;
+            }
+            if((fd = open(argv[i + 1], flags | O_CLOEXEC, 0666)) < 0){
+                fprintf(stderr, "Error: %s: %s\n", argv[i + 1], strerror(errno));
+                break;
+            }
+        }
+        if(*target >= 0)
+            close(*target);
+        *target = fd;
+        i++;
+    }
+    argv[j] = NULL;
+
+    if(result == 0)
+        return 0;
+    if(*fd_in >= 0)
+        close(*fd_in);
+    if(*fd_out >= 0)
+        close(*fd_out);
+    *fd_in = *fd_out = -1;
+    return -1;
+}
+
+/* Pipelines */
+
+/* Synopsis:
+ * int is_builtin(const char *name)
+ *
+ * Description:
+ * The function checks whether name is handled by commands()
+ * rather than launched as an external command.
+ *
+ * Returns:
+ * 1 if name is a builtin.
+ * 0 otherwise.
+ */
+int is_builtin(const char *name){
+    return name[0] == '!' || find_builtin(name) != NULL;
+}
+
+/* Synopsis:
+ * int is_pipeline()
+ *
+ * Description:
+ * The function checks whether the parsed command line contains
+ * a pipe operator.
+ *
+ * Returns:
+ * 1 if cmdStr is a pipeline.
+ * 0 otherwise.
+ */
+int is_pipeline(){
+    int i;
+    for(i = 0; cmdStr[i] != NULL; i++)
+        if(strcmp(cmdStr[i], "|") == 0)
+            return 1;
+    return 0;
+}
+
+/* Synopsis:
+ * void give_terminal(pid_t pgid)
+ *
+ * Description:
+ * The function makes pgid the foreground process group of the
+ * controlling terminal when the shell is interactive, so the
+ * group receives keyboard signals and may read the terminal.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void give_terminal(pid_t pgid){
+    if(interactive)
+        tcsetpgrp(STDIN_FILENO, pgid);
+}
+
+/* Synopsis:
+ * pid_t fork_builtin(Launch *job, int close_fd)
+ *
+ * Description:
+ * The function runs a builtin as a pipeline stage. The builtin
+ * runs in a forked child with the stage's descriptors, close_fd
+ * is the read end of the next pipe which the child must not hold.
+ *
+ * Returns:
+ * Process id of the child.
+ * -1 if the child could not be forked.
+ */
+pid_t fork_builtin(Launch *job, int close_fd){
+    pid_t pid;
+    int i;
+
+    fflush(stdout); /* Don't let the child repeat pending output. */
+    if((pid = fork()) == 0){
+        if(child_setup(job) < 0){
+            perror("Error");
+            _exit(1);
+        }
+        events_forget();
+        if(close_fd >= 0)
+            close(close_fd);
+        if(job->fd_in >= 0)
+            close(job->fd_in);
+        if(job->fd_out >= 0)
+            close(job->fd_out);
+        if(job->argv != cmdStr){
+            reset_cmdstr();
+            for(i = 0; job->argv[i] != NULL; i++)
+                push_cmdstr(job->argv[i]);
+        }
+        commands();
+        fflush(stdout);
+        _exit(last_status);
+    }
+    if(pid < 0)
+        perror("Error");
+    return pid;
+}
+
+/* Resource Accounting */
+
+/* Synopsis:
+ * double elapsed(const struct timespec *since)
+ *
+ * Description:
+ * The function measures the time since a reading of the
+ * monotonic clock.
+ *
+ * Returns:
+ * Seconds elapsed since since.
+ */
+double elapsed(const struct timespec *since){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+/* Synopsis:
+ * CmdStats *find_stats(const char *name)
+ *
+ * Description:
+ * The function looks up the statistics kept for command name,
+ * adding an empty record the first time name is run.
+ *
+ * Returns:
+ * The statistics of name.
+ */
+CmdStats *find_stats(const char *name){
+    unsigned int bucket = hash_string(name) % HASH_SIZE;
+    CmdStats *entry;
+
+    for(entry = stats_table[bucket]; entry != NULL; entry = entry->next)
+        if(strcmp(entry->name, name) == 0)
+            return entry;
+    entry = calloc(1, sizeof(CmdStats));
+    entry->name = strdup(name);
+    entry->next = stats_table[bucket];
+    stats_table[bucket] = entry;
+    return entry;
+}
+
+/* Synopsis:
+ * void record_stats(CmdStats *entry, double secs, long rss)
+ *
+ * Description:
+ * The function adds one run of a command taking secs seconds and
+ * peaking at rss KB to its statistics. The latency is also put in
+ * the window of the last STATS_WINDOW runs used for percentiles.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void record_stats(CmdStats *entry, double secs, long rss){
+    entry->window[entry->count % STATS_WINDOW] = secs;
+    entry->count++;
+    entry->total += secs;
+    if(rss > entry->peak_rss)
+        entry->peak_rss = rss;
+}
+
+/* Synopsis:
+ * void add_usage(struct rusage *total, const struct rusage *usage)
+ *
+ * Description:
+ * The function adds the times and context switches of usage to
+ * total and keeps the larger of their peak resident sizes.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_usage(struct rusage *total, const struct rusage *usage){
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+    if(usage->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = usage->ru_maxrss;
+}
+
+/* Synopsis:
+ * void print_time(const char *label, double secs)
+ *
+ * Description:
+ * The function prints one line of the time builtin's report
+ * to stderr in minutes and seconds.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void print_time(const char *label, double secs){
+    int minutes = (int)(secs / 60);
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, secs - minutes * 60);
+}
+
+/* Synopsis:
+ * void time_command()
+ *
+ * Description:
+ * The function implements the time prefix. The rest of the command
+ * line is run, pipelines included, and its wall clock, user and system
+ * time, peak resident size and context switches are printed to stderr.
+ * Children are reaped with wait4() so their usage is added up without
+ * starting /usr/bin/time, and the shell's own usage is added for
+ * builtins run in process.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void time_command(){
+    struct rusage before, after, usage;
+    struct timespec start;
+    double real;
+    size_t i;
+
+    exec_last = 0; /* The report comes after the command. */
+
+    /* Drop the word 'time' and run the rest as a command line. */
+    for(i = 0; i < cmd_len; i++)
+        cmdStr[i] = cmdStr[i + 1];
+    cmd_len--;
+
+    memset(&job_usage, 0, sizeof(job_usage));
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    commands();
+    real = elapsed(&start);
+    getrusage(RUSAGE_SELF, &after);
+
+    usage = job_usage;
+    timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+    after.ru_nvcsw -= before.ru_nvcsw;
+    after.ru_nivcsw -= before.ru_nivcsw;
+    if(usage.ru_maxrss > 0) /* A child ran, report its size rather than the shell's. */
+        after.ru_maxrss = 0;
+    add_usage(&usage, &after);
+
+    fflush(stdout);
+    fputc('\n', stderr);
+    print_time("real", real);
+    print_time("user", usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6);
+    print_time("sys", usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+    fprintf(stderr, "maxrss\t%ld KB\n", usage.ru_maxrss);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n", usage.ru_nvcsw, usage.ru_nivcsw);
+}
+
+/* Synopsis:
+ * int compare_latency(const void *a, const void *b)
+ *
+ * Description:
+ * The function orders latencies for qsort().
+ *
+ * Returns:
+ * Negative, zero or positive as a is less than, equal to or greater than b.
+ */
+int compare_latency(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Synopsis:
+ * int compare_stats(const void *a, const void *b)
+ *
+ * Description:
+ * The function orders command statistics by total time spent,
+ * most first, for qsort().
+ *
+ * Returns:
+ * Negative, zero or positive as a comes before, with or after b.
+ */
+int compare_stats(const void *a, const void *b){
+    double x = (*(CmdStats * const *)a)->total, y = (*(CmdStats * const *)b)->total;
+    return (x < y) - (x > y);
+}
+
+/* Synopsis:
+ * void stats()
+ *
+ * Description:
+ * The function implements the stats builtin.
+ * 'stats' prints for each command run how often it ran, its mean
+ * latency, the median and 99th percentile latency of its last
+ * STATS_WINDOW runs and its peak resident size, the commands which
+ * took the most time in total first. Builtins run in process have
+ * no size of their own.
+ * 'stats -r' clears the statistics.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void stats(){
+    CmdStats *entry, **list;
+    double window[STATS_WINDOW];
+    int i, n = 0, samples;
+
+    if(cmdStr[1] != NULL && strcmp(cmdStr[1], "-r") != 0){
+        puts("STATS: Error unknown option, use -r to reset.");
+        last_status = 2;
+        return;
+    }
+    for(i = 0; i < HASH_SIZE; i++){
+        for(entry = stats_table[i]; entry != NULL; entry = entry->next){
+            if(cmdStr[1] != NULL){ /* Running jobs still point at the record. */
+                entry->count = 0;
+                entry->total = 0;
+                entry->peak_rss = 0;
+            }
+            else if(entry->count > 0)
+                n++;
+        }
+    }
+    if(n == 0)
+        return;
+
+    list = malloc(n * sizeof(CmdStats *));
+    n = 0;
+    for(i = 0; i < HASH_SIZE; i++)
+        for(entry = stats_table[i]; entry != NULL; entry = entry->next)
+            if(entry->count > 0)
+                list[n++] = entry;
+    qsort(list, n, sizeof(CmdStats *), compare_stats);
+
+    printf("%-20s %8s %12s %12s %12s %10s\n", "command", "count", "mean", "p50", "p99", "peak rss");
+    for(i = 0; i < n; i++){
+        entry = list[i];
+        samples = entry->count < STATS_WINDOW ? (int)entry->count : STATS_WINDOW;
+        memcpy(window, entry->window, samples * sizeof(double));
+        qsort(window, samples, sizeof(double), compare_latency);
+        printf("%-20s %8ld %10.3fms %10.3fms %10.3fms ", entry->name, entry->count,
+               entry->total / entry->count * 1e3, window[(samples * 50 + 99) / 100 - 1] * 1e3,
+               window[(samples * 99 + 99) / 100 - 1] * 1e3);
+        if(entry->peak_rss > 0)
+            printf("%7ld KB\n", entry->peak_rss);
+        else
+            printf("%10s\n", "-");
+    }
+    free(list);
+}
+
+/* Job Control */
+
+/* Synopsis:
+ * void events_init()
+ *
+ * Description:
+ * The function sets up the event loop used to reap children.
+ * Each child gets a pidfd which becomes readable when it exits,
+ * SIGCHLD is blocked and read from a signalfd so that stopped
+ * children are noticed too. Both are watched by one epoll instance.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void events_init(){
+    struct epoll_event ev;
+    sigset_t mask;
+
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+        perror("epoll_create1() error");
+        return;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if((sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) >= 0){
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL; /* NULL marks the signalfd, pidfds carry their Proc. */
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    }
+}
+
+/* Synopsis:
+ * void events_forget()
+ *
+ * Description:
+ * The function is called in a forked child which keeps running shell
+ * code. It drops the child's handles on the parent's event loop so
+ * it cannot consume the parent's events, forgets inherited jobs and
+ * starts an event loop of its own.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void events_forget(){
+    if(epoll_fd >= 0)
+        close(epoll_fd);
+    if(sigchld_fd >= 0)
+        close(sigchld_fd);
+    epoll_fd = sigchld_fd = -1;
+    job_count = 0;
+    events_init();
+}
+
+/* Synopsis:
+ * void watch_proc(Proc *proc)
+ *
+ * Description:
+ * The function opens a pidfd for a newly started process and adds
+ * it to the event loop. If pidfds are not supported the process is
+ * still reaped when SIGCHLD arrives.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void watch_proc(Proc *proc){
+    struct epoll_event ev;
+
+    proc->pidfd = -1;
+    if(epoll_fd < 0)
+        return;
+    if((proc->pidfd = (int)syscall(SYS_pidfd_open, proc->pid, 0)) < 0)
+        return;
+    fcntl(proc->pidfd, F_SETFD, FD_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = proc;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, proc->pidfd, &ev) < 0){
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+}
+
+/* Synopsis:
+ * void update_proc(Proc *proc, int flags)
+ *
+ * Description:
+ * The function collects any change of state of proc, without
+ * blocking if flags holds WNOHANG, and updates the counters of the
+ * job it belongs to. When proc has finished its resource usage is
+ * kept and its run added to the statistics of its command.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void update_proc(Proc *proc, int flags){
+    Job *job = proc->job;
+    struct rusage usage;
+    int status;
+
+    if(proc->state == PROC_DONE)
+        return;
+    if(wait4(proc->pid, &status, flags | WUNTRACED | WCONTINUED, &usage) != proc->pid)
+        return;
+
+    if(WIFSTOPPED(status)){
+        if(proc->state == PROC_RUNNING)
+            job->running--;
+        proc->state = PROC_STOPPED;
+    }
+    else if(WIFCONTINUED(status)){
+        if(proc->state == PROC_STOPPED)
+            job->running++;
+        proc->state = PROC_RUNNING;
+    }
+    else{
+        if(proc->state == PROC_RUNNING)
+            job->running--;
+        proc->state = PROC_DONE;
+        proc->status = status;
+        proc->usage = usage;
+        if(proc->stats != NULL)
+            record_stats(proc->stats, elapsed(&proc->started), usage.ru_maxrss);
+        job->alive--;
+        if(proc->pidfd >= 0){ /* Closing the pidfd also removes it from epoll. */
+            close(proc->pidfd);
+            proc->pidfd = -1;
+        }
+    }
+}
+
+/* Synopsis:
+ * int process_events(int timeout)
+ *
+ * Description:
+ * The function waits up to timeout milliseconds (-1 for ever,
+ * 0 to only poll) for children to exit or stop and records what
+ * happened to them.
+ *
+ * Returns:
+ * Number of events handled.
+ */
+int process_events(int timeout){
+    struct epoll_event events[16];
+    struct signalfd_siginfo info;
+    int n, i, j, k;
+
+    if(epoll_fd < 0)
+        return 0;
+    while((n = epoll_wait(epoll_fd, events, SIZE(events), timeout)) < 0 && errno == EINTR)
+        ;
+
+    for(i = 0; i < n; i++){
+        if(events[i].data.ptr != NULL){
+            update_proc(events[i].data.ptr, WNOHANG);
+            continue;
+        }
+        /* SIGCHLD: something stopped, continued or exited without a pidfd. */
+        while(read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+            ;
+        for(j = 0; j < job_count; j++)
+            for(k = 0; k < job_table[j]->nprocs; k++)
+                update_proc(&job_table[j]->procs[k], WNOHANG);
+    }
+    return n < 0 ? 0 : n;
+}
+
+/* Synopsis:
+ * Job *add_job(char *cmd, int nprocs, int background)
+ *
+ * Description:
+ * The function adds a job with room for nprocs processes to the
+ * job table. The job takes ownership of cmd, its command line. At
+ * the prompt its processes get a process group of their own, else
+ * they stay in the shell's so the terminal and its signals reach them.
+ *
+ * Returns:
+ * The new job.
+ */
+Job *add_job(char *cmd, int nprocs, int background){
+    Job *job = calloc(1, sizeof(Job));
+
+    job->id = job_count > 0 ? job_table[job_count - 1]->id + 1 : 1;
+    job->background = background;
+    job->pgid = interactive ? 0 : -1;
+    job->procs = calloc(nprocs, sizeof(Proc));
+    job->cmd = cmd;
+
+    if(job_count == job_capacity){
+        job_capacity = job_capacity ? job_capacity * 2 : 16;
+        job_table = realloc(job_table, job_capacity * sizeof(Job *));
+    }
+    job_table[job_count++] = job;
+    return job;
+}
+
+/* Synopsis:
+ * Job *new_job(char ***stages, int nstages, int background)
+ *
+ * Description:
+ * The function adds a job for the given pipeline stages to the job
+ * table. The job keeps a copy of its command line for reporting.
+ *
+ * Returns:
+ * The new job.
+ */
+Job *new_job(char ***stages, int nstages, int background){
+    size_t len = 0;
+    char *cmd;
+    int i, j;
+
+    for(i = 0; i < nstages; i++)
+        for(j = 0; stages[i][j] != NULL; j++)
+            len += strlen(stages[i][j]) + 3;
+    cmd = malloc(len + 1);
+    cmd[0] = '\0';
+    for(i = 0; i < nstages; i++){
+        if(i > 0)
+            strcat(cmd, "| ");
+        for(j = 0; stages[i][j] != NULL; j++){
+            strcat(cmd, stages[i][j]);
+            strcat(cmd, " ");
+        }
+    }
+    if(len > 0)
+        cmd[strlen(cmd) - 1] = '\0';
+
+    return add_job(cmd, nstages, background);
+}
+
+/* Synopsis:
+ * void free_job(Job *job)
+ *
+ * Description:
+ * The function removes a job from the job table and releases it.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void free_job(Job *job){
+    int i;
+
+    for(i = 0; i < job->nprocs; i++)
+        if(job->procs[i].pidfd >= 0)
+            close(job->procs[i].pidfd);
+    for(i = 0; i < job_count; i++){
+        if(job_table[i] == job){
+            memmove(&job_table[i], &job_table[i + 1], (job_count - i - 1) * sizeof(Job *));
+            job_count--;
+            break;
+        }
+    }
+    free(job->procs);
+    free(job->cmd);
+    free(job);
+}
+
+/* Synopsis:
+ * Job *start_job(char ***stages, int nstages, int background)
+ *
+ * Description:
+ * The function starts each stage of a pipeline at the same time.
+ * Stages are connected with close-on-exec pipes, resized to pipe_size
+ * if set, and placed in one new process group when the shell is
+ * interactive. A stage's redirections
+ * take the place of its pipes. Builtin stages run in a forked child.
+ * The job is returned without waiting for it.
+ *
+ * Returns:
+ * The started job.
+ * NULL if no stage could be started.
+ */
+Job *start_job(char ***stages, int nstages, int background){
+    int in_fd = -1, fds[2], file_in, file_out, i, cpu = background ? next_cpu(launch_sched) : -1;
+    Job *job = new_job(stages, nstages, background);
+    Launch launch_job;
+    Proc *proc;
+    pid_t pid;
+    uint64_t started;
+
+    fflush(stdout); /* Keep our output ahead of the job's. */
+    for(i = 0; i < nstages; i++){
+        fds[0] = fds[1] = -1;
+        if(i < nstages - 1){
+            if(pipe2(fds, O_CLOEXEC) < 0){
+                perror("Error");
+                break;
+            }
+#ifdef F_SETPIPE_SZ
+            if(pipe_size > 0)
+                fcntl(fds[1], F_SETPIPE_SZ, pipe_size);
+#endif
+        }
+
+        launch_init(&launch_job, stages[i]);
+        launch_job.fd_in = in_fd;
+        launch_job.fd_out = fds[1];
+        launch_job.pgid = job->pgid;
+        launch_job.cpu = cpu;
+        TRACE_START(started);
+        if(open_redirects(stages[i], &file_in, &file_out) < 0)
+            pid = -1;
+        else{
+            if(file_in >= 0)
+                launch_job.fd_in = file_in;
+            if(file_out >= 0)
+                launch_job.fd_out = file_out;
+            if(stages[i][0] == NULL) /* Only redirections, the files are made and that is all. */
+                pid = -1;
+            else if(is_builtin(stages[i][0]))
+                pid = fork_builtin(&launch_job, fds[0]);
+            else
+                pid = start_command(&launch_job);
+            if(file_in >= 0)
+                close(file_in);
+            if(file_out >= 0)
+                close(file_out);
+        }
+        TRACE_END(started, "launch", stages[i][0], pid);
+
+        if(pid > 0){
+            if(job->pgid == 0) /* First stage started leads the group. */
+                job->pgid = pid;
+            if(job->pgid > 0)
+                setpgid(pid, job->pgid); /* The child does this too, whichever runs first wins. */
+            proc = &job->procs[job->nprocs++];
+            proc->pid = pid;
+            proc->state = PROC_RUNNING;
+            proc->job = job;
+            proc->stats = find_stats(stages[i][0]);
+            clock_gettime(CLOCK_MONOTONIC, &proc->started);
+            watch_proc(proc);
+            job->running++;
+            job->alive++;
+        }
+
+        /* The stages now own these ends. */
+        if(in_fd >= 0)
+            close(in_fd);
+        if(fds[1] >= 0)
+            close(fds[1]);
+        in_fd = fds[0];
+    }
+    if(in_fd >= 0)
+        close(in_fd);
+
+    if(job->nprocs == 0){
+        free_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* Synopsis:
+ * int wait_job(Job *job)
+ *
+ * Description:
+ * The function runs job in the foreground. The job is given the
+ * terminal and the event loop runs until every process of the job
+ * has finished or the job has been stopped. Finished jobs are
+ * removed, stopped ones stay in the job table as background jobs.
+ *
+ * Returns:
+ * Wait status of the last process in the job.
+ */
+int wait_job(Job *job){
+    int status, i;
+    uint64_t started;
+
+    TRACE_START(started);
+    job->background = 0;
+    give_terminal(job->pgid);
+    while(job->running > 0){
+        if(epoll_fd < 0){ /* No event loop, fall back to blocking waits. */
+            for(i = 0; i < job->nprocs; i++)
+                if(job->procs[i].state == PROC_RUNNING)
+                    update_proc(&job->procs[i], 0);
+            continue;
+        }
+        process_events(-1);
+    }
+    give_terminal(getpgrp());
+    TRACE_END(started, "wait", job->cmd, job->alive > 0 ? -1 : job->procs[job->nprocs - 1].status);
+
+    if(job->alive > 0){ /* Stopped, keep the job and its terminal modes. */
+        if(interactive){
+            tcgetattr(STDIN_FILENO, &job->tmodes);
+            job->tmodes_saved = 1;
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+        }
+        job->background = 1;
+        job->stopped = 1;
+        printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->cmd);
+        return 0;
+    }
+
+    if(interactive)
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    status = job->procs[job->nprocs - 1].status;
+    for(i = 0; i < job->nprocs; i++)
+        add_usage(&job_usage, &job->procs[i].usage);
+    free_job(job);
+    return status;
+}
+
+/* Synopsis:
+ * void report_jobs()
+ *
+ * Description:
+ * The function polls the event loop without blocking and tells
+ * the user about background jobs which have finished or stopped
+ * since the last prompt. Finished jobs are removed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void report_jobs(){
+    Job *job;
+    int i;
+
+    while(process_events(0) > 0)
+        ;
+    for(i = 0; i < job_count; i++){
+        job = job_table[i];
+        if(job->alive == 0){
+            printf("[%d]  Done\t\t%s\n", job->id, job->cmd);
+            free_job(job);
+            i--;
+        }
+        else if(job->running == 0 && !job->stopped){
+            printf("[%d]+  Stopped\t\t%s\n", job->id, job->cmd);
+            job->stopped = 1;
+        }
+    }
+}
+
+/* Synopsis:
+ * void set_status(int status)
+ *
+ * Description:
+ * The function records the exit status of a finished job from
+ * its wait status, 128 plus the signal number if it was killed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void set_status(int status){
+    if(WIFEXITED(status))
+        last_status = WEXITSTATUS(status);
+    else if(WIFSIGNALED(status))
+        last_status = 128 + WTERMSIG(status);
+    else
+        last_status = 0;
+}
+
+/* Synopsis:
+ * void exec_command()
+ *
+ * Description:
+ * The function replaces the shell with the command in cmdStr[], for
+ * the last command of -c or a script when nothing is left to do
+ * afterwards. The command's exit status then becomes the shell's.
+ * The SIGCHLD block kept for the signalfd is lifted first as execve()
+ * passes the signal mask on.
+ *
+ * Returns:
+ * The function only returns if the command could not be run, with
+ * the shell's state unchanged so it can be started as usual.
+ */
+void exec_command(){
+    const char *path;
+    sigset_t mask, old;
+
+    if (has_redirect(cmdStr)) /* start_job() opens the files. */
+        return;
+    if (launch_sched->set != 0 || launch_sched->limits != 0) /* Children take run settings, the shell does not. */
+        return;
+    if (tracing) /* The trace would end with the shell. */
+        return;
+    if ((path = find_command(cmdStr[0])) == NULL)
+        return;
+    fflush(stdout);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, &old);
+    exec_file(path, cmdStr, build_envp());
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Synopsis:
+ * void createProcess()
+ *
+ * Description:
+ * The function resolves the command through the lookup cache,
+ * launches it as a child process, waits for it and
+ * goes back to parent process. The last command of -c or a
+ * script is run in place of the shell instead.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void createProcess(){
+    char **stages[1];
+    Job *job;
+
+    if (exec_last && job_count == 0)
+        exec_command();
+    exec_last = 0;
+
+    stages[0] = cmdStr;
+    if ((job = start_job(stages, 1, 0)) != NULL)
+        set_status(wait_job(job));
+    else
+        last_status = 127;
+}
+
+/* Synopsis:
+ * void run_pipeline(int background)
+ *
+ * Description:
+ * The function splits cmdStr into its '|' separated stages and
+ * runs them as one job. A foreground job is waited for, a background
+ * job is announced with its number and process group.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_pipeline(int background){
+    char **words = arena_alloc(&line_arena, (cmd_len + 1) * sizeof(char *));
+    char ***stages = arena_alloc(&line_arena, (cmd_len + 1) * sizeof(char **));
+    int nstages = 0, i;
+    Job *job;
+
+    /* Split a copy of cmdStr into NULL terminated stages at each '|'. */
+    stages[nstages++] = words;
+    for(i = 0; cmdStr[i] != NULL; i++){
+        if(strcmp(cmdStr[i], "|") == 0){
+            words[i] = NULL;
+            stages[nstages++] = &words[i + 1];
+        }
+        else
+            words[i] = cmdStr[i];
+    }
+    words[i] = NULL;
+
+    for(i = 0; i < nstages; i++){
+        if(stages[i][0] == NULL){
+            puts("PIPE: Error missing command.");
+            return;
+        }
+    }
+
+    if((job = start_job(stages, nstages, background)) == NULL){
+        last_status = 127;
+        return;
+    }
+    if(background){
+        if(interactive)
+            printf("[%d] %d\n", job->id, (int)job->pgid);
+        last_status = 0;
+    }
+    else
+        set_status(wait_job(job));
+}
+
+/* Synopsis:
+ * void set_pipesize()
+ *
+ * Description:
+ * The function implements the pipesize builtin.
+ * 'pipesize' prints the capacity used for pipeline pipes.
+ * 'pipesize <bytes>' sets it, 0 restores the system default.
+ * The kernel rounds the size up to a whole number of pages.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void set_pipesize(){
+    int fds[2], size;
+    char *end;
+
+    if(cmdStr[1] == NULL){
+        if(pipe_size == 0)
+            puts("default");
+        else
+            printf("%d\n", pipe_size);
+        return;
+    }
+    size = (int)strtol(cmdStr[1], &end, 10);
+    if(*end != '\0' || size < 0){
+        puts("PIPESIZE: Error invalid size.");
+        return;
+    }
+    if(size == 0){
+        pipe_size = 0;
+        return;
+    }
+
+#ifdef F_SETPIPE_SZ
+    /* Try the size on a scratch pipe to find what the kernel will allow. */
+    if(pipe2(fds, O_CLOEXEC) < 0){
+        perror("PIPESIZE: Error");
+        return;
+    }
+    if((size = fcntl(fds[1], F_SETPIPE_SZ, size)) < 0)
+        perror("PIPESIZE: Error");
+    else
+        pipe_size = size;
+    close(fds[0]);
+    close(fds[1]);
+#else
+    (void)fds;
+    puts("PIPESIZE: Error not supported on this system.");
+#endif
+}
+
+/* Synopsis:
+ * Job *find_job(const char *spec)
+ *
+ * Description:
+ * The function finds the job named by spec, which is a job number
+ * optionally preceded by '%'. With no spec the most recent job is used.
+ *
+ * Returns:
+ * The job.
+ * NULL if there is no such job, after printing an error.
+ */
+Job *find_job(const char *spec){
+    int i, id;
+
+    if(spec == NULL){
+        if(job_count > 0)
+            return job_table[job_count - 1];
+        puts("Error: No current job.");
+        return NULL;
+    }
+    if(spec[0] == '%')
+        spec++;
+    id = atoi(spec);
+    for(i = 0; i < job_count; i++)
+        if(job_table[i]->id == id)
+            return job_table[i];
+    printf("Error: %s: No such job.\n", spec);
+    return NULL;
+}
+
+/* Synopsis:
+ * void list_jobs()
+ *
+ * Description:
+ * The function implements the jobs builtin, which prints
+ * every job with its state.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void list_jobs(){
+    Job *job;
+    int i;
+
+    while(process_events(0) > 0)
+        ;
+    for(i = 0; i < job_count; i++){
+        job = job_table[i];
+        printf("[%d]%c  %s\t\t%s\n", job->id, i == job_count - 1 ? '+' : ' ',
+               job->alive == 0 ? "Done" : job->running == 0 ? "Stopped" : "Running", job->cmd);
+    }
+}
+
+/* Synopsis:
+ * int signal_job(Job *job, int sig)
+ *
+ * Description:
+ * The function sends sig to job, to its process group or, when it
+ * has none of its own, to each of its processes not yet finished.
+ *
+ * Returns:
+ * 0 if the signal was sent.
+ * -1 with errno set otherwise.
+ */
+int signal_job(Job *job, int sig){
+    int result = 0, i;
+
+    if(job->pgid > 0)
+        return kill(-job->pgid, sig);
+    for(i = 0; i < job->nprocs; i++)
+        if(job->procs[i].state != PROC_DONE && kill(job->procs[i].pid, sig) < 0)
+            result = -1;
+    return result;
+}
+
+/* Synopsis:
+ * void continue_job(Job *job)
+ *
+ * Description:
+ * The function sends SIGCONT to every process of job and marks the
+ * stopped processes as running again.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void continue_job(Job *job){
+    int i;
+
+    for(i = 0; i < job->nprocs; i++){
+        if(job->procs[i].state == PROC_STOPPED){
+            job->procs[i].state = PROC_RUNNING;
+            job->running++;
+        }
+    }
+    job->stopped = 0;
+    if(signal_job(job, SIGCONT) < 0)
+        perror("Error");
+}
+
+/* Synopsis:
+ * void fg()
+ *
+ * Description:
+ * The function implements the fg builtin, which brings a job
+ * to the foreground, continuing it if it is stopped.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void fg(){
+    Job *job;
+
+    if((job = find_job(cmdStr[1])) == NULL)
+        return;
+
+    if(interactive)
+        puts(job->cmd);
+    /* A job stopped in the background never had modes of its own. */
+    if(interactive && job->stopped)
+        tcsetattr(STDIN_FILENO, TCSADRAIN, job->tmodes_saved ? &job->tmodes : &shell_tmodes);
+    give_terminal(job->pgid);
+    if(job->running < job->alive)
+        continue_job(job);
+    set_status(wait_job(job));
+}
+
+/* Synopsis:
+ * void bg()
+ *
+ * Description:
+ * The function implements the bg builtin, which continues a
+ * stopped job in the background.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bg(){
+    Job *job;
+
+    if((job = find_job(cmdStr[1])) == NULL)
+        return;
+
+    if(job->running == job->alive){
+        printf("Error: job %d already in background.\n", job->id);
+        return;
+    }
+    continue_job(job);
+    printf("[%d]+ %s &\n", job->id, job->cmd);
+}
+
+/* Synopsis:
+ * void wait_jobs()
+ *
+ * Description:
+ * The function implements the wait builtin. It waits for the
+ * given jobs, or for every running job if none are given.
+ * Stopped jobs are not waited for.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void wait_jobs(){
+    Job *job;
+    int i, busy = 1;
+
+    for(i = 1; cmdStr[i] != NULL; i++){
+        if((job = find_job(cmdStr[i])) == NULL)
+            continue;
+        while(job->running > 0)
+            process_events(-1);
+    }
+    if(cmdStr[1] != NULL)
+        return;
+
+    while(busy){
+        busy = 0;
+        for(i = 0; i < job_count; i++)
+            if(job_table[i]->running > 0)
+                busy = 1;
+        if(busy)
+            process_events(-1);
+    }
+}
+
+/* Parallel Executor */
+
+/* Synopsis:
+ * void copy_output(int fd)
+ *
+ * Description:
+ * The function writes everything captured in fd to stdout
+ * and closes fd.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void copy_output(int fd){
+    char buf[65536];
+    ssize_t n;
+
+    fflush(stdout);
+    lseek(fd, 0, SEEK_SET);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        if(write(STDOUT_FILENO, buf, n) != n)
+            break;
+    close(fd);
+}
+
+/* Synopsis:
+ * void parallel()
+ *
+ * Description:
+ * The function implements the parallel builtin:
+ * 'parallel [-j jobs] [-n args] [-k] [-a file] command [args...]'
+ * One argument is read per line from file, or from stdin without -a,
+ * and appended to command in batches. Without -n each worker gets
+ * about four batches so that slow batches even out, and a batch never
+ * grows past what fits within ARG_MAX. Up to jobs batches (default the
+ * number of online cores) run at once, taken from a ready queue in
+ * input order. Each batch's stdout is captured and written whole when
+ * it finishes, or in input order with -k; a worker is free again as
+ * soon as its batch exits. The builtin runs in the shell and cannot
+ * be suspended, so when the running batches are stopped, as by
+ * Ctrl-Z, they are ended and no more are started. A throughput
+ * summary is written to stderr at the end.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void parallel(){
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN), per_batch = 0, keep_order = 0;
+    int first, nbase, nargs = 0, args_cap = 0, nbatches = 0, next = 0, flushed = 0;
+    int cancelled = 0, failed = 0, i, j;
+    long arg_max = sysconf(_SC_ARG_MAX), budget, used, base = 0;
+    char **args = NULL, *line = NULL, *end, **envp;
+    size_t line_cap = 0;
+    ssize_t len;
+    FILE *input = stdin;
+    struct timeval start, finish;
+    double secs;
+    struct batch{
+        int first, count, out, collected;
+        pid_t pid;
+    } *batches;
+    Launch launch_job;
+    Job *job;
+    Proc *proc;
+
+    /* Parse options. */
+    for(i = 1; cmdStr[i] != NULL && cmdStr[i][0] == '-'; i++){
+        if(strcmp(cmdStr[i], "--") == 0){
+            i++;
+            break;
+        }
+        else if(strcmp(cmdStr[i], "-k") == 0)
+            keep_order = 1;
+        else if((strcmp(cmdStr[i], "-j") == 0 || strcmp(cmdStr[i], "-n") == 0) && cmdStr[i + 1] != NULL){
+            j = (int)strtol(cmdStr[i + 1], &end, 10);
+            if(*end != '\0' || j <= 0){
+                puts("PARALLEL: Error invalid number.");
+                return;
+            }
+            if(cmdStr[i][1] == 'j')
+                jobs = j;
+            else
+                per_batch = j;
+            i++;
+        }
+        else if(strcmp(cmdStr[i], "-a") == 0 && cmdStr[i + 1] != NULL){
+            if((input = fopen(cmdStr[++i], "r")) == NULL){
+                perror("PARALLEL: Error");
+                return;
+            }
+        }
+        else{
+            puts("PARALLEL: Usage: parallel [-j jobs] [-n args] [-k] [-a file] command [args...]");
+            return;
+        }
+    }
+    if(cmdStr[i] == NULL){
+        puts("PARALLEL: Error no command given.");
+        if(input != stdin)
+            fclose(input);
+        return;
+    }
+    first = i;
+    if(jobs < 1)
+        jobs = 1;
+
+    /* Read one argument per line. */
+    while((len = getline(&line, &line_cap, input)) >= 0){
+        if(len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if(len == 0)
+            continue;
+        if(nargs == args_cap){
+            args_cap = args_cap ? args_cap * 2 : 256;
+            args = realloc(args, args_cap * sizeof(char *));
+        }
+        args[nargs++] = strdup(line);
+    }
+    free(line);
+    if(input != stdin)
+        fclose(input);
+    else
+        clearerr(stdin); /* A terminal may still be used after end of input. */
+    if(nargs == 0){
+        free(args);
+        return;
+    }
+
+    /* Work out how many bytes of arguments a single exec can take. */
+    for(envp = build_envp(); *envp != NULL; envp++)
+        base += strlen(*envp) + 1 + sizeof(char *);
+    for(nbase = 0; cmdStr[first + nbase] != NULL; nbase++)
+        base += strlen(cmdStr[first + nbase]) + 1 + sizeof(char *);
+    budget = arg_max - base - 4096;
+    if(per_batch == 0)
+        per_batch = (nargs + jobs * 4 - 1) / (jobs * 4);
+
+    /* Split the arguments into a queue of batches. */
+    batches = malloc(nargs * sizeof(*batches));
+    for(i = 0; i < nargs; ){
+        batches[nbatches].first = i;
+        batches[nbatches].collected = 0;
+        used = 0;
+        for(j = 0; i < nargs && j < per_batch; i++, j++){
+            used += strlen(args[i]) + 1 + sizeof(char *);
+            if(j > 0 && used > budget)
+                break;
+        }
+        batches[nbatches++].count = j;
+    }
+
+    job = add_job(strdup("parallel"), nbatches, 0);
+    gettimeofday(&start, NULL);
+    fflush(stdout);
+
+    while(flushed < nbatches){
+        /* Start batches from the ready queue while workers are free. */
+        while(next < nbatches && job->alive < jobs){
+            struct batch *b = &batches[next];
+            char **argv = malloc((nbase + b->count + 1) * sizeof(char *));
+
+            memcpy(argv, &cmdStr[first], nbase * sizeof(char *));
+            memcpy(argv + nbase, &args[b->first], b->count * sizeof(char *));
+            argv[nbase + b->count] = NULL;
+
+            launch_init(&launch_job, argv);
+            launch_job.fd_out = b->out = memfd_create("parallel", MFD_CLOEXEC);
+            if(job->alive == 0 && interactive) /* The group dies with its last member, start a new one. */
+                job->pgid = 0;
+            launch_job.pgid = job->pgid;
+            launch_job.cpu = next_cpu(launch_sched);
+            b->pid = is_builtin(argv[0]) ? fork_builtin(&launch_job, -1) : start_command(&launch_job);
+            free(argv);
+
+            proc = &job->procs[job->nprocs++];
+            proc->job = job;
+            proc->pid = b->pid;
+            proc->stats = find_stats(cmdStr[first]);
+            clock_gettime(CLOCK_MONOTONIC, &proc->started);
+            if(b->pid > 0){
+                if(job->pgid == 0){
+                    job->pgid = b->pid;
+                    give_terminal(job->pgid);
+                }
+                if(job->pgid > 0)
+                    setpgid(b->pid, job->pgid);
+                proc->state = PROC_RUNNING;
+                watch_proc(proc);
+                job->running++;
+                job->alive++;
+            }
+            else{
+                proc->state = PROC_DONE;
+                proc->status = 127 << 8;
+                proc->pidfd = -1;
+            }
+            next++;
+        }
+
+        /* Collect finished batches, in input order with -k. */
+        for(i = flushed; i < next; i++){
+            struct batch *b = &batches[i];
+            proc = &job->procs[i];
+            if(b->collected || proc->state != PROC_DONE){
+                if(keep_order)
+                    break;
+                continue;
+            }
+            if(!WIFEXITED(proc->status) || WEXITSTATUS(proc->status) != 0)
+                failed++;
+            if(b->out >= 0) /* Without a memfd the batch wrote straight to stdout. */
+                copy_output(b->out);
+            b->collected = 1;
+        }
+        while(flushed < next && batches[flushed].collected)
+            flushed++;
+
+        if(job->alive > 0 && job->running == 0){ /* Stopped, end the batches and start no more. */
+            signal_job(job, SIGTERM);
+            signal_job(job, SIGCONT);
+            nbatches = next;
+            cancelled = 1;
+        }
+        if(flushed < nbatches && (next == nbatches || job->alive >= jobs))
+            process_events(-1);
+    }
+    give_terminal(getpgrp());
+    gettimeofday(&finish, NULL);
+
+    secs = (finish.tv_sec - start.tv_sec) + (finish.tv_usec - start.tv_usec) / 1e6;
+    if(cancelled)
+        fprintf(stderr, "parallel: stopped, batches after the first %d cancelled\n", nbatches);
+    fprintf(stderr, "parallel: %d args in %d batches on %d workers, %d failed, %.3f s, %.1f args/s\n",
+            nargs, nbatches, jobs, failed, secs, secs > 0 ? nargs / secs : 0.0);
+
+    free_job(job);
+    free(batches);
+    for(i = 0; i < nargs; i++)
+        free(args[i]);
+    free(args);
+}
+
+/* Simple Builtins */
+
+/* Synopsis:
+ * const char *put_escape(const char *str, int echo_style)
+ *
+ * Description:
+ * The function writes out the backslash escape str starts with, as
+ * echo -e and printf understand them. Octal escapes are written
+ * \0nnn in echo style and \nnn otherwise. Unknown escapes are
+ * written as they are.
+ *
+ * Returns:
+ * Pointer to the character after the escape.
+ * NULL if the escape was \c, which ends all output.
+ */
+const char *put_escape(const char *str, int echo_style){
+    int c, n;
+
+    switch(*++str){
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'c': return NULL;
+    case 'e': c = 033; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'x':
+        for(c = 0, n = 0; n < 2 && isxdigit((unsigned char)str[1]); n++){
+            str++;
+            c = c * 16 + (isdigit((unsigned char)*str) ? *str - '0' : tolower((unsigned char)*str) - 'a' + 10);
+        }
+        if(n == 0){
+            putchar('\\');
+            c = 'x';
+        }
+        break;
+    default:
+        if(echo_style ? *str == '0' : (*str >= '0' && *str <= '7')){
+            c = echo_style ? 0 : *str - '0';
+            for(n = echo_style ? 0 : 1; n < 3 && str[1] >= '0' && str[1] <= '7'; n++)
+                c = c * 8 + *++str - '0';
+        }
+        else{
+            putchar('\\');
+            c = *str;
+        }
+    }
+    putchar(c);
+    return str + 1;
+}
+
+/* Synopsis:
+ * int put_escaped(const char *str, int echo_style)
+ *
+ * Description:
+ * The function writes str to stdout expanding its backslash
+ * escapes with put_escape().
+ *
+ * Returns:
+ * 1 if a \c escape ended the output.
+ * 0 otherwise.
+ */
+int put_escaped(const char *str, int echo_style){
+    while(*str != '\0'){
+        if(*str == '\\' && str[1] != '\0'){
+            if((str = put_escape(str, echo_style)) == NULL)
+                return 1;
+        }
+        else
+            putchar(*str++);
+    }
+    return 0;
+}
+
+/* Synopsis:
+ * void echo()
+ *
+ * Description:
+ * The function implements the echo builtin. It writes its arguments
+ * separated by spaces and followed by a newline. -n leaves out the
+ * newline, -e expands backslash escapes and -E turns that off again.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void echo(){
+    int i, newline = 1, escapes = 0;
+    const char *opt;
+
+    /* Only words made up of n, e and E are taken as options. */
+    for(i = 1; cmdStr[i] != NULL && cmdStr[i][0] == '-' && cmdStr[i][1] != '\0'; i++){
+        for(opt = cmdStr[i] + 1; *opt == 'n' || *opt == 'e' || *opt == 'E'; opt++)
+            ;
+        if(*opt != '\0')
+            break;
+        for(opt = cmdStr[i] + 1; *opt != '\0'; opt++){
+            if(*opt == 'n')
+                newline = 0;
+            else
+                escapes = (*opt == 'e');
+        }
+    }
+
+    for(; cmdStr[i] != NULL; i++){
+        if(!escapes)
+            fputs(cmdStr[i], stdout);
+        else if(put_escaped(cmdStr[i], 1))
+            return;
+        if(cmdStr[i + 1] != NULL)
+            putchar(' ');
+    }
+    if(newline)
+        putchar('\n');
+}
+
+/* Synopsis:
+ * void builtin_true()
+ *
+ * Description:
+ * The function implements the true builtin.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void builtin_true(){
+    last_status = 0;
+}
+
+/* Synopsis:
+ * void builtin_false()
+ *
+ * Description:
+ * The function implements the false builtin.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void builtin_false(){
+    last_status = 1;
+}
+
+/* Synopsis:
+ * int test_integer(Test *test, const char *arg, long long *value)
+ *
+ * Description:
+ * The function reads the integer operand arg of a test expression.
+ *
+ * Returns:
+ * 1 if arg is an integer, stored in value.
+ * 0 otherwise, and the expression is marked malformed.
+ */
+int test_integer(Test *test, const char *arg, long long *value){
+    char *end;
+
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    while(isspace((unsigned char)*end))
+        end++;
+    if(arg[0] == '\0' || *end != '\0' || errno != 0){
+        printf("test: %s: integer expression expected\n", arg);
+        test->error = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Synopsis:
+ * int is_test_unary(const char *op)
+ *
+ * Description:
+ * The function checks whether op is a unary test operator.
+ *
+ * Returns:
+ * 1 if op is a unary operator.
+ * 0 otherwise.
+ */
+int is_test_unary(const char *op){
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghkLnprsStuwxzOG", op[1]) != NULL;
+}
+
+/* Synopsis:
+ * int is_test_binary(const char *op)
+ *
+ * Description:
+ * The function checks whether op is a binary test operator.
+ *
+ * Returns:
+ * 1 if op is a binary operator.
+ * 0 otherwise.
+ */
+int is_test_binary(const char *op){
+    static const char *binary[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef"};
+    int i;
+
+    for(i = 0; i < (int)SIZE(binary); i++)
+        if(strcmp(op, binary[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* Synopsis:
+ * int test_unary(const char *op, const char *arg)
+ *
+ * Description:
+ * The function applies the unary test operator op to arg.
+ *
+ * Returns:
+ * 1 if the test holds.
+ * 0 otherwise.
+ */
+int test_unary(const char *op, const char *arg){
+    struct stat st;
+
+    switch(op[1]){
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't': return isatty(atoi(arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if(stat(arg, &st) < 0)
+        return 0;
+    switch(op[1]){
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    case 's': return st.st_size > 0;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+    return 1; /* -e */
+}
+
+/* Synopsis:
+ * int test_newer(const char *path, const char *other)
+ *
+ * Description:
+ * The function compares the modification times of two files
+ * for the -nt and -ot test operators.
+ *
+ * Returns:
+ * 1 if path exists and other does not or is older.
+ * 0 otherwise.
+ */
+int test_newer(const char *path, const char *other){
+    struct stat st, st_other;
+
+    if(stat(path, &st) < 0)
+        return 0;
+    if(stat(other, &st_other) < 0)
+        return 1;
+    return st.st_mtim.tv_sec > st_other.st_mtim.tv_sec ||
+           (st.st_mtim.tv_sec == st_other.st_mtim.tv_sec && st.st_mtim.tv_nsec > st_other.st_mtim.tv_nsec);
+}
+
+/* Synopsis:
+ * int test_binary(Test *test, const char *left, const char *op, const char *right)
+ *
+ * Description:
+ * The function applies the binary test operator op to left and right.
+ *
+ * Returns:
+ * 1 if the test holds.
+ * 0 otherwise.
+ */
+int test_binary(Test *test, const char *left, const char *op, const char *right){
+    struct stat st_left, st_right;
+    long long a, b;
+
+    if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if(strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+
+    if(strcmp(op, "-nt") == 0)
+        return test_newer(left, right);
+    if(strcmp(op, "-ot") == 0)
+        return test_newer(right, left);
+    if(strcmp(op, "-ef") == 0)
+        return stat(left, &st_left) == 0 && stat(right, &st_right) == 0 &&
+               st_left.st_dev == st_right.st_dev && st_left.st_ino == st_right.st_ino;
+
+    if(!test_integer(test, left, &a) || !test_integer(test, right, &b))
+        return 0;
+    if(strcmp(op, "-eq") == 0)
+        return a == b;
+    if(strcmp(op, "-ne") == 0)
+        return a != b;
+    if(strcmp(op, "-lt") == 0)
+        return a < b;
+    if(strcmp(op, "-le") == 0)
+        return a <= b;
+    if(strcmp(op, "-gt") == 0)
+        return a > b;
+    return a >= b;
+}
+
+int test_or(Test *test);
+
+/* Synopsis:
+ * int test_primary(Test *test)
+ *
+ * Description:
+ * The function evaluates the next primary of a test expression:
+ * a binary test, a bracketed expression, a unary test or a
+ * single word, which holds if it is not empty.
+ *
+ * Returns:
+ * 1 if the primary holds.
+ * 0 otherwise.
+ */
+int test_primary(Test *test){
+    char **argv = test->argv;
+    int value;
+
+    if(test->pos >= test->end){
+        puts("test: Error argument expected.");
+        test->error = 1;
+        return 0;
+    }
+    if(test->pos + 2 < test->end && is_test_binary(argv[test->pos + 1])){
+        value = test_binary(test, argv[test->pos], argv[test->pos + 1], argv[test->pos + 2]);
+        test->pos += 3;
+        return value;
+    }
+    if(strcmp(argv[test->pos], "(") == 0 && test->pos + 1 < test->end){
+        test->pos++;
+        value = test_or(test);
+        if(test->pos >= test->end || strcmp(argv[test->pos], ")") != 0){
+            puts("test: Error missing ')'.");
+            test->error = 1;
+        }
+        test->pos++;
+        return value;
+    }
+    if(is_test_unary(argv[test->pos]) && test->pos + 1 < test->end){
+        value = test_unary(argv[test->pos], argv[test->pos + 1]);
+        test->pos += 2;
+        return value;
+    }
+    return argv[test->pos++][0] != '\0';
+}
+
+/* Synopsis:
+ * int test_not(Test *test)
+ *
+ * Description:
+ * The function evaluates a primary, negated by each '!' before it.
+ *
+ * Returns:
+ * 1 if the expression holds.
+ * 0 otherwise.
+ */
+int test_not(Test *test){
+    if(test->pos + 1 < test->end && strcmp(test->argv[test->pos], "!") == 0){
+        test->pos++;
+        return !test_not(test);
+    }
+    return test_primary(test);
+}
+
+/* Synopsis:
+ * int test_and(Test *test)
+ *
+ * Description:
+ * The function evaluates expressions joined by -a.
+ *
+ * Returns:
+ * 1 if every expression holds.
+ * 0 otherwise.
+ */
+int test_and(Test *test){
+    int value = test_not(test);
+
+    while(test->pos + 1 < test->end && strcmp(test->argv[test->pos], "-a") == 0){
+        test->pos++;
+        value = test_not(test) && value;
+    }
+    return value;
+}
+
+/* Synopsis:
+ * int test_or(Test *test)
+ *
+ * Description:
+ * The function evaluates expressions joined by -o, which binds
+ * less tightly than -a.
+ *
+ * Returns:
+ * 1 if any expression holds.
+ * 0 otherwise.
+ */
+int test_or(Test *test){
+    int value = test_and(test);
+
+    while(test->pos + 1 < test->end && strcmp(test->argv[test->pos], "-o") == 0){
+        test->pos++;
+        value = test_and(test) || value;
+    }
+    return value;
+}
+
+/* Synopsis:
+ * void test_builtin()
+ *
+ * Description:
+ * The function implements the test and [ builtins. The status is
+ * 0 if the expression holds, 1 if it does not and 2 if it is
+ * malformed. An empty expression does not hold.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void test_builtin(){
+    Test test;
+    int value;
+
+    test.argv = cmdStr + 1;
+    test.pos = 0;
+    test.error = 0;
+    for(test.end = 0; test.argv[test.end] != NULL; test.end++)
+        ;
+    if(strcmp(cmdStr[0], "[") == 0){
+        if(test.end == 0 || strcmp(test.argv[test.end - 1], "]") != 0){
+            puts("[: Error missing ']'.");
+            last_status = 2;
+            return;
+        }
+        test.end--;
+    }
+    if(test.end == 0){
+        last_status = 1;
+        return;
+    }
+
+    value = test_or(&test);
+    if(!test.error && test.pos < test.end){
+        printf("test: %s: unexpected argument\n", test.argv[test.pos]);
+        test.error = 1;
+    }
+    last_status = test.error ? 2 : !value;
+}
+
+/* Synopsis:
+ * char *printf_arg(char ***args)
+ *
+ * Description:
+ * The function takes the next argument for a printf conversion.
+ *
+ * Returns:
+ * The argument, or an empty string once they have run out.
+ */
+char *printf_arg(char ***args){
+    if(**args == NULL)
+        return "";
+    return *(*args)++;
+}
+
+/* Synopsis:
+ * long long printf_number(const char *arg)
+ *
+ * Description:
+ * The function reads a numeric printf argument. A leading quote
+ * gives the value of the character after it. Invalid numbers
+ * are reported and make the status 1.
+ *
+ * Returns:
+ * The value of arg.
+ */
+long long printf_number(const char *arg){
+    long long value;
+    char *end;
+
+    if(arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char)arg[1];
+    errno = 0;
+    value = strtoll(arg, &end, 0);
+    if(*end != '\0' || errno != 0){
+        printf("printf: %s: invalid number\n", arg);
+        last_status = 1;
+    }
+    return value;
+}
+
+/* Synopsis:
+ * const char *printf_conversion(const char *format, char ***args)
+ *
+ * Description:
+ * The function writes out the conversion which starts at the '%'
+ * format points to, taking its arguments from args. Flags, field
+ * width and precision (either of which may be '*') are handed to
+ * printf() with the conversion widened to long long or double.
+ *
+ * Returns:
+ * Pointer to the character after the conversion.
+ * NULL if output has to stop, after \c in a %b argument or an
+ * invalid conversion.
+ */
+const char *printf_conversion(const char *format, char ***args){
+    char spec[64], *arg;
+    int n = 0, part;
+
+    spec[n++] = *format++;
+    while(*format != '\0' && strchr("-+ #0", *format) != NULL && n < 8)
+        spec[n++] = *format++;
+    for(part = 0; part < 2; part++){
+        if(part == 1){
+            if(*format != '.')
+                break;
+            spec[n++] = *format++;
+        }
+        if(*format == '*'){
+            n += sprintf(spec + n, "%d", (int)printf_number(printf_arg(args)));
+            format++;
+        }
+        else{
+            while(isdigit((unsigned char)*format) && n < 40)
+                spec[n++] = *format++;
+        }
+    }
+
+    switch(*format){
+    case 'd':
+    case 'i':
+        strcpy(spec + n, "lld");
+        printf(spec, printf_number(printf_arg(args)));
+        break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        sprintf(spec + n, "ll%c", *format);
+        printf(spec, (unsigned long long)printf_number(printf_arg(args)));
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        sprintf(spec + n, "%c", *format);
+        printf(spec, strtod(printf_arg(args), NULL));
+        break;
+    case 'c':
+        arg = printf_arg(args);
+        strcpy(spec + n, ".1s");
+        printf(spec, arg);
+        break;
+    case 's':
+        strcpy(spec + n, "s");
+        printf(spec, printf_arg(args));
+        break;
+    case 'b':
+        if(put_escaped(printf_arg(args), 1))
+            return NULL;
+        break;
+    default:
+        if(*format == '\0')
+            puts("printf: Error missing format character.");
+        else
+            printf("printf: %c: invalid format character\n", *format);
+        last_status = 1;
+        return NULL;
+    }
+    return format + 1;
+}
+
+/* Synopsis:
+ * void printf_builtin()
+ *
+ * Description:
+ * The function implements the printf builtin. The format is
+ * written with its escapes expanded and its conversions filled
+ * in from the arguments, and is used again while arguments are
+ * left over.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void printf_builtin(){
+    char **args = &cmdStr[2], **start;
+    const char *format;
+
+    do{
+        start = args;
+        for(format = cmdStr[1]; *format != '\0'; ){
+            if(*format == '\\' && format[1] != '\0')
+                format = put_escape(format, 0);
+            else if(*format == '%' && format[1] == '%'){
+                putchar('%');
+                format += 2;
+            }
+            else if(*format == '%')
+                format = printf_conversion(format, &args);
+            else
+                putchar(*format++);
+            if(format == NULL)
+                return;
+        }
+    } while(*args != NULL && args != start);
+}
+
+/* Synopsis:
+ * int valid_name(const char *name, size_t len)
+ *
+ * Description:
+ * The function checks whether the first len characters of name
+ * make a valid environment variable name.
+ *
+ * Returns:
+ * 1 if the name is valid.
+ * 0 otherwise.
+ */
+int valid_name(const char *name, size_t len){
+    size_t i;
+
+    if(len == 0 || isdigit((unsigned char)name[0]))
+        return 0;
+    for(i = 0; i < len; i++)
+        if(!isalnum((unsigned char)name[i]) && name[i] != '_')
+            return 0;
+    return 1;
+}
+
+/* Synopsis:
+ * void export()
+ *
+ * Description:
+ * The function implements the export builtin. 'export NAME=value'
+ * sets an environment variable for the commands the shell runs,
+ * 'export' on its own lists them. 'export NAME' moves shell variable
+ * NAME, if it is set, into the environment.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void export(){
+    char *equals;
+    size_t len;
+    int i, index;
+
+    if(cmdStr[1] == NULL){
+        for(i = 0; environ[i] != NULL; i++)
+            printf("export %s\n", environ[i]);
+        return;
+    }
+
+    for(i = 1; cmdStr[i] != NULL; i++){
+        equals = strchr(cmdStr[i], '=');
+        len = equals != NULL ? (size_t)(equals - cmdStr[i]) : strlen(cmdStr[i]);
+        if(!valid_name(cmdStr[i], len)){
+            printf("export: %s: not a valid identifier\n", cmdStr[i]);
+            last_status = 1;
+            continue;
+        }
+        if(equals == NULL){
+            /* Hand a shell variable over to the environment. */
+            if((index = find_var(cmdStr[i], len, 0)) >= 0 && vars[index].value != NULL){
+                setenv(cmdStr[i], vars[index].value, 1);
+                drop_var(cmdStr[i]);
+            }
+            continue;
+        }
+        *equals = '\0';
+        drop_var(cmdStr[i]);
+        if(setenv(cmdStr[i], equals + 1, 1) < 0){
+            perror("Error");
+            last_status = 1;
+        }
+        else if(strcmp(cmdStr[i], "PATH") == 0)
+            hash_clear(); /* Cached lookups belong to the old PATH. */
+        *equals = '=';
+    }
+    env_changed();
+}
+
+/* Synopsis:
+ * void unset()
+ *
+ * Description:
+ * The function implements the unset builtin, which removes
+ * shell and environment variables.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void unset(){
+    int i;
+
+    for(i = 1; cmdStr[i] != NULL; i++){
+        if(!valid_name(cmdStr[i], strlen(cmdStr[i]))){
+            printf("unset: %s: not a valid identifier\n", cmdStr[i]);
+            last_status = 1;
+            continue;
+        }
+        drop_var(cmdStr[i]);
+        unsetenv(cmdStr[i]);
+        if(strcmp(cmdStr[i], "PATH") == 0)
+            hash_clear();
+    }
+    env_changed();
+}
+
+/* Synopsis:
+ * void type()
+ *
+ * Description:
+ * The function implements the type builtin, which tells how
+ * each name would be run: as an alias, a builtin or the file
+ * found in the lookup cache or PATH. It does not add to the cache.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void type(){
+    HashEntry *entry;
+    char *path;
+    size_t len;
+    int i, index;
+
+    for(i = 1; cmdStr[i] != NULL; i++){
+        if((index = alias_check(cmdStr[i])) >= 0){
+            path = alias_table[index].alias_cmd;
+            for(len = strlen(path); len > 0 && path[len - 1] == ' '; len--) /* Stored with a space after each word. */
+                ;
+            printf("%s is aliased to `%.*s'\n", cmdStr[i], (int)len, path);
+        }
+        else if(find_builtin(cmdStr[i]) != NULL)
+            printf("%s is a shell builtin\n", cmdStr[i]);
+        else if(strchr(cmdStr[i], '/') != NULL && access(cmdStr[i], X_OK) == 0)
+            printf("%s is %s\n", cmdStr[i], cmdStr[i]);
+        else if(strchr(cmdStr[i], '/') == NULL && (entry = hash_find(cmdStr[i])) != NULL)
+            printf("%s is hashed (%s)\n", cmdStr[i], entry->path);
+        else if(strchr(cmdStr[i], '/') == NULL && (path = search_path(cmdStr[i])) != NULL){
+            printf("%s is %s\n", cmdStr[i], path);
+            free(path);
+        }
+        else{
+            printf("type: %s: not found\n", cmdStr[i]);
+            last_status = 1;
+        }
+    }
+}
+
+/* File Builtins */
+
+/* Synopsis:
+ * int write_all(int fd, const char *buf, size_t len)
+ *
+ * Description:
+ * The function writes all of buf to fd, carrying on after short
+ * writes and interrupted calls.
+ *
+ * Returns:
+ * 0 once everything is written.
+ * -1 with errno set if writing failed.
+ */
+int write_all(int fd, const char *buf, size_t len){
+    ssize_t n;
+
+    while(len > 0){
+        if((n = write(fd, buf, len)) < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Synopsis:
+ * int copy_fd(int in, int out, off_t limit)
+ *
+ * Description:
+ * The function copies limit bytes, or everything left to read when
+ * limit is negative, from in to out without
+ * the data passing through the shell where the descriptors allow it:
+ * - copy_file_range() between regular files, which lets the filesystem
+ *   share extents or copy on the server;
+ * - sendfile() from a regular file to any other output;
+ * - splice() when either end is a pipe.
+ * Each is tried in turn until the kernel accepts one for this pair,
+ * read() and write() through a COPY_CHUNK buffer are the last resort.
+ * An empty looking regular file, as those under /proc are, is read
+ * with read() as its size can't be trusted.
+ *
+ * Returns:
+ * 0 once the end of in is reached.
+ * -1 with errno set if reading or writing failed.
+ */
+int copy_fd(int in, int out, off_t limit){
+    static char *buffer;
+    struct stat in_st, out_st;
+    int method, piped;
+    off_t total = 0;
+    size_t chunk;
+    ssize_t n;
+
+    if(fstat(in, &in_st) < 0 || fstat(out, &out_st) < 0)
+        return -1;
+    piped = S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode);
+    /* 0 copy_file_range, 1 sendfile, 2 splice, 3 read and write */
+    if(S_ISREG(in_st.st_mode) && in_st.st_size > 0)
+        method = S_ISREG(out_st.st_mode) ? 0 : 1;
+    else
+        method = piped && !S_ISREG(in_st.st_mode) ? 2 : 3;
+
+    while(1){
+        chunk = limit >= 0 && limit - total < COPY_CHUNK ? (size_t)(limit - total) : COPY_CHUNK;
+        if(chunk == 0)
+            return 0;
+        if(method == 0)
+            n = copy_file_range(in, NULL, out, NULL, chunk, 0);
+        else if(method == 1)
+            n = sendfile(out, in, NULL, chunk);
+        else if(method == 2)
+            n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else{
+            if(buffer == NULL && (buffer = malloc(COPY_CHUNK)) == NULL)
+                return -1;
+            if((n = read(in, buffer, chunk)) > 0 && write_all(out, buffer, n) < 0)
+                return -1;
+        }
+
+        if(n > 0)
+            total += n;
+        else if(n == 0)
+            return 0;
+        else if(errno == EINTR)
+            continue;
+        else if(method < 3 && total == 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+                errno == EOPNOTSUPP || errno == EBADF)) /* Not for these descriptors, try the next way. */
+            method = method == 1 && !piped ? 3 : method + 1;
+        else
+            return -1;
+    }
+}
+
+/* Synopsis:
+ * void cat()
+ *
+ * Description:
+ * The function implements the cat builtin, which writes each
+ * file named, or stdin for '-' or when none is named, to stdout
+ * with copy_fd(). A file which is also stdout is refused, as
+ * copying it onto itself would truncate it or never end.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void cat(){
+    static char *standard_input[] = {"-", NULL};
+    struct stat in_st, out_st;
+    char **files = cmdStr[1] != NULL ? &cmdStr[1] : standard_input;
+    int fd, i;
+
+    fflush(stdout);
+    if(fstat(STDOUT_FILENO, &out_st) < 0)
+        out_st.st_mode = 0;
+    for(i = 0; files[i] != NULL; i++){
+        if(strcmp(files[i], "-") == 0)
+            fd = STDIN_FILENO;
+        else if((fd = open(files[i], O_RDONLY | O_CLOEXEC)) < 0){
+            fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+            last_status = 1;
+            continue;
+        }
+
+        if(S_ISREG(out_st.st_mode) && fstat(fd, &in_st) == 0 &&
+           in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino){
+            fprintf(stderr, "cat: %s: input file is output file\n", files[i]);
+            last_status = 1;
+        }
+        else if(copy_fd(fd, STDOUT_FILENO, -1) < 0){
+            fprintf(stderr, "cat: %s: %s\n", files[i], strerror(errno));
+            last_status = 1;
+        }
+        if(fd != STDIN_FILENO)
+            close(fd);
+    }
+}
+
+/* Synopsis:
+ * int copy_file(const char *from, const char *to)
+ *
+ * Description:
+ * The function copies file from to file to with copy_fd(). to is
+ * truncated if it exists, or created with the permissions of from.
+ * Errors are reported to the user.
+ *
+ * Returns:
+ * 0 if the file was copied.
+ * -1 otherwise.
+ */
+int copy_file(const char *from, const char *to){
+    struct stat from_st, to_st;
+    int in, out, result = 0;
+
+    if((in = open(from, O_RDONLY | O_CLOEXEC)) < 0 || fstat(in, &from_st) < 0){
+        fprintf(stderr, "cp: %s: %s\n", from, strerror(errno));
+        if(in >= 0)
+            close(in);
+        return -1;
+    }
+    if(S_ISDIR(from_st.st_mode)){
+        fprintf(stderr, "cp: %s: Is a directory, not copied\n", from);
+        close(in);
+        return -1;
+    }
+    if(stat(to, &to_st) == 0 && to_st.st_dev == from_st.st_dev && to_st.st_ino == from_st.st_ino){
+        fprintf(stderr, "cp: %s and %s are the same file\n", from, to);
+        close(in);
+        return -1;
+    }
+
+    if((out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, from_st.st_mode & 07777)) < 0){
+        fprintf(stderr, "cp: %s: %s\n", to, strerror(errno));
+        close(in);
+        return -1;
+    }
+    if(copy_fd(in, out, -1) < 0 || close(out) < 0){
+        fprintf(stderr, "cp: %s: %s\n", to, strerror(errno));
+        result = -1;
+    }
+    close(in);
+    return result;
+}
+
+/* Synopsis:
+ * void cp()
+ *
+ * Description:
+ * The function implements the cp builtin.
+ * 'cp <source> <dest>' copies a file.
+ * 'cp <source>... <directory>' copies each file into directory
+ * under its own name.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void cp(){
+    struct stat st;
+    char *target, *path;
+    int last, into_dir, i;
+
+    for(last = 2; cmdStr[last + 1] != NULL; last++)
+        ;
+    target = cmdStr[last];
+    into_dir = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+    if(!into_dir && last > 2){
+        fprintf(stderr, "cp: %s: Not a directory\n", target);
+        last_status = 1;
+        return;
+    }
+
+    for(i = 1; i < last; i++){
+        path = target;
+        if(into_dir){
+            path = arena_alloc(&line_arena, strlen(target) + strlen(cmdStr[i]) + 2);
+            sprintf(path, "%s/%s", target, basename(cmdStr[i]));
+        }
+        if(copy_file(cmdStr[i], path) < 0)
+            last_status = 1;
+    }
+}
+
+/* Output Memoisation */
+
+/* Synopsis:
+ * char *memo_dir()
+ *
+ * Description:
+ * The function finds the memo cache directory in HOME and
+ * creates it if it does not exist yet.
+ *
+ * Returns:
+ * Path of the directory, valid until the next line is read.
+ * NULL if there is no HOME or the directory can't be made.
+ */
+char *memo_dir(){
+    const char *home = getenv("HOME");
+    char *dir;
+
+    if(home == NULL)
+        return NULL;
+    dir = arena_alloc(&line_arena, strlen(home) + strlen(MEMO_DIR) + 2);
+    sprintf(dir, "%s/%s", home, MEMO_DIR);
+    if(mkdir(dir, 0700) < 0 && errno != EEXIST)
+        return NULL;
+    return dir;
+}
+
+/* Synopsis:
+ * void memo_fingerprint(FILE *key, const char *path)
+ *
+ * Description:
+ * The function adds path and its device, inode, size and
+ * modification time to key, or '-' if it does not exist, so
+ * changing, replacing or creating the file changes the key.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void memo_fingerprint(FILE *key, const char *path){
+    struct stat st;
+
+    fprintf(key, "%s%c", path, 0);
+    if(stat(path, &st) < 0)
+        fprintf(key, "-%c", 0);
+    else
+        fprintf(key, "%llu:%llu:%lld:%lld.%09ld%c", (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+                (long long)st.st_size, (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, 0);
+}
+
+/* Synopsis:
+ * uint64_t memo_hash(const char *data, size_t len)
+ *
+ * Description:
+ * The function hashes len bytes of data with 64 bit FNV-1a.
+ *
+ * Returns:
+ * The hash.
+ */
+uint64_t memo_hash(const char *data, size_t len){
+    uint64_t hash = 14695981039346656037ULL;
+
+    while(len-- > 0){
+        hash ^= (unsigned char)*data++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Synopsis:
+ * int memo_replay(const char *path, const char *key, size_t key_len)
+ *
+ * Description:
+ * The function looks for the result of a command in cache entry
+ * path. If the entry holds the same key its stdout and stderr are
+ * copied out, its exit status becomes the last status and its
+ * modification time is set to now, marking it as recently used.
+ *
+ * Returns:
+ * 1 if the result was replayed.
+ * 0 if the entry is missing or belongs to another key.
+ */
+int memo_replay(const char *path, const char *key, size_t key_len){
+    MemoHeader header;
+    char *stored;
+    int fd, hit = 0;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return 0;
+    if(read(fd, &header, sizeof(header)) == sizeof(header) &&
+       memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) == 0 && header.key_len == key_len){
+        stored = malloc(key_len);
+        hit = read(fd, stored, key_len) == (ssize_t)key_len && memcmp(stored, key, key_len) == 0;
+        free(stored);
+    }
+    if(hit){
+        futimens(fd, NULL);
+        fflush(stdout);
+        fflush(stderr);
+        copy_fd(fd, STDOUT_FILENO, header.out_len);
+        copy_fd(fd, STDERR_FILENO, header.err_len);
+        last_status = header.status;
+    }
+    close(fd);
+    return hit;
+}
+
+/* Synopsis:
+ * void memo_store(const char *path, const char *key, size_t key_len, int out, int err)
+ *
+ * Description:
+ * The function saves the key, the output captured in out and err
+ * and the last status as cache entry path. The entry is written to
+ * a temporary file and renamed into place, so other shells never
+ * see half an entry.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void memo_store(const char *path, const char *key, size_t key_len, int out, int err){
+    MemoHeader header;
+    char *tmp = arena_alloc(&line_arena, strlen(path) + 8);
+    int fd;
+
+    sprintf(tmp, "%s.XXXXXX", path);
+    if((fd = mkostemp(tmp, O_CLOEXEC)) < 0)
+        return;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+    header.key_len = key_len;
+    header.out_len = lseek(out, 0, SEEK_END);
+    header.err_len = lseek(err, 0, SEEK_END);
+    header.status = last_status;
+    lseek(out, 0, SEEK_SET);
+    lseek(err, 0, SEEK_SET);
+
+    if(write_all(fd, (char *)&header, sizeof(header)) < 0 || write_all(fd, key, key_len) < 0 ||
+       copy_fd(out, fd, -1) < 0 || copy_fd(err, fd, -1) < 0 || close(fd) < 0 || rename(tmp, path) < 0){
+        fprintf(stderr, "memo: %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+/* Synopsis:
+ * void memo_visit(int dir_fd, DirEntry *entry, void *arg)
+ *
+ * Description:
+ * The function is the scan_dir() visitor listing the memo cache into
+ * the MemoScan arg. Temporary files being written are left out.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void memo_visit(int dir_fd, DirEntry *entry, void *arg){
+    MemoScan *scan = arg;
+    struct stat st;
+
+    if(strchr(entry->d_name, '.') != NULL || fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+       !S_ISREG(st.st_mode))
+        return;
+    if(scan->count == scan->cap){
+        scan->cap = scan->cap ? scan->cap * 2 : 64;
+        scan->entries = realloc(scan->entries, scan->cap * sizeof(MemoEntry));
+    }
+    scan->entries[scan->count].name = arena_strdup(&line_arena, entry->d_name);
+    scan->entries[scan->count].size = st.st_size;
+    scan->entries[scan->count].used = st.st_mtim;
+    scan->count++;
+    scan->total += st.st_size;
+}
+
+/* Synopsis:
+ * int compare_memo(const void *a, const void *b)
+ *
+ * Description:
+ * The function orders memo cache entries from least to most
+ * recently used for qsort().
+ *
+ * Returns:
+ * Negative, zero or positive as a was used before, with or after b.
+ */
+int compare_memo(const void *a, const void *b){
+    const struct timespec *x = &((const MemoEntry *)a)->used, *y = &((const MemoEntry *)b)->used;
+
+    if(x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* Synopsis:
+ * void memo_trim(const char *dir, long long limit)
+ *
+ * Description:
+ * The function removes the least recently used entries from the
+ * memo cache in dir until it holds no more than limit bytes.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void memo_trim(const char *dir, long long limit){
+    MemoScan scan;
+    char *path;
+    int i;
+
+    memset(&scan, 0, sizeof(scan));
+    scan_dir(dir, memo_visit, &scan);
+    if(scan.total > limit){
+        qsort(scan.entries, scan.count, sizeof(MemoEntry), compare_memo);
+        for(i = 0; i < scan.count && scan.total > limit; i++){
+            path = arena_alloc(&line_arena, strlen(dir) + strlen(scan.entries[i].name) + 2);
+            sprintf(path, "%s/%s", dir, scan.entries[i].name);
+            if(unlink(path) == 0)
+                scan.total -= scan.entries[i].size;
+        }
+    }
+    free(scan.entries);
+}
+
+/* Synopsis:
+ * long long memo_limit()
+ *
+ * Description:
+ * The function reads the size the memo cache is kept under from
+ * MEMOSIZE, in bytes.
+ *
+ * Returns:
+ * The limit, MEMO_DEFAULT_SIZE if MEMOSIZE is not set or not a number.
+ */
+long long memo_limit(){
+    const char *size = getenv("MEMOSIZE");
+    char *end;
+    long long limit;
+
+    if(size == NULL || (limit = strtoll(size, &end, 10)) < 0 || end == size || *end != '\0')
+        return MEMO_DEFAULT_SIZE;
+    return limit;
+}
+
+/* Synopsis:
+ * void memo()
+ *
+ * Description:
+ * The function implements the memo builtin.
+ * 'memo' prints the size of the cache and this session's hits and misses.
+ * 'memo -c' empties the cache.
+ * 'memo [-f file]... [-e name]... [--] command [args...]' runs an external
+ * command through createProcess() with its stdout and stderr captured,
+ * writes them out and saves them with the exit status. Later runs with
+ * the same key replay the saved result instead. The key is made of the
+ * arguments, the working directory, PATH, each variable named with -e
+ * and fingerprints of the command's executable and each file named
+ * with -f. Results of commands which could not be started, were killed
+ * or were stopped are not saved.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void memo(){
+    char *dir = memo_dir(), *path, *key = NULL, cwd[PATH_MAX];
+    const char *exe, *value;
+    int first, i, out, err, saved_out, saved_err, jobs;
+    size_t key_len = 0;
+    MemoScan scan;
+    FILE *stream;
+
+    if(dir == NULL){
+        puts("MEMO: Error no cache directory in HOME.");
+        last_status = 1;
+        return;
+    }
+    if(cmdStr[1] == NULL){
+        memset(&scan, 0, sizeof(scan));
+        scan_dir(dir, memo_visit, &scan);
+        printf("%s: %d entries, %lld of %lld bytes, %d hits and %d misses this session\n",
+               dir, scan.count, (long long)scan.total, memo_limit(), memo_hits, memo_misses);
+        free(scan.entries);
+        return;
+    }
+    if(strcmp(cmdStr[1], "-c") == 0 && cmdStr[2] == NULL){
+        memo_trim(dir, 0);
+        return;
+    }
+
+    for(first = 1; cmdStr[first] != NULL && cmdStr[first][0] == '-'; first += 2){
+        if(strcmp(cmdStr[first], "--") == 0){
+            first++;
+            break;
+        }
+        if((strcmp(cmdStr[first], "-f") != 0 && strcmp(cmdStr[first], "-e") != 0) || cmdStr[first + 1] == NULL){
+            printf("MEMO: Error bad option %s.\n", cmdStr[first]);
+            last_status = 2;
+            return;
+        }
+    }
+    if(cmdStr[first] == NULL || find_builtin(cmdStr[first]) != NULL || cmdStr[first][0] == '!'){
+        puts("MEMO: Error an external command is needed.");
+        last_status = 2;
+        return;
+    }
+
+    /* Build the key, every part NUL terminated. */
+    stream = open_memstream(&key, &key_len);
+    for(i = first; cmdStr[i] != NULL; i++)
+        fprintf(stream, "%s%c", cmdStr[i], 0);
+    fprintf(stream, "%c%s%c", 1, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "", 0);
+    value = getenv("PATH");
+    fprintf(stream, "PATH=%s%c", value != NULL ? value : "", 0);
+    for(i = 1; i < first && strcmp(cmdStr[i], "--") != 0; i += 2){
+        if(strcmp(cmdStr[i], "-e") == 0 && (value = getenv(cmdStr[i + 1])) != NULL)
+            fprintf(stream, "%s=%s%c", cmdStr[i + 1], value, 0);
+        else if(strcmp(cmdStr[i], "-e") == 0)
+            fprintf(stream, "%s%c", cmdStr[i + 1], 0);
+        else
+            memo_fingerprint(stream, cmdStr[i + 1]);
+    }
+    if((exe = find_command(cmdStr[first])) != NULL)
+        memo_fingerprint(stream, exe);
+    fclose(stream);
+
+    path = arena_alloc(&line_arena, strlen(dir) + 18);
+    sprintf(path, "%s/%016llx", dir, (unsigned long long)memo_hash(key, key_len));
+    if(memo_replay(path, key, key_len)){
+        memo_hits++;
+        free(key);
+        return;
+    }
+    memo_misses++;
+
+    /* Run the command with its output going to memory files. */
+    out = memfd_create("memo-stdout", MFD_CLOEXEC);
+    err = memfd_create("memo-stderr", MFD_CLOEXEC);
+    if(out < 0 || err < 0){
+        perror("Error");
+        last_status = 1;
+        free(key);
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+
+    for(i = 0; cmdStr[first + i] != NULL; i++)
+        cmdStr[i] = cmdStr[first + i];
+    cmdStr[i] = NULL;
+    cmd_len = i;
+    exec_last = 0; /* The output is written out after the command. */
+    jobs = job_count;
+    createProcess();
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    lseek(out, 0, SEEK_SET);
+    lseek(err, 0, SEEK_SET);
+    copy_fd(out, STDOUT_FILENO, -1);
+    copy_fd(err, STDERR_FILENO, -1);
+    if(exe != NULL && job_count == jobs && last_status < 128){
+        memo_store(path, key, key_len, out, err);
+        memo_trim(dir, memo_limit());
+    }
+    close(out);
+    close(err);
+    free(key);
+}
+
+/* Shell Variables */
+
+/* Synopsis:
+ * int find_var(const char *name, size_t len, int create)
+ *
+ * Description:
+ * The function looks up the shell variable named by the first len
+ * characters of name in var_index[], an open addressing hash table
+ * probed linearly. If create is set a missing variable is added,
+ * unset, growing the table as needed. A variable keeps its position
+ * in vars[] for good, so compiled scripts refer to it by position.
+ *
+ * Returns:
+ * Position of the variable in vars[].
+ * -1 if it does not exist and create is not set.
+ */
+int find_var(const char *name, size_t len, int create){
+    unsigned int slot;
+    int index, i;
+
+    if(var_slots > 0){
+        slot = (unsigned int)memo_hash(name, len) & (var_slots - 1);
+        while((index = var_index[slot]) != 0){
+            if(strncmp(vars[index - 1].name, name, len) == 0 && vars[index - 1].name[len] == '\0')
+                return index - 1;
+            slot = (slot + 1) & (var_slots - 1);
+        }
+    }
+    if(!create)
+        return -1;
+
+    if((var_count + 1) * 100 > var_slots * ALIAS_LOAD_PERCENT){
+        free(var_index);
+        var_slots = var_slots ? var_slots * 2 : 64;
+        var_index = calloc(var_slots, sizeof(int));
+        for(i = 0; i < var_count; i++){
+            slot = (unsigned int)memo_hash(vars[i].name, strlen(vars[i].name)) & (var_slots - 1);
+            while(var_index[slot] != 0)
+                slot = (slot + 1) & (var_slots - 1);
+            var_index[slot] = i + 1;
+        }
+        return find_var(name, len, create);
+    }
+
+    if(var_count == var_cap){
+        var_cap = var_cap ? var_cap * 2 : 64;
+        vars = realloc(vars, var_cap * sizeof(Var));
+    }
+    vars[var_count].name = strndup(name, len);
+    vars[var_count].value = NULL;
+    var_index[slot] = ++var_count;
+    return var_count - 1;
+}
+
+/* Synopsis:
+ * const char *var_value(int index)
+ *
+ * Description:
+ * The function gives the value of shell variable index, or of the
+ * environment variable of the same name when it is not set in the
+ * shell. VAR_STATUS gives the exit status of the last command.
+ *
+ * Returns:
+ * The value, empty if the variable is set nowhere. It is valid
+ * until the variable is next changed.
+ */
+const char *var_value(int index){
+    static char status[16];
+    const char *value;
+
+    if(index == VAR_STATUS){
+        snprintf(status, sizeof(status), "%d", last_status);
+        return status;
+    }
+    if(vars[index].value != NULL)
+        return vars[index].value;
+    value = getenv(vars[index].name);
+    return value != NULL ? value : "";
+}
+
+/* Synopsis:
+ * void set_var(int index, const char *value)
+ *
+ * Description:
+ * The function sets shell variable index to value. A variable which
+ * is in the environment is changed there, as export would, so the
+ * commands started afterwards see the new value.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void set_var(int index, const char *value){
+    Var *var = &vars[index];
+
+    if(getenv(var->name) != NULL){
+        setenv(var->name, value, 1);
+        if(strcmp(var->name, "PATH") == 0)
+            hash_clear(); /* Cached lookups belong to the old PATH. */
+        env_changed();
+        return;
+    }
+    free(var->value);
+    var->value = strdup(value);
+}
+
+/* Synopsis:
+ * void drop_var(const char *name)
+ *
+ * Description:
+ * The function unsets shell variable name, if there is one, so
+ * the environment variable of that name shows through.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void drop_var(const char *name){
+    int index = find_var(name, strlen(name), 0);
+
+    if(index >= 0){
+        free(vars[index].value);
+        vars[index].value = NULL;
+    }
+}
+
+/* Synopsis:
+ * int var_reference(const char *text, const char **name, size_t *len)
+ *
+ * Description:
+ * The function reads the variable reference following a '$' at
+ * text, which is $NAME, ${NAME}, $? or ${?}, storing where its name
+ * starts and how long it is.
+ *
+ * Returns:
+ * Number of characters of the reference after the '$'.
+ * 0 if there is none, so the '$' stands for itself.
+ */
+int var_reference(const char *text, const char **name, size_t *len){
+    const char *end;
+    size_t n = 0;
+
+    if(text[0] == '{'){
+        if((end = strchr(text, '}')) == NULL)
+            return 0;
+        *name = text + 1;
+        *len = end - text - 1;
+        if(!(*len == 1 && text[1] == '?') && !valid_name(*name, *len))
+            return 0;
+        return *len + 2;
+    }
+    *name = text;
+    if(text[0] == '?'){
+        *len = 1;
+        return 1;
+    }
+    while(isalnum((unsigned char)text[n]) || text[n] == '_')
+        n++;
+    *len = n;
+    return valid_name(text, n) ? (int)n : 0;
+}
+
+/* Synopsis:
+ * char *expand_vars(char *word)
+ *
+ * Description:
+ * The function puts the values of the variables referred to in
+ * word in their place. The result is one word however many spaces
+ * the values hold.
+ *
+ * Returns:
+ * word itself if it refers to no variables.
+ * Otherwise the expanded word, valid until the line arena is reset.
+ */
+char *expand_vars(char *word){
+    const char *name, *value, *p;
+    char *result = NULL, *out = NULL;
+    size_t len, size = 1;
+    int pass, n;
+
+    if(strchr(word, '$') == NULL)
+        return word;
+
+    /* Measure the result on the first pass and write it on the second. */
+    for(pass = 0; pass < 2; pass++){
+        for(p = word; *p != '\0'; ){
+            if(*p != '$' || (n = var_reference(p + 1, &name, &len)) == 0){
+                if(pass)
+                    *out++ = *p;
+                else
+                    size++;
+                p++;
+                continue;
+            }
+            value = len == 1 && *name == '?' ? var_value(VAR_STATUS) : var_value(find_var(name, len, 1));
+            if(pass)
+                out = stpcpy(out, value);
+            else
+                size += strlen(value);
+            p += n + 1;
+        }
+        if(!pass)
+            out = result = arena_alloc(&line_arena, size);
+    }
+    *out = '\0';
+    return result;
+}
+
+/* Synopsis:
+ * int is_assignment(const char *word)
+ *
+ * Description:
+ * The function checks whether word is of the form NAME=value.
+ *
+ * Returns:
+ * 1 if it is an assignment.
+ * 0 otherwise.
+ */
+int is_assignment(const char *word){
+    const char *equals = strchr(word, '=');
+
+    return equals != NULL && valid_name(word, equals - word);
+}
+
+/* Synopsis:
+ * void assign_vars()
+ *
+ * Description:
+ * The function runs a command line of NAME=value words, setting
+ * each shell variable in turn.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void assign_vars(){
+    char *equals;
+    int i;
+
+    for(i = 0; cmdStr[i] != NULL; i++){
+        if(!is_assignment(cmdStr[i])){
+            printf("Error: %s: assignments must be on a line of their own.\n", cmdStr[i]);
+            last_status = 1;
+            return;
+        }
+    }
+    for(i = 0; cmdStr[i] != NULL; i++){
+        equals = strchr(cmdStr[i], '=');
+        set_var(find_var(cmdStr[i], equals - cmdStr[i], 1), equals + 1);
+    }
+    last_status = 0;
+}
+
+/* Script Engine */
+
+/* Synopsis:
+ * int script_keyword(const char *word)
+ *
+ * Description:
+ * The function checks whether the first word of word, which may
+ * be a whole line, is a keyword of the script language.
+ *
+ * Returns:
+ * The KW_* of the keyword.
+ * -1 if it is not a keyword.
+ */
+int script_keyword(const char *word){
+    size_t len;
+    int i;
+
+    word += strspn(word, DELIMS);
+    len = strcspn(word, DELIMS OPERATORS "#");
+    for(i = 0; i < (int)SIZE(script_keywords); i++)
+        if(strlen(script_keywords[i]) == len && strncmp(script_keywords[i], word, len) == 0)
+            return i;
+    return -1;
+}
+
+/* Synopsis:
+ * int emit(Compiler *c, int op)
+ *
+ * Description:
+ * The function appends an instruction doing op to the script
+ * being compiled, with its other fields cleared.
+ *
+ * Returns:
+ * Position of the instruction.
+ */
+int emit(Compiler *c, int op){
+    Script *script = c->script;
+    Instr *instr;
+
+    if(script->code_len == script->code_cap){
+        script->code_cap = script->code_cap ? script->code_cap * 2 : 16;
+        script->code = realloc(script->code, script->code_cap * sizeof(Instr));
+    }
+    instr = &script->code[script->code_len];
+    memset(instr, 0, sizeof(Instr));
+    instr->op = op;
+    instr->target = -1;
+    return script->code_len++;
+}
+
+/* Synopsis:
+ * void patch(Compiler *c, int jump, int target)
+ *
+ * Description:
+ * The function points the chain of jumps starting at jump, linked
+ * through their targets, at target.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void patch(Compiler *c, int jump, int target){
+    int next;
+
+    for(; jump >= 0; jump = next){
+        next = c->script->code[jump].target;
+        c->script->code[jump].target = target;
+    }
+}
+
+/* Synopsis:
+ * void compile_error(Compiler *c, const char *message)
+ *
+ * Description:
+ * The function reports an error in the current line, unless one
+ * has already been reported, and marks the compile as failed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_error(Compiler *c, const char *message){
+    if(!c->error)
+        printf("SCRIPT: Error line %d: %s\n", c->line, message);
+    c->error = 1;
+}
+
+/* Synopsis:
+ * int add_word(Compiler *c, char *text)
+ *
+ * Description:
+ * The function adds word text to the script being compiled. Its
+ * variable references are looked up now and kept as parts, so
+ * running the script only has to put their values in.
+ *
+ * Returns:
+ * Position of the word.
+ */
+int add_word(Compiler *c, char *text){
+    Script *script = c->script;
+    const char *name;
+    char *p, *literal;
+    size_t len;
+    Word *word;
+    Part *part;
+    int n;
+
+    if(script->word_len == script->word_cap){
+        script->word_cap = script->word_cap ? script->word_cap * 2 : 32;
+        script->words = realloc(script->words, script->word_cap * sizeof(Word));
+    }
+    word = &script->words[script->word_len];
+    word->text = text;
+    word->part = script->part_len;
+    word->parts = 0;
+    word->glob = has_glob(text);
+    if(strchr(text, '$') == NULL)
+        return script->word_len++;
+
+    for(p = literal = text; ; p++){
+        n = 0;
+        if(*p != '\0' && (*p != '$' || (n = var_reference(p + 1, &name, &len)) == 0))
+            continue;
+        /* Text up to here, then the variable if there is one. */
+        if(script->part_len + 2 > script->part_cap){
+            script->part_cap = script->part_cap ? script->part_cap * 2 : 32;
+            script->parts = realloc(script->parts, script->part_cap * sizeof(Part));
+        }
+        if(p > literal){
+            part = &script->parts[script->part_len++];
+            part->text = literal;
+            part->len = p - literal;
+            part->var = -2;
+        }
+        if(n == 0)
+            break;
+        part = &script->parts[script->part_len++];
+        part->text = NULL;
+        part->len = 0;
+        part->var = len == 1 && *name == '?' ? VAR_STATUS : find_var(name, len, 1);
+        p += n;
+        literal = p + 1;
+    }
+    word->parts = script->part_len - word->part;
+    return script->word_len++;
+}
+
+/* Synopsis:
+ * char *compile_heredoc(Compiler *c, const char *delim)
+ *
+ * Description:
+ * The function takes the lines of the script after the current one,
+ * up to the line holding only delim, as a here-document. The body is
+ * left in place in the script's text, which is terminated where the
+ * delimiter line starts, and compiling carries on after that line.
+ * Without a delimiter line the body runs to the end of the script.
+ *
+ * Returns:
+ * The body, each of its lines ending with a newline.
+ */
+char *compile_heredoc(Compiler *c, const char *delim){
+    char *body = c->next, *line, *end;
+    size_t len = strlen(delim);
+
+    while(*c->next != '\0'){
+        line = c->next;
+        end = strchrnul(line, '\n');
+        c->next = *end != '\0' ? end + 1 : end;
+        c->line++;
+        if((size_t)(end - line) == len && strncmp(line, delim, len) == 0){
+            *line = '\0';
+            break;
+        }
+    }
+    return body;
+}
+
+/* Synopsis:
+ * int compile_line(Compiler *c)
+ *
+ * Description:
+ * The function splits the next line of the script which holds
+ * any words into c->tokens, in the same way as tokenise() does,
+ * and sets c->keyword to its keyword. The word after '<<' is
+ * replaced by the here-document it ends.
+ *
+ * Returns:
+ * 1 if a line was read.
+ * 0 at the end of the script.
+ */
+int compile_line(Compiler *c){
+    Scanner scan;
+    char *line, *token;
+    int i;
+
+    while(*c->next != '\0'){
+        line = c->next;
+        c->next = strchrnul(line, '\n');
+        if(*c->next != '\0')
+            *c->next++ = '\0';
+        c->line++;
+
+        c->token_len = 0;
+        scan_init(&scan, line);
+        while((token = scan_token(&scan)) != NULL){
+            if(c->token_len + 1 >= c->token_cap){
+                c->token_cap = c->token_cap ? c->token_cap * 2 : 32;
+                c->tokens = realloc(c->tokens, c->token_cap * sizeof(char *));
+            }
+            c->tokens[c->token_len++] = token;
+        }
+        if(c->token_len > 0){
+            c->tokens[c->token_len] = NULL;
+            c->keyword = script_keyword(c->tokens[0]);
+            for(i = 1; i < c->token_len; i++){
+                if(strcmp(c->tokens[i - 1], "<<") != 0)
+                    continue;
+                if(heredoc_quoted(c->tokens[i]))
+                    c->tokens[i - 1] = HEREDOC_LITERAL;
+                c->tokens[i] = compile_heredoc(c, c->tokens[i]);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Synopsis:
+ * void compile_command(Compiler *c, int from, int condition)
+ *
+ * Description:
+ * The function compiles the words of the current line from from
+ * on as a command. A leading '!' word negates its status. Unless
+ * it is the condition of an if, while or until, a line of NAME=value
+ * words compiles to assignments instead.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_command(Compiler *c, int from, int condition){
+    char *equals;
+    Word *word;
+    int at, negate = 0, i;
+
+    if(!condition){
+        for(i = from; i < c->token_len && is_assignment(c->tokens[i]); i++)
+            ;
+        if(i == c->token_len){
+            for(i = from; i < c->token_len; i++){
+                equals = strchr(c->tokens[i], '=');
+                at = emit(c, OP_ASSIGN);
+                c->script->code[at].var = find_var(c->tokens[i], equals - c->tokens[i], 1);
+                c->script->code[at].word = add_word(c, equals + 1);
+            }
+            return;
+        }
+    }
+
+    if(from < c->token_len && strcmp(c->tokens[from], "!") == 0){
+        negate = 1;
+        from++;
+    }
+    if(from == c->token_len){
+        compile_error(c, "missing command");
+        return;
+    }
+    at = emit(c, OP_RUN);
+    c->script->code[at].negate = negate;
+    c->script->code[at].word = c->script->word_len;
+    c->script->code[at].words = c->token_len - from;
+    for(i = from; i < c->token_len; i++){
+        word = &c->script->words[add_word(c, c->tokens[i])];
+        if(i > from && strcmp(c->tokens[i - 1], HEREDOC_LITERAL) == 0){ /* Its variables are left as written. */
+            c->script->part_len = word->part;
+            word->parts = 0;
+        }
+    }
+}
+
+/* Synopsis:
+ * void compile_alone(Compiler *c)
+ *
+ * Description:
+ * The function checks that the keyword of the current line, such
+ * as fi or done, has the line to itself.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_alone(Compiler *c){
+    if(c->token_len > 1)
+        compile_error(c, "unexpected words after keyword");
+}
+
+/* Synopsis:
+ * void compile_keyword_line(Compiler *c)
+ *
+ * Description:
+ * The function rejects the one-line forms 'if command; then' and
+ * 'for NAME in words; do'. ';' does not end a command here, so a word
+ * ending with it, or a then or do word after the keyword, would
+ * otherwise be taken as part of the command or list.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_keyword_line(Compiler *c){
+    size_t len;
+    int i;
+
+    for(i = 1; i < c->token_len; i++){
+        len = strlen(c->tokens[i]);
+        if(c->tokens[i][len - 1] == ';' || strcmp(c->tokens[i], "then") == 0 || strcmp(c->tokens[i], "do") == 0){
+            compile_error(c, "';' does not end a command, put 'then' or 'do' on a line of its own");
+            return;
+        }
+    }
+}
+
+int compile_block(Compiler *c, int stops);
+
+/* Synopsis:
+ * void compile_if(Compiler *c)
+ *
+ * Description:
+ * The function compiles an if statement, from its if line up to
+ * and including fi. Each condition which fails jumps to the next
+ * elif, else or the end, and each branch taken jumps past the rest.
+ * With no else a failed last condition leaves a status of 0.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_if(Compiler *c){
+    int ends = -1, failed, jump, keyword;
+
+    do{
+        compile_keyword_line(c);
+        compile_command(c, 1, 1);
+        failed = emit(c, OP_JUMP_FALSE);
+        keyword = compile_block(c, 1 << KW_ELIF | 1 << KW_ELSE | 1 << KW_FI);
+        jump = emit(c, OP_JUMP);
+        c->script->code[jump].target = ends;
+        ends = jump;
+        patch(c, failed, c->script->code_len);
+    } while(keyword == KW_ELIF);
+
+    if(keyword == KW_ELSE){
+        if(c->token_len > 1)
+            compile_command(c, 1, 0);
+        keyword = compile_block(c, 1 << KW_FI);
+    }
+    else if(keyword == KW_FI)
+        emit(c, OP_ZERO);
+    if(keyword != KW_FI)
+        compile_error(c, "missing 'fi'");
+    else
+        compile_alone(c);
+    patch(c, ends, c->script->code_len);
+}
+
+/* Synopsis:
+ * void compile_while(Compiler *c, int until)
+ *
+ * Description:
+ * The function compiles a while loop, or an until loop if until is
+ * set, from its first line up to and including done. The loop
+ * leaves a status of 0.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_while(Compiler *c, int until){
+    LoopScope scope;
+    int exit, at;
+
+    scope.top = c->script->code_len;
+    scope.loop = -1;
+    scope.breaks = -1;
+    scope.outer = c->scope;
+
+    compile_keyword_line(c);
+    compile_command(c, 1, 1);
+    exit = emit(c, until ? OP_JUMP_TRUE : OP_JUMP_FALSE);
+    c->scope = &scope;
+    if(compile_block(c, 1 << KW_DONE) != KW_DONE)
+        compile_error(c, "missing 'done'");
+    else
+        compile_alone(c);
+    c->scope = scope.outer;
+
+    at = emit(c, OP_JUMP); /* emit() may move code[], so index it after. */
+    c->script->code[at].target = scope.top;
+    patch(c, exit, c->script->code_len);
+    patch(c, scope.breaks, c->script->code_len);
+    emit(c, OP_ZERO);
+}
+
+/* Synopsis:
+ * void compile_for(Compiler *c)
+ *
+ * Description:
+ * The function compiles 'for NAME in words' up to and including
+ * done. The words are expanded once as the loop starts and NAME
+ * is set to each in turn. The loop leaves the status of the last
+ * command it ran.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_for(Compiler *c){
+    LoopScope scope;
+    int start, at, i;
+
+    if(c->token_len < 3 || !valid_name(c->tokens[1], strlen(c->tokens[1])) || strcmp(c->tokens[2], "in") != 0){
+        compile_error(c, "expected 'for NAME in words'");
+        return;
+    }
+    compile_keyword_line(c);
+    scope.loop = c->script->loops++;
+    scope.breaks = -1;
+    scope.outer = c->scope;
+
+    start = emit(c, OP_FOR);
+    c->script->code[start].loop = scope.loop;
+    c->script->code[start].word = c->script->word_len;
+    c->script->code[start].words = c->token_len - 3;
+    for(i = 3; i < c->token_len; i++)
+        add_word(c, c->tokens[i]);
+
+    scope.top = emit(c, OP_NEXT);
+    c->script->code[scope.top].loop = scope.loop;
+    c->script->code[scope.top].var = find_var(c->tokens[1], strlen(c->tokens[1]), 1);
+
+    c->scope = &scope;
+    if(compile_block(c, 1 << KW_DONE) != KW_DONE)
+        compile_error(c, "missing 'done'");
+    else
+        compile_alone(c);
+    c->scope = scope.outer;
+
+    at = emit(c, OP_JUMP);
+    c->script->code[at].target = scope.top;
+    patch(c, scope.breaks, c->script->code_len);
+    c->script->code[scope.top].target = c->script->code_len;
+    at = emit(c, OP_END);
+    c->script->code[at].loop = scope.loop;
+}
+
+/* Synopsis:
+ * void compile_jump(Compiler *c, int keyword)
+ *
+ * Description:
+ * The function compiles 'break [n]' or 'continue [n]', leaving or
+ * going round again the n-th enclosing loop. The for loops left on
+ * the way are ended so their words are freed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void compile_jump(Compiler *c, int keyword){
+    LoopScope *scope = c->scope;
+    int levels = 1, jump, at, i;
+
+    if(c->token_len > 2 || (c->token_len == 2 && (levels = atoi(c->tokens[1])) < 1)){
+        compile_error(c, "expected a loop count");
+        return;
+    }
+    for(i = 1; i < levels && scope != NULL; i++)
+        scope = scope->outer;
+    if(scope == NULL){
+        compile_error(c, keyword == KW_BREAK ? "'break' outside a loop" : "'continue' outside a loop");
+        return;
+    }
+
+    for(scope = c->scope, i = 1; i < levels; i++, scope = scope->outer)
+        if(scope->loop >= 0){
+            at = emit(c, OP_END);
+            c->script->code[at].loop = scope->loop;
+        }
+    jump = emit(c, OP_JUMP);
+    if(keyword == KW_BREAK){
+        c->script->code[jump].target = scope->breaks;
+        scope->breaks = jump;
+    }
+    else
+        c->script->code[jump].target = scope->top;
+}
+
+/* Synopsis:
+ * int compile_block(Compiler *c, int stops)
+ *
+ * Description:
+ * The function compiles lines until one starting with a keyword
+ * whose bit is set in stops, which is left for the caller. 'then'
+ * and 'do' are optional and skipped.
+ *
+ * Returns:
+ * The KW_* of the keyword which stopped the block.
+ * -1 at the end of the script or after an error.
+ */
+int compile_block(Compiler *c, int stops){
+    while(!c->error && compile_line(c)){
+        if(c->keyword >= 0 && (stops & 1 << c->keyword))
+            return c->keyword;
+        switch(c->keyword){
+        case KW_IF:
+            compile_if(c);
+            break;
+        case KW_WHILE:
+        case KW_UNTIL:
+            compile_while(c, c->keyword == KW_UNTIL);
+            break;
+        case KW_FOR:
+            compile_for(c);
+            break;
+        case KW_BREAK:
+        case KW_CONTINUE:
+            compile_jump(c, c->keyword);
+            break;
+        case KW_THEN:
+        case KW_DO:
+            if(c->token_len > 1)
+                compile_command(c, 1, 0);
+            break;
+        case -1:
+            compile_command(c, 0, 0);
+            break;
+        default:
+            compile_error(c, "unexpected keyword");
+        }
+    }
+    return -1;
+}
+
+/* Synopsis:
+ * void free_script(Script *script)
+ *
+ * Description:
+ * The function frees a compiled script.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void free_script(Script *script){
+    free(script->source);
+    free(script->text);
+    free(script->code);
+    free(script->words);
+    free(script->parts);
+    free(script);
+}
+
+/* Synopsis:
+ * Script *compile_script(const char *text, size_t len)
+ *
+ * Description:
+ * The function compiles len bytes of script text into instructions.
+ * A script compiled before is found in script_cache[] by the hash of
+ * its text and used again without being parsed. When the cache holds
+ * SCRIPT_CACHE_MAX scripts those not running are dropped.
+ *
+ * Returns:
+ * The compiled script.
+ * NULL if it has an error, which has been reported.
+ */
+Script *compile_script(const char *text, size_t len){
+    uint64_t hash = memo_hash(text, len);
+    Script **link, *script, *dropped;
+    Compiler c;
+    uint64_t started;
+    int i;
+
+    for(script = script_cache[hash % HASH_SIZE]; script != NULL; script = script->next)
+        if(script->hash == hash && script->len == len && memcmp(script->source, text, len) == 0)
+            return script;
+
+    TRACE_START(started);
+    script = calloc(1, sizeof(Script));
+    script->hash = hash;
+    script->len = len;
+    script->source = malloc(len + 1);
+    memcpy(script->source, text, len);
+    script->source[len] = '\0';
+    script->text = strdup(script->source);
+
+    memset(&c, 0, sizeof(c));
+    c.script = script;
+    c.next = script->text;
+    compile_block(&c, 0);
+    free(c.tokens);
+    TRACE_END(started, "compile", NULL, (long)len);
+    if(c.error){
+        free_script(script);
+        return NULL;
+    }
+
+    if(script_count >= SCRIPT_CACHE_MAX){
+        for(i = 0; i < HASH_SIZE; i++){
+            for(link = &script_cache[i]; *link != NULL; ){
+                if((*link)->running){
+                    link = &(*link)->next;
+                    continue;
+                }
+                dropped = *link;
+                *link = dropped->next;
+                free_script(dropped);
+                script_count--;
+            }
+        }
+    }
+    script->next = script_cache[hash % HASH_SIZE];
+    script_cache[hash % HASH_SIZE] = script;
+    script_count++;
+    return script;
+}
+
+/* Synopsis:
+ * char *expand_word(Script *script, Word *word)
+ *
+ * Description:
+ * The function makes a copy of a word of a compiled script in the
+ * line arena, with the values of its variables put in.
+ *
+ * Returns:
+ * The copy, valid until the line arena is reset.
+ */
+char *expand_word(Script *script, Word *word){
+    size_t size = 1;
+    char *result, *out;
+    Part *part;
+    int i;
+
+    if(word->parts == 0)
+        return arena_strdup(&line_arena, word->text);
+    part = &script->parts[word->part];
+    {
+        const char *values[word->parts];
+
+        for(i = 0; i < word->parts; i++){
+            values[i] = part[i].var == -2 ? NULL : var_value(part[i].var);
+            size += values[i] != NULL ? strlen(values[i]) : (size_t)part[i].len;
+        }
+        out = result = arena_alloc(&line_arena, size);
+        for(i = 0; i < word->parts; i++){
+            if(values[i] != NULL)
+                out = stpcpy(out, values[i]);
+            else
+                out = mempcpy(out, part[i].text, part[i].len);
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+/* Synopsis:
+ * void script_words(Script *script, Instr *instr, int aliases)
+ *
+ * Description:
+ * The function fills cmdStr[] with the words of instr, expanding
+ * variables and globs as tokenise() would, and an alias in the first
+ * word if aliases is set. Nothing is split or parsed again.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void script_words(Script *script, Instr *instr, int aliases){
+    Word *word;
+    char *text;
+    int i, glob;
+
+    reset_cmdstr();
+    for(i = 0; i < instr->words; i++){
+        word = &script->words[instr->word + i];
+        text = expand_word(script, word);
+        if(i == 0 && aliases && expand_alias(text, 0))
+            continue;
+        glob = word->parts > 0 ? has_glob(text) : word->glob;
+        if(!glob || (cmd_len > 0 && is_redirect(cmdStr[cmd_len - 1])) || expand_glob(text) == 0)
+            push_cmdstr(text);
+    }
+}
+
+/* Synopsis:
+ * void run_script(Script *script)
+ *
+ * Description:
+ * The function runs a compiled script. Each command has its words
+ * filled in from the compiled form and goes to commands(), the line
+ * arena being rewound after it. exit stops the script and the shell,
+ * and at the prompt so does a command killed by SIGINT, which the
+ * shell itself ignores.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_script(Script *script){
+    Loop *loops = calloc(script->loops + 1, sizeof(Loop)), *loop;
+    ArenaMark mark = arena_mark(&line_arena);
+    Instr *instr;
+    int pc = 0, i;
+
+    script->running++;
+    while(pc < script->code_len && !shell_exit){
+        instr = &script->code[pc++];
+        switch(instr->op){
+        case OP_RUN:
+            arena_release(&line_arena, mark);
+            script_words(script, instr, 1);
+            if(cmd_len == 0)
+                last_status = 0;
+            else if(strcmp(cmdStr[0], "exit") == 0){
+                if(cmdStr[1] != NULL)
+                    last_status = atoi(cmdStr[1]);
+                shell_exit = 1;
+            }
+            else
+                commands();
+            if(interactive && last_status == 128 + SIGINT)
+                pc = script->code_len;
+            else if(instr->negate)
+                last_status = !last_status;
+            break;
+        case OP_ASSIGN:
+            arena_release(&line_arena, mark);
+            set_var(instr->var, expand_word(script, &script->words[instr->word]));
+            last_status = 0;
+            break;
+        case OP_JUMP:
+            pc = instr->target;
+            break;
+        case OP_JUMP_FALSE:
+            if(last_status != 0)
+                pc = instr->target;
+            break;
+        case OP_JUMP_TRUE:
+            if(last_status == 0)
+                pc = instr->target;
+            break;
+        case OP_FOR:
+            arena_release(&line_arena, mark);
+            script_words(script, instr, 0);
+            loop = &loops[instr->loop];
+            loop->items = malloc((cmd_len + 1) * sizeof(char *));
+            for(i = 0; i < (int)cmd_len; i++)
+                loop->items[i] = strdup(cmdStr[i]);
+            loop->count = cmd_len;
+            loop->next = 0;
+            last_status = 0;
+            break;
+        case OP_NEXT:
+            loop = &loops[instr->loop];
+            if(loop->next < loop->count)
+                set_var(instr->var, loop->items[loop->next++]);
+            else
+                pc = instr->target;
+            break;
+        case OP_END:
+            loop = &loops[instr->loop];
+            for(i = 0; i < loop->count; i++)
+                free(loop->items[i]);
+            free(loop->items);
+            loop->items = NULL;
+            loop->count = 0;
+            break;
+        case OP_ZERO:
+            last_status = 0;
+            break;
+        }
+    }
+    script->running--;
+
+    for(i = 0; i < script->loops; i++){ /* Loops left by exit or SIGINT. */
+        while(loops[i].count > 0)
+            free(loops[i].items[--loops[i].count]);
+        free(loops[i].items);
+    }
+    free(loops);
+    arena_release(&line_arena, mark);
+}
+
+/* Synopsis:
+ * void run_text(const char *text, size_t len)
+ *
+ * Description:
+ * The function compiles len bytes of script text, or finds them
+ * compiled already, and runs them. cmdStr[] is set aside meanwhile
+ * so a builtin running a script can carry on with its own words.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_text(const char *text, size_t len){
+    char **saved = cmdStr;
+    size_t saved_len = cmd_len, saved_cap = cmd_cap;
+    Script *script;
+
+    exec_last = 0; /* Only single commands may replace the shell. */
+    if((script = compile_script(text, len)) == NULL){
+        last_status = 2;
+        return;
+    }
+    cmdStr = NULL;
+    reset_cmdstr();
+    run_script(script);
+    free(cmdStr);
+    cmdStr = saved;
+    cmd_len = saved_len;
+    cmd_cap = saved_cap;
+}
+
+/* Synopsis:
+ * void source()
+ *
+ * Description:
+ * The function implements 'source file' and '. file', which run
+ * the commands in file in this shell, so the variables, aliases and
+ * directory it sets stay set. The whole file is compiled at once,
+ * and when it is sourced again unchanged the compiled form is used.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void source(){
+    struct stat st;
+    char *text;
+    size_t got = 0;
+    ssize_t n;
+    int fd;
+
+    if((fd = open(cmdStr[1], O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0){
+        printf("SOURCE: Error %s: %s\n", cmdStr[1], strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        last_status = 1;
+        return;
+    }
+    text = malloc(st.st_size + 1);
+    while(got < (size_t)st.st_size){
+        n = read(fd, text + got, st.st_size - got);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    run_text(text, got);
+    free(text);
+}
+
+/* Builtin Dispatch */
+
+/* Builtins, found through builtin_index[] by find_builtin() */
+const Builtin builtins[] = {
+    {"history",  "HISTORY",  0, -1, list_history},
+    {"getpath",  "GETPATH",  0, 0,  getpath},
+    {"setpath",  "SETPATH",  1, 1,  setpath},
+    {"pwd",      "PWD",      0, 0,  pwd},
+    {"cd",       "CD",       0, 1,  cd},
+    {"alias",    "ALIAS",    0, -1, alias},
+    {"unalias",  "UNALIAS",  1, 1,  remove_alias},
+    {"hash",     "HASH",     0, -1, hash},
+    {"launcher", "LAUNCHER", 0, 1,  set_launcher},
+    {"pipesize", "PIPESIZE", 0, 1,  set_pipesize},
+    {"jobs",     "JOBS",     0, 0,  list_jobs},
+    {"fg",       "FG",       0, 1,  fg},
+    {"bg",       "BG",       0, 1,  bg},
+    {"wait",     "WAIT",     0, -1, wait_jobs},
+    {"parallel", "PARALLEL", 0, -1, parallel},
+    {"echo",     "ECHO",     0, -1, echo},
+    {"true",     "TRUE",     0, -1, builtin_true},
+    {"false",    "FALSE",    0, -1, builtin_false},
+    {"test",     "TEST",     0, -1, test_builtin},
+    {"[",        "[",        0, -1, test_builtin},
+    {"printf",   "PRINTF",   1, -1, printf_builtin},
+    {"export",   "EXPORT",   0, -1, export},
+    {"unset",    "UNSET",    0, -1, unset},
+    {"type",     "TYPE",     1, -1, type},
+    {"time",     "TIME",     1, -1, time_command},
+    {"stats",    "STATS",    0, 1,  stats},
+    {"cat",      "CAT",      0, -1, cat},
+    {"cp",       "CP",       2, -1, cp},
+    {"memo",     "MEMO",     0, -1, memo},
+    {"source",   "SOURCE",   1, 1,  source},
+    {"run",      "RUN",      0, -1, run_command},
+    {"trace",    "TRACE",    0, 3,  trace},
+    {".",        "SOURCE",   1, 1,  source},
+};
+
+/* Slot of each builtin plus one, 0 for an empty slot */
+unsigned char builtin_index[BUILTIN_SLOTS];
+/* Seed which makes builtin_hash() give every builtin its own slot */
+unsigned int builtin_seed;
+
+/* Synopsis:
+ * unsigned int builtin_hash(const char *name, unsigned int seed)
+ *
+ * Description:
+ * The function hashes name with FNV-1a, starting from a basis
+ * derived from seed.
+ *
+ * Returns:
+ * The hash of name.
+ */
+unsigned int builtin_hash(const char *name, unsigned int seed){
+    unsigned int hash = 2166136261u ^ (seed * 2654435761u);
+
+    while(*name != '\0'){
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+/* Synopsis:
+ * void builtins_init()
+ *
+ * Description:
+ * The function builds a perfect hash of the builtin names by
+ * trying seeds until every builtin lands in a slot of its own,
+ * so a lookup takes one hash and one strcmp.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void builtins_init(){
+    unsigned int seed, slot;
+    int i;
+
+    for(seed = 1; ; seed++){
+        memset(builtin_index, 0, sizeof(builtin_index));
+        for(i = 0; i < (int)SIZE(builtins); i++){
+            slot = builtin_hash(builtins[i].name, seed) & (BUILTIN_SLOTS - 1);
+            if(builtin_index[slot] != 0)
+                break;
+            builtin_index[slot] = i + 1;
+        }
+        if(i == (int)SIZE(builtins))
+            break;
+    }
+    builtin_seed = seed;
+}
+
+/* Synopsis:
+ * const Builtin *find_builtin(const char *name)
+ *
+ * Description:
+ * The function looks name up in the builtin dispatch table,
+ * building the table the first time it is used.
+ *
+ * Returns:
+ * The descriptor of builtin name.
+ * NULL if name is not a builtin.
+ */
+const Builtin *find_builtin(const char *name){
+    int index;
+
+    if(builtin_seed == 0)
+        builtins_init();
+    index = builtin_index[builtin_hash(name, builtin_seed) & (BUILTIN_SLOTS - 1)];
+    if(index != 0 && strcmp(builtins[index - 1].name, name) == 0)
+        return &builtins[index - 1];
+    return NULL;
+}
+
+/* Synopsis:
+ * void run_builtin(const Builtin *builtin)
+ *
+ * Description:
+ * The function checks the number of arguments in cmdStr[] against
+ * the limits of builtin and runs it if they are within them.
+ * Otherwise an error is printed and the status is 2.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_builtin(const Builtin *builtin){
+    int argc;
+
+    for(argc = 0; cmdStr[argc + 1] != NULL; argc++)
+        ;
+    if(argc < builtin->min_args){
+        printf("%s: Not enough arguments.\n", builtin->tag);
+        last_status = 2;
+    }
+    else if(builtin->max_args >= 0 && argc > builtin->max_args){
+        printf("%s: Error too many arguments.\n", builtin->tag);
+        last_status = 2;
+    }
+    else
+        builtin->run();
+}
+
+/* Synopsis:
+ * void redirect_builtin(const Builtin *builtin)
+ *
+ * Description:
+ * The function runs builtin in the shell with the redirections in
+ * cmdStr[] applied. The shell's stdin and stdout are set aside while
+ * it runs and put back afterwards. With no builtin, as for a line of
+ * redirections only, the files are just opened.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void redirect_builtin(const Builtin *builtin){
+    int fd_in, fd_out, saved_in = -1, saved_out = -1;
+
+    if(open_redirects(cmdStr, &fd_in, &fd_out) < 0){
+        last_status = 1;
+        return;
+    }
+    for(cmd_len = 0; cmdStr[cmd_len] != NULL; cmd_len++)
+        ;
+
+    fflush(stdout);
+    if(fd_in >= 0){
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd_in, STDIN_FILENO);
+        close(fd_in);
+    }
+    if(fd_out >= 0){
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd_out, STDOUT_FILENO);
+        close(fd_out);
+    }
+
+    if(builtin != NULL)
+        run_builtin(builtin);
+
+    fflush(stdout);
+    if(saved_in >= 0){
+        __fpurge(stdin); /* Don't let the shell read on from the file's data. */
+        clearerr(stdin);
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    if(saved_out >= 0){
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+}
+
+/* Synopsis:
+ * void commands()
+ *
+ * Description:
+ * The function runs the command line in cmdStr[]: a timed command
+ * line, a pipeline or background job, a command from history, a
+ * builtin looked up in the dispatch table or otherwise an external
+ * command. Builtins run here are added to the command statistics,
+ * external commands have their redirections opened by start_job().
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void commands(){
+    const Builtin *builtin;
+    struct timespec start;
+    uint64_t started;
+    char *name;
+    int last, i;
+
+    /* time covers the whole line, pipelines and '&' included. */
+    if (strcmp(cmdStr[0], "time") == 0 && cmdStr[1] != NULL) {
+        time_command();
+        return;
+    }
+    /* So do the settings of run. */
+    if (strcmp(cmdStr[0], "run") == 0 && cmdStr[1] != NULL) {
+        run_command();
+        return;
+    }
+
+    /* A trailing '&' runs the command line as a background job. */
+    for (last = 0; cmdStr[last + 1] != NULL; last++)
+        ;
+    for (i = 0; i < last; i++) {
+        if (strcmp(cmdStr[i], "&") == 0) {
+            puts("Error: '&' must end the command.");
+            last_status = 2;
+            return;
+        }
+    }
+    if (strcmp(cmdStr[last], "&") == 0) {
+        cmdStr[last] = NULL;
+        if (last == 0) {
+            puts("Error: Missing command before '&'.");
+            last_status = 2;
+        }
+        else
+            run_pipeline(1);
+        return;
+    }
+    if (cmdStr[0][0] != '!' && is_pipeline()) {
+        run_pipeline(0);
+        return;
+    }
+    if (is_assignment(cmdStr[0])) {
+        assign_vars();
+        return;
+    }
+    last_status = 0;
+    name = command_word(cmdStr);
+    /* Check if user invoked a command from history. */
+    if (cmdStr[0][0] == '!')
+        invoke_history();
+    else if (name == NULL)
+        redirect_builtin(NULL);
+    else if ((builtin = find_builtin(name)) != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        TRACE_START(started);
+        if (has_redirect(cmdStr))
+            redirect_builtin(builtin);
+        else
+            run_builtin(builtin);
+        TRACE_END(started, "builtin", builtin->name, last_status);
+        record_stats(find_stats(builtin->name), elapsed(&start), 0);
+    }
+    else
+        createProcess();
+}
+
+/* Executable Index */
+
+/* Synopsis:
+ * int scan_dir(const char *path, void (*visit)(int, DirEntry *, void *), void *arg)
+ *
+ * Description:
+ * The function reads directory path with getdents64, DIR_BUFFER bytes
+ * of entries per call, and calls visit with the directory's descriptor,
+ * each entry other than '.' and '..' and arg.
+ *
+ * Returns:
+ * 0 once every entry has been visited.
+ * -1 if the directory could not be read.
+ */
+int scan_dir(const char *path, void (*visit)(int, DirEntry *, void *), void *arg){
+    static char *buffer;
+    DirEntry *entry;
+    long n, pos;
+    int fd;
+
+    if((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return -1;
+    if(buffer == NULL)
+        buffer = malloc(DIR_BUFFER);
+    while((n = syscall(SYS_getdents64, fd, buffer, DIR_BUFFER)) > 0){
+        for(pos = 0; pos < n; pos += entry->d_reclen){
+            entry = (DirEntry *)(buffer + pos);
+            if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                visit(fd, entry, arg);
+        }
+    }
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/* Synopsis:
+ * int trie_child(int node, char c, int create)
+ *
+ * Description:
+ * The function finds the child of node reached by c, adding it in
+ * character order among its siblings if create is set.
+ *
+ * Returns:
+ * The child's index in exec_trie[].
+ * 0 if node has no such child and create is not set.
+ */
+int trie_child(int node, char c, int create){
+    int prev = 0, next = exec_trie[node].child, added;
+
+    while(next != 0 && (unsigned char)exec_trie[next].c < (unsigned char)c){
+        prev = next;
+        next = exec_trie[next].sibling;
+    }
+    if(next != 0 && exec_trie[next].c == c)
+        return next;
+    if(!create)
+        return 0;
+
+    if(trie_len == trie_cap){
+        trie_cap *= 2;
+        exec_trie = realloc(exec_trie, trie_cap * sizeof(TrieNode));
+    }
+    added = trie_len++;
+    exec_trie[added].c = c;
+    exec_trie[added].child = 0;
+    exec_trie[added].sibling = next;
+    exec_trie[added].count = exec_trie[added].live = 0;
+    if(prev == 0) /* The root is never a sibling, so 0 means node's first child. */
+        exec_trie[node].child = added;
+    else
+        exec_trie[prev].sibling = added;
+    return added;
+}
+
+/* Synopsis:
+ * void trie_update(const char *name, int delta)
+ *
+ * Description:
+ * The function adds name to the executable trie for delta 1, or
+ * takes away one directory holding it for delta -1. Nodes are
+ * kept when their names go, with no names counted under them.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trie_update(const char *name, int delta){
+    int node = 0;
+
+    exec_trie[0].live += delta;
+    for(; *name != '\0'; name++){
+        node = trie_child(node, *name, 1);
+        exec_trie[node].live += delta;
+    }
+    exec_trie[node].count += delta;
+}
+
+/* Synopsis:
+ * void add_executable(int dir_fd, DirEntry *entry, void *arg)
+ *
+ * Description:
+ * The function is the scan_dir() visitor reading a PATH directory.
+ * Regular files which someone may execute, links to them included,
+ * are added to the trie and to the names of the directory in arg.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_executable(int dir_fd, DirEntry *entry, void *arg){
+    PathDir *dir = arg;
+    struct stat st;
+    size_t len;
+
+    if(entry->d_type == DT_DIR || fstatat(dir_fd, entry->d_name, &st, 0) < 0 ||
+       !S_ISREG(st.st_mode) || (st.st_mode & 0111) == 0)
+        return;
+    len = strlen(entry->d_name) + 1;
+    if(dir->names_len + len > dir->names_cap){
+        dir->names_cap = (dir->names_cap + len) * 2;
+        dir->names = realloc(dir->names, dir->names_cap);
+    }
+    memcpy(dir->names + dir->names_len, entry->d_name, len);
+    dir->names_len += len;
+    trie_update(entry->d_name, 1);
+}
+
+/* Synopsis:
+ * void refresh_dir(PathDir *dir)
+ *
+ * Description:
+ * The function brings the trie up to date with dir. Nothing is
+ * read unless the directory's modification time has changed since
+ * it was last read, otherwise its old names are taken out of the
+ * trie and it is read again. A directory which has gone holds no names.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void refresh_dir(PathDir *dir){
+    struct stat st;
+    size_t pos;
+
+    if(stat(dir->path, &st) < 0)
+        memset(&st, 0, sizeof(st));
+    if(dir->scanned && st.st_mtim.tv_sec == dir->mtime.tv_sec && st.st_mtim.tv_nsec == dir->mtime.tv_nsec)
+        return;
+
+    for(pos = 0; pos < dir->names_len; pos += strlen(dir->names + pos) + 1)
+        trie_update(dir->names + pos, -1);
+    dir->names_len = 0;
+    dir->mtime = st.st_mtim; /* Taken before reading, so a change while reading is seen next time. */
+    dir->scanned = 1;
+    if(S_ISDIR(st.st_mode))
+        scan_dir(dir->path, add_executable, dir);
+}
+
+/* Synopsis:
+ * void refresh_index()
+ *
+ * Description:
+ * The function brings the executable index up to date with PATH,
+ * splitting PATH into its directories the first time it is used.
+ * Each directory costs one stat() unless it has changed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void refresh_index(){
+    const char *path = getenv("PATH"), *end;
+    int i;
+
+    if(path_dirs == NULL){
+        if(exec_trie == NULL){
+            trie_cap = 1024;
+            exec_trie = malloc(trie_cap * sizeof(TrieNode));
+        }
+        memset(&exec_trie[0], 0, sizeof(TrieNode));
+        trie_len = 1;
+
+        path_dirs = calloc(1, sizeof(PathDir)); /* Never NULL once built, even for an empty PATH. */
+        path_dir_count = 0;
+        for(; path != NULL && *path != '\0'; path = *end ? end + 1 : end){
+            end = strchrnul(path, ':');
+            if(end == path)
+                continue;
+            path_dirs = realloc(path_dirs, (path_dir_count + 1) * sizeof(PathDir));
+            memset(&path_dirs[path_dir_count], 0, sizeof(PathDir));
+            path_dirs[path_dir_count++].path = strndup(path, end - path);
+        }
+    }
+    for(i = 0; i < path_dir_count; i++)
+        refresh_dir(&path_dirs[i]);
+}
+
+/* Synopsis:
+ * void exec_index_reset()
+ *
+ * Description:
+ * The function drops the executable index, to be built again from
+ * the new PATH when completion next needs it.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void exec_index_reset(){
+    int i;
+
+    for(i = 0; i < path_dir_count; i++){
+        free(path_dirs[i].path);
+        free(path_dirs[i].names);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    path_dir_count = 0;
+}
+
+/* Command Completion */
+
+/* Synopsis:
+ * void add_completion(char *word)
+ *
+ * Description:
+ * The function adds word to the completion candidates.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_completion(char *word){
+    if(completion_count == completion_cap){
+        completion_cap = completion_cap ? completion_cap * 2 : 64;
+        completions = realloc(completions, completion_cap * sizeof(char *));
+    }
+    completions[completion_count++] = word;
+}
+
+/* Synopsis:
+ * void trie_collect(int node, char *name, size_t len)
+ *
+ * Description:
+ * The function adds every executable in the subtree of node to the
+ * completion candidates, in order. name holds the len characters
+ * leading to node and has room for the longest name.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void trie_collect(int node, char *name, size_t len){
+    int child;
+
+    if(exec_trie[node].count > 0){
+        name[len] = '\0';
+        add_completion(arena_strdup(&line_arena, name));
+    }
+    for(child = exec_trie[node].child; child != 0; child = exec_trie[child].sibling){
+        if(exec_trie[child].live > 0){
+            name[len] = exec_trie[child].c;
+            trie_collect(child, name, len + 1);
+        }
+    }
+}
+
+/* Synopsis:
+ * void complete_command(const char *word)
+ *
+ * Description:
+ * The function adds the builtins, aliases and executables on PATH
+ * starting with word to the completion candidates.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void complete_command(const char *word){
+    char name[NAME_MAX + 1];
+    size_t len = strlen(word);
+    int node = 0, i;
+
+    for(i = 0; i < (int)SIZE(builtins); i++)
+        if(strncmp(builtins[i].name, word, len) == 0)
+            add_completion((char *)builtins[i].name);
+    for(i = 0; i < alias_capacity; i++)
+        if(alias_table[i].alias_name != NULL && strncmp(alias_table[i].alias_name, word, len) == 0)
+            add_completion(alias_table[i].alias_name);
+
+    if(len > NAME_MAX)
+        return;
+    refresh_index();
+    for(i = 0; word[i] != '\0'; i++)
+        if((node = trie_child(node, word[i], 0)) == 0)
+            return;
+    memcpy(name, word, len);
+    trie_collect(node, name, len);
+}
+
+/* Synopsis:
+ * void add_path(int dir_fd, DirEntry *entry, void *arg)
+ *
+ * Description:
+ * The function is the scan_dir() visitor completing a path. An entry
+ * starting with the name in the PathQuery arg is added as the whole
+ * path, with a '/' after a directory. Hidden entries are only added
+ * when the name starts with '.'.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void add_path(int dir_fd, DirEntry *entry, void *arg){
+    PathQuery *query = arg;
+    struct stat st;
+    size_t len;
+    char *path;
+    int is_dir;
 
-        if(history_counter == 0){
-            puts("Error: No commands in history.");
-            return;
+    if(strncmp(entry->d_name, query->base, query->base_len) != 0 ||
+       (entry->d_name[0] == '.' && query->base[0] != '.'))
+        return;
+    is_dir = entry->d_type == DT_DIR;
+    if((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) && fstatat(dir_fd, entry->d_name, &st, 0) == 0)
+        is_dir = S_ISDIR(st.st_mode);
+
+    len = strlen(entry->d_name);
+    path = arena_alloc(&line_arena, query->dir_len + len + 2);
+    memcpy(path, query->word, query->dir_len);
+    memcpy(path + query->dir_len, entry->d_name, len);
+    strcpy(path + query->dir_len + len, is_dir ? "/" : "");
+    add_completion(path);
+}
+
+/* Synopsis:
+ * void complete_path(const char *word)
+ *
+ * Description:
+ * The function adds the paths starting with word to the completion
+ * candidates. A leading '~/' stands for the HOME directory.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void complete_path(const char *word){
+    const char *slash = strrchr(word, '/'), *home = getenv("HOME");
+    PathQuery query;
+    char *dir = ".";
+
+    query.word = word;
+    query.dir_len = slash != NULL ? (size_t)(slash - word) + 1 : 0;
+    query.base = word + query.dir_len;
+    query.base_len = strlen(query.base);
+    if(query.dir_len > 0){
+        if(strncmp(word, "~/", 2) == 0 && home != NULL){
+            dir = arena_alloc(&line_arena, strlen(home) + query.dir_len);
+            sprintf(dir, "%s%.*s", home, (int)query.dir_len - 1, word + 1);
         }
-		/* Check if run last command. */
-        if(strncmp("!!",cmdStr[0], 2) == 0){
-            if (history_counter == 0){
-                input = strdup(history[20]);
-            } else {
-                input = strdup(history[history_counter - 1]);
-            }
+        else{
+            dir = arena_alloc(&line_arena, query.dir_len + 1);
+            memcpy(dir, word, query.dir_len);
+            dir[query.dir_len] = '\0';
         }
-        else { /* Run command specified by user. */
-            char *num = strtok(cmdStr[0], "!\n ");
-            int index = atoi(num);
-            if (index > 0){
-                if (index < 0 || index > 20){
-                    puts("Error: History number out of bounds.");
-                    return;
-                } else if (index <= history_counter) {
-                    input = strdup(history[index-1]);
-                } else if (index > history_counter) {
-                    puts("Error: History number out of bounds.");
-                    return;
+    }
+    scan_dir(dir, add_path, &query);
+}
+
+/* Synopsis:
+ * int compare_names(const void *a, const void *b)
+ *
+ * Description:
+ * The function orders strings for qsort().
+ *
+ * Returns:
+ * Result of comparing them with strcmp().
+ */
+int compare_names(const void *a, const void *b){
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Synopsis:
+ * int find_completions(const char *word, int command)
+ *
+ * Description:
+ * The function fills completions[] with the ways word could go on,
+ * sorted and without repeats. In the command position a word with
+ * no '/' is completed as a command name, any other word as a path.
+ *
+ * Returns:
+ * The number of candidates.
+ */
+int find_completions(const char *word, int command){
+    int i, kept = 0;
+
+    completion_count = 0;
+    if(command && strchr(word, '/') == NULL)
+        complete_command(word);
+    else
+        complete_path(word);
+
+    qsort(completions, completion_count, sizeof(char *), compare_names);
+    for(i = 0; i < completion_count; i++)
+        if(kept == 0 || strcmp(completions[kept - 1], completions[i]) != 0)
+            completions[kept++] = completions[i];
+    return completion_count = kept;
+}
+
+/* Glob Expansion */
+
+/* Synopsis:
+ * const char *glob_class_end(const char *class)
+ *
+ * Description:
+ * The function finds the ']' closing the bracket expression which
+ * starts at class, just after its '['. A ']' right after '[' or
+ * '[!' is part of the set.
+ *
+ * Returns:
+ * The closing ']'.
+ * NULL if the expression is not closed, when '[' is an ordinary character.
+ */
+const char *glob_class_end(const char *class){
+    if(*class == '!' || *class == '^')
+        class++;
+    if(*class == ']')
+        class++;
+    while(*class != '\0' && *class != ']' && *class != '/')
+        class++;
+    return *class == ']' ? class : NULL;
+}
+
+/* Synopsis:
+ * int has_glob(const char *word)
+ *
+ * Description:
+ * The function checks whether word holds a wildcard: '*', '?' or
+ * a closed '[...]' expression which no '\' escapes.
+ *
+ * Returns:
+ * 1 if word is a pattern.
+ * 0 otherwise.
+ */
+int has_glob(const char *word){
+    for(; *word != '\0'; word++){
+        if(*word == '\\' && word[1] != '\0')
+            word++;
+        else if(*word == '*' || *word == '?' || (*word == '[' && glob_class_end(word + 1) != NULL))
+            return 1;
+    }
+    return 0;
+}
+
+/* Synopsis:
+ * Glob *glob_compile(const char *pattern, size_t len)
+ *
+ * Description:
+ * The function compiles len characters of pattern, one component
+ * of a path, for glob_match(). Each '?', '[...]' and other character
+ * becomes an element accepting its bytes and each run of '*' one
+ * element accepting any byte any number of times. The tables are
+ * carved out of the line arena.
+ *
+ * Returns:
+ * The compiled component.
+ */
+Glob *glob_compile(const char *pattern, size_t len){
+    Glob *glob = arena_alloc(&line_arena, sizeof(Glob));
+    const char *end = pattern + len, *p, *close;
+    int elements = 0, state = 0, negate, c, words;
+    size_t table;
+
+    /* Count the elements first to size the sets. */
+    for(p = pattern; p < end; p++){
+        if(*p == '*' && p + 1 < end && p[1] == '*')
+            continue;
+        if(*p == '[' && (close = glob_class_end(p + 1)) != NULL && close < end)
+            p = close;
+        else if(*p == '\\' && p + 1 < end)
+            p++;
+        elements++;
+    }
+    words = elements / 64 + 1;
+    table = (256 + 3) * words * sizeof(uint64_t);
+    glob->accept = memset(arena_alloc(&line_arena, table), 0, table);
+    glob->star = glob->accept + 256 * words;
+    glob->current = glob->star + words;
+    glob->next = glob->current + words;
+    glob->len = elements;
+    glob->words = words;
+    glob->hide_dots = pattern[0] != '.';
+
+#define GLOB_ACCEPT(byte) (glob->accept[(byte) * words + state / 64] |= (uint64_t)1 << (state % 64))
+    for(p = pattern; p < end; p++, state++){
+        if(*p == '*'){
+            while(p + 1 < end && p[1] == '*')
+                p++;
+            glob->star[state / 64] |= (uint64_t)1 << (state % 64);
+        }
+        else if(*p == '?'){
+            for(c = 1; c < 256; c++)
+                GLOB_ACCEPT(c);
+        }
+        else if(*p == '[' && (close = glob_class_end(p + 1)) != NULL && close < end){
+            char set[256] = {0};
+
+            p++;
+            negate = *p == '!' || *p == '^';
+            if(negate)
+                p++;
+            do{ /* The first character may be ']'. */
+                if(p + 2 < close && p[1] == '-'){
+                    for(c = (unsigned char)p[0]; c <= (unsigned char)p[2]; c++)
+                        set[c] = 1;
+                    p += 3;
                 }
-            }else {
-                puts("Error: Invalid history invocation.");
-                return;
+                else
+                    set[(unsigned char)*p++] = 1;
+            }while(p < close);
+            for(c = 1; c < 256; c++)
+                if(set[c] != negate)
+                    GLOB_ACCEPT(c);
+        }
+        else{
+            if(*p == '\\' && p + 1 < end)
+                p++;
+            GLOB_ACCEPT((unsigned char)*p);
+        }
+    }
+#undef GLOB_ACCEPT
+    return glob;
+}
+
+/* Synopsis:
+ * void glob_closure(Glob *glob, uint64_t *states)
+ *
+ * Description:
+ * The function adds to states the state after each '*' in it, as
+ * '*' may match nothing. Runs of '*' are a single element, so the
+ * state after one is never a '*' and one pass is enough.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void glob_closure(Glob *glob, uint64_t *states){
+    uint64_t carry = 0, stars;
+    int w;
+
+    for(w = 0; w < glob->words; w++){
+        stars = states[w] & glob->star[w];
+        states[w] |= stars << 1 | carry;
+        carry = stars >> 63;
+    }
+}
+
+/* Synopsis:
+ * int glob_match(Glob *glob, const char *name)
+ *
+ * Description:
+ * The function runs the NFA of glob over name, moving every live
+ * state at once for each byte with a few word operations, so the
+ * time taken grows with the length of name and never backtracks.
+ * Hidden names only match a pattern which starts with '.'.
+ *
+ * Returns:
+ * 1 if name matches.
+ * 0 otherwise.
+ */
+int glob_match(Glob *glob, const char *name){
+    uint64_t *current = glob->current, *next = glob->next, *accept, *swap, carry, moved, live;
+    int w;
+
+    if(glob->hide_dots && name[0] == '.')
+        return 0;
+    memset(current, 0, glob->words * sizeof(uint64_t));
+    current[0] = 1;
+    glob_closure(glob, current);
+
+    for(; *name != '\0'; name++){
+        accept = glob->accept + (unsigned char)*name * glob->words;
+        carry = live = 0;
+        for(w = 0; w < glob->words; w++){
+            moved = current[w] & accept[w];
+            next[w] = moved << 1 | carry | (current[w] & glob->star[w]);
+            carry = moved >> 63;
+            live |= next[w];
+        }
+        if(live == 0)
+            return 0;
+        glob_closure(glob, next);
+        swap = current;
+        current = next;
+        next = swap;
+    }
+    return (current[glob->len / 64] >> (glob->len % 64)) & 1;
+}
+
+/* Synopsis:
+ * void glob_visit(int dir_fd, DirEntry *entry, void *arg)
+ *
+ * Description:
+ * The function is the scan_dir() visitor matching a directory against
+ * a component of a pattern. In the last component a matching name is
+ * pushed onto cmdStr[] as its whole path straight away, otherwise a
+ * matching directory is kept to be searched for the next component.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void glob_visit(int dir_fd, DirEntry *entry, void *arg){
+    GlobScan *scan = arg;
+    struct stat st;
+    size_t len;
+    char *path;
+    int is_dir;
+
+    if(!glob_match(scan->glob, entry->d_name))
+        return;
+    len = strlen(entry->d_name);
+    if(scan->last){
+        path = arena_alloc(&line_arena, scan->len + len + 1);
+        memcpy(path, scan->path, scan->len);
+        memcpy(path + scan->len, entry->d_name, len + 1);
+        push_cmdstr(path);
+        return;
+    }
+
+    if(entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+        is_dir = fstatat(dir_fd, entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    else
+        is_dir = entry->d_type == DT_DIR;
+    if(!is_dir)
+        return;
+    if(scan->dir_count == scan->dir_cap){
+        scan->dir_cap = scan->dir_cap ? scan->dir_cap * 2 : 16;
+        scan->dirs = realloc(scan->dirs, scan->dir_cap * sizeof(char *));
+    }
+    scan->dirs[scan->dir_count++] = arena_strdup(&line_arena, entry->d_name);
+}
+
+/* Synopsis:
+ * void glob_dir(char *path, size_t len, const char *rest)
+ *
+ * Description:
+ * The function expands the pattern rest under the directory held in
+ * the first len characters of path, a PATH_MAX buffer. Components
+ * with no wildcard are added to the path as they are, without their
+ * '\' escapes, the others are matched against the directory with one
+ * bulk read and only the matching names kept.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void glob_dir(char *path, size_t len, const char *rest){
+    const char *end, *p;
+    struct stat st;
+    GlobScan scan;
+    size_t start;
+    int i;
+
+    while(*rest == '/' && len < PATH_MAX - 1)
+        path[len++] = *rest++;
+    end = strchrnul(rest, '/');
+    if(len + (end - rest) >= PATH_MAX - 1)
+        return;
+
+    path[len] = '\0';
+    if(!has_glob(strndupa(rest, end - rest))){
+        start = len;
+        for(p = rest; p < end; p++){
+            if(*p == '\\' && p + 1 < end)
+                p++;
+            path[len++] = *p;
+        }
+        path[len] = '\0';
+        if(*end != '\0')
+            glob_dir(path, len, end);
+        else if(lstat(path, &st) == 0)
+            push_cmdstr(arena_strdup(&line_arena, path));
+        path[start] = '\0';
+        return;
+    }
+
+    scan.glob = glob_compile(rest, end - rest);
+    scan.path = path;
+    scan.len = len;
+    scan.last = *end == '\0';
+    scan.dirs = NULL;
+    scan.dir_count = scan.dir_cap = 0;
+    scan_dir(len > 0 ? path : ".", glob_visit, &scan);
+
+    for(i = 0; i < scan.dir_count; i++){
+        if(len + strlen(scan.dirs[i]) >= PATH_MAX - 1)
+            continue;
+        strcpy(path + len, scan.dirs[i]);
+        glob_dir(path, len + strlen(scan.dirs[i]), end);
+    }
+    path[len] = '\0';
+    free(scan.dirs);
+}
+
+/* Synopsis:
+ * int expand_glob(char *word)
+ *
+ * Description:
+ * The function pushes the paths matching the pattern word onto
+ * cmdStr[] as they are found, then sorts them in byte order.
+ *
+ * Returns:
+ * The number of paths pushed, 0 if none matched.
+ */
+int expand_glob(char *word){
+    char path[PATH_MAX];
+    size_t first = cmd_len;
+
+    glob_dir(path, 0, word);
+    qsort(&cmdStr[first], cmd_len - first, sizeof(char *), compare_names);
+    return cmd_len - first;
+}
+
+/* Line Editor */
+
+/* Synopsis:
+ * int editor_key()
+ *
+ * Description:
+ * The function returns the next byte typed, reading whatever the
+ * terminal has ready when the keys read before are used up.
+ *
+ * Returns:
+ * The byte.
+ * -1 at the end of input.
+ */
+int editor_key(){
+    ssize_t n;
+
+    if(editor.keys_pos == editor.keys_len){
+        while((n = read(STDIN_FILENO, editor.keys, sizeof(editor.keys))) < 0 && errno == EINTR)
+            ;
+        if(n <= 0)
+            return -1;
+        editor.keys_len = n;
+        editor.keys_pos = 0;
+    }
+    return (unsigned char)editor.keys[editor.keys_pos++];
+}
+
+/* Synopsis:
+ * void editor_refresh()
+ *
+ * Description:
+ * The function redraws the prompt and the line, and puts the
+ * cursor back where it is in the line.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void editor_refresh(){
+    printf("\r%s%.*s\x1b[K", prompt, (int)editor.len, editor.line);
+    if(editor.pos < editor.len)
+        printf("\x1b[%zuD", editor.len - editor.pos);
+    fflush(stdout);
+}
+
+/* Synopsis:
+ * void editor_insert(const char *text, size_t len)
+ *
+ * Description:
+ * The function inserts len characters of text at the cursor.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void editor_insert(const char *text, size_t len){
+    if(editor.len + len + 1 > editor.cap){
+        editor.cap = (editor.len + len + 1) * 2;
+        editor.line = realloc(editor.line, editor.cap);
+    }
+    memmove(editor.line + editor.pos + len, editor.line + editor.pos, editor.len - editor.pos);
+    memcpy(editor.line + editor.pos, text, len);
+    editor.len += len;
+    editor.pos += len;
+}
+
+/* Synopsis:
+ * void editor_delete(size_t from, size_t to)
+ *
+ * Description:
+ * The function deletes the characters of the line from from up
+ * to to and leaves the cursor where they were.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void editor_delete(size_t from, size_t to){
+    memmove(editor.line + from, editor.line + to, editor.len - to);
+    editor.len -= to - from;
+    editor.pos = from;
+}
+
+/* Synopsis:
+ * void editor_browse(int delta)
+ *
+ * Description:
+ * The function replaces the line with the previous command in
+ * history for delta -1 or the next for delta 1. Going past the
+ * latest command brings back the line which was being typed.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void editor_browse(int delta){
+    const char *text;
+
+    if(editor.browse + delta < 0 || editor.browse + delta > history_counter)
+        return;
+    if(editor.browse == history_counter){
+        free(editor.draft);
+        editor.draft = strndup(editor.line, editor.len);
+    }
+    editor.browse += delta;
+    text = editor.browse == history_counter ? editor.draft : history_entry(editor.browse);
+    editor.len = editor.pos = 0;
+    editor_insert(text, strlen(text));
+}
+
+/* Synopsis:
+ * void list_completions(size_t skip)
+ *
+ * Description:
+ * The function prints the completion candidates in columns under
+ * the line, leaving out the first skip characters of each, and
+ * draws the line again below them.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void list_completions(size_t skip){
+    struct winsize size;
+    int columns = 80, width = 0, per_row, i;
+
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        columns = size.ws_col;
+    for(i = 0; i < completion_count; i++)
+        if((int)strlen(completions[i] + skip) > width)
+            width = strlen(completions[i] + skip);
+    width += 2;
+    per_row = columns / width > 0 ? columns / width : 1;
+
+    putchar('\n');
+    for(i = 0; i < completion_count; i++){
+        if((i + 1) % per_row == 0 || i == completion_count - 1)
+            printf("%s\n", completions[i] + skip);
+        else
+            printf("%-*s", width, completions[i] + skip);
+    }
+    editor_refresh();
+}
+
+/* Synopsis:
+ * void editor_complete()
+ *
+ * Description:
+ * The function completes the word before the cursor. It is extended
+ * by what all candidates have in common, a single candidate being
+ * followed by a space unless it is a directory. When nothing can be
+ * added, a second Tab in a row lists the candidates.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void editor_complete(){
+    size_t start = editor.pos, before, len, common, skip = 0;
+    const char *slash;
+    char *word;
+    int command;
+
+    while(start > 0 && strchr(WORD_BREAKS, editor.line[start - 1]) == NULL)
+        start--;
+    for(before = start; before > 0 && isspace((unsigned char)editor.line[before - 1]); before--)
+        ;
+    command = before == 0 || editor.line[before - 1] == '|' || editor.line[before - 1] == '&';
+
+    len = editor.pos - start;
+    word = arena_alloc(&line_arena, len + 1);
+    memcpy(word, editor.line + start, len);
+    word[len] = '\0';
+
+    if(find_completions(word, command) == 0){
+        putchar('\a');
+        fflush(stdout);
+        return;
+    }
+    for(common = 0; completions[0][common] != '\0' &&
+        completions[0][common] == completions[completion_count - 1][common]; common++)
+        ;
+
+    if(common > len)
+        editor_insert(completions[0] + len, common - len);
+    if(completion_count == 1 && common > 0 && completions[0][common - 1] != '/')
+        editor_insert(" ", 1);
+    else if(common == len && editor.tabbed){
+        if((slash = strrchr(word, '/')) != NULL)
+            skip = slash - word + 1;
+        list_completions(skip);
+        return;
+    }
+    editor_refresh();
+}
+
+/* Synopsis:
+ * char *edit_line(Reader *in)
+ *
+ * Description:
+ * The function prompts for and reads a line from the terminal with
+ * the line editor. The terminal is put in raw mode while the line is
+ * edited. Keys:
+ * - Left, Right, Home, End, Ctrl-B, Ctrl-F, Ctrl-A, Ctrl-E move the cursor;
+ * - Backspace, Delete, Ctrl-D, Ctrl-U, Ctrl-K, Ctrl-W delete;
+ * - Up, Down, Ctrl-P, Ctrl-N browse history;
+ * - Tab completes, Ctrl-L clears the screen, Ctrl-C drops the line;
+ * - Ctrl-D on an empty line ends input.
+ * If the terminal can't be put in raw mode the line is read from in.
+ *
+ * Returns:
+ * The line, valid until the next call.
+ * NULL at the end of input.
+ */
+char *edit_line(Reader *in){
+    struct termios saved, raw;
+    int key, done = 0;
+    size_t i;
+
+    if(tcgetattr(STDIN_FILENO, &saved) < 0){
+        printf(prompt);
+        fflush(stdout);
+        return read_line(in);
+    }
+    raw = saved;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if(tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) < 0){
+        printf(prompt);
+        fflush(stdout);
+        return read_line(in);
+    }
+
+    editor.len = editor.pos = 0;
+    editor.browse = history_counter;
+    editor.tabbed = 0;
+    editor_refresh();
+    while(!done){
+        switch(key = editor_key()){
+        case -1:
+            done = -1;
+            break;
+        case '\r':
+        case '\n':
+            done = 1;
+            break;
+        case '\t':
+            editor_complete();
+            break;
+        case 1: /* Ctrl-A */
+            editor.pos = 0;
+            break;
+        case 2: /* Ctrl-B */
+            if(editor.pos > 0)
+                editor.pos--;
+            break;
+        case 3: /* Ctrl-C */
+            printf("^C\n");
+            editor.len = editor.pos = 0;
+            editor.browse = history_counter;
+            break;
+        case 4: /* Ctrl-D */
+            if(editor.len == 0)
+                done = -1;
+            else if(editor.pos < editor.len)
+                editor_delete(editor.pos, editor.pos + 1);
+            break;
+        case 5: /* Ctrl-E */
+            editor.pos = editor.len;
+            break;
+        case 6: /* Ctrl-F */
+            if(editor.pos < editor.len)
+                editor.pos++;
+            break;
+        case 11: /* Ctrl-K */
+            editor.len = editor.pos;
+            break;
+        case 12: /* Ctrl-L */
+            printf("\x1b[H\x1b[2J");
+            break;
+        case 14: /* Ctrl-N */
+            editor_browse(1);
+            break;
+        case 16: /* Ctrl-P */
+            editor_browse(-1);
+            break;
+        case 21: /* Ctrl-U */
+            editor_delete(0, editor.pos);
+            break;
+        case 23: /* Ctrl-W */
+            for(i = editor.pos; i > 0 && editor.line[i - 1] == ' '; i--)
+                ;
+            while(i > 0 && editor.line[i - 1] != ' ')
+                i--;
+            editor_delete(i, editor.pos);
+            break;
+        case 8:
+        case 127: /* Backspace */
+            if(editor.pos > 0)
+                editor_delete(editor.pos - 1, editor.pos);
+            break;
+        case 27: /* Escape sequences of the arrow and editing keys */
+            if((key = editor_key()) != '[' && key != 'O')
+                break;
+            key = editor_key();
+            if(key >= '0' && key <= '9' && editor_key() != '~')
+                break;
+            if(key == 'A')
+                editor_browse(-1);
+            else if(key == 'B')
+                editor_browse(1);
+            else if(key == 'C' && editor.pos < editor.len)
+                editor.pos++;
+            else if(key == 'D' && editor.pos > 0)
+                editor.pos--;
+            else if(key == 'H' || key == '1' || key == '7')
+                editor.pos = 0;
+            else if(key == 'F' || key == '4' || key == '8')
+                editor.pos = editor.len;
+            else if(key == '3' && editor.pos < editor.len)
+                editor_delete(editor.pos, editor.pos + 1);
+            break;
+        default:
+            if(key >= 32){
+                char c = key;
+                editor_insert(&c, 1);
             }
+            break;
         }
-        copy = strdup(input);
-        if (tokenise(copy) == 1)
-            commands();
-        else
-            puts("Error: Invalid history invocation.");
+        editor.tabbed = key == '\t';
+        if(!done && key != '\t')
+            editor_refresh();
     }
-    else{
-        puts("HISTORY: Error too many arguments");
-    }
-    return;
+
+    putchar('\n');
+    fflush(stdout);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    if(done < 0)
+        return NULL;
+    if(editor.line == NULL)
+        editor_insert("", 0);
+    editor.line[editor.len] = '\0';
+    return editor.line;
 }
 
+/* Input Reading */
+
 /* Synopsis:
- * void open_history()
+ * void reader_open(Reader *in, int fd)
  *
  * Description:
- * The function creates new file at HOME directory to store history
- * if the file has not been created. 
- * Otherwise, reads lines from file and adds commands to history.
+ * The function prepares in to read lines from fd.
  *
  * Returns:
- * The function has return type void
+ * The function has return type void.
  */
-void open_history(){
-	FILE *history_file;
-	char load_file[513];
-    char *letter;
+void reader_open(Reader *in, int fd){
+    in->fd = fd;
+    in->size = READ_CHUNK;
+    in->buf = malloc(in->size);
+    in->start = in->end = in->scanned = 0;
+    in->eof = 0;
+}
 
-	/* Create a new file. */
-	if((history_file = fopen(".hist_list", "r")) == NULL){
-		puts("Creating new history file at HOME directory.");
-	}
+/* Synopsis:
+ * void reader_string(Reader *in, const char *str)
+ *
+ * Description:
+ * The function prepares in to read lines from a string.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void reader_string(Reader *in, const char *str){
+    in->fd = -1;
+    in->end = strlen(str);
+    in->size = in->end + 1;
+    in->buf = malloc(in->size);
+    memcpy(in->buf, str, in->end);
+    in->start = in->scanned = 0;
+    in->eof = 1;
+}
 
-	/* File exists, read it. */
-	else {
-		while (1) {
-			if((fgets(load_file, 513, history_file)) == NULL){ /* End of file check. */
-				break;
-			}
+/* Synopsis:
+ * char *read_line(Reader *in)
+ *
+ * Description:
+ * The function returns the next line of input without its newline.
+ * Input is read in READ_CHUNK sized blocks and the buffer grows as
+ * needed, so lines may be of any length. The line stays valid until
+ * the next call.
+ *
+ * Returns:
+ * The next line.
+ * NULL at the end of input.
+ */
+char *read_line(Reader *in){
+    char *line, *nl;
+    ssize_t n;
 
-           		 /* Check to see if there is a newline file in the history.
-            		  * If so, replace with a null terminate. */
-			if ((letter = strchr(load_file, '\n')) != NULL)
-                		*letter = '\0';
-			add_history(load_file);
-	 	}
-	 	fclose(history_file);
-	}
+    while(1){
+        /* Only search data which has not been searched yet. */
+        if((nl = memchr(in->buf + in->scanned, '\n', in->end - in->scanned)) != NULL){
+            *nl = '\0';
+            line = in->buf + in->start;
+            in->start = in->scanned = nl - in->buf + 1;
+            return line;
+        }
+        in->scanned = in->end;
+
+        if(in->eof){ /* Last line may have no newline. */
+            if(in->start == in->end)
+                return NULL;
+            in->buf[in->end] = '\0';
+            line = in->buf + in->start;
+            in->start = in->scanned = in->end;
+            return line;
+        }
+
+        /* Move the partial line to the front and make room for more. */
+        if(in->start > 0){
+            memmove(in->buf, in->buf + in->start, in->end - in->start);
+            in->end -= in->start;
+            in->scanned -= in->start;
+            in->start = 0;
+        }
+        if(in->size - in->end < READ_CHUNK / 2){
+            in->size *= 2;
+            in->buf = realloc(in->buf, in->size);
+        }
 
+        /* Keep a byte free for terminating a final line. */
+        n = read(in->fd, in->buf + in->end, in->size - in->end - 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            in->eof = 1;
+        else
+            in->end += n;
+    }
 }
 
 /* Synopsis:
- * void save_history()
+ * int reader_at_end(Reader *in)
  *
  * Description:
- * The function opens file where history is stored and prints
- * history to that file.
+ * The function checks whether nothing but blank lines and comments
+ * follows the line last read from in. More input is only read into
+ * the free end of the buffer, as the current line must stay where
+ * it is, so the answer is no if the buffer fills up first.
  *
  * Returns:
- * The function has return type void.
+ * 1 if no further commands can be read from in.
+ * 0 otherwise.
  */
-void save_history(){
-	FILE *history_file;
-    	int i;
-	history_file = fopen(".hist_list", "w+");
- 	i = 0;
-
-	while(i < history_counter){ /* Ensures empty history is not printed. */
-		fprintf(history_file, "%s\n", history[i]);
-		i++;
-	}
- 	fclose(history_file);
+int reader_at_end(Reader *in){
+    size_t pos = in->start;
+    ssize_t n;
+
+    while(1){
+        while(pos < in->end){
+            if(in->buf[pos] == '#'){
+                while(pos < in->end && in->buf[pos] != '\n')
+                    pos++;
+            }
+            else if(isspace((unsigned char)in->buf[pos]))
+                pos++;
+            else
+                return 0;
+        }
+        if(in->eof)
+            return 1;
+        if(in->end >= in->size - 1)
+            return 0;
+        n = read(in->fd, in->buf + in->end, in->size - in->end - 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            in->eof = 1;
+        else
+            in->end += n;
+    }
 }
 
 /* Synopsis:
- * void createProcess()
+ * void read_heredocs(Reader *in)
  *
  * Description:
- * The function forks a child process from parent
- * process, executes it, goes back to parent process.
+ * The function reads the body of each here-document in cmdStr[] from
+ * in, the lines up to one holding only its delimiter, and puts it in
+ * place of the delimiter. Variables in a body are expanded unless its
+ * delimiter was quoted. At the end of input the body ends too. The
+ * words of cmdStr[] must not be in the reader's buffer.
  *
  * Returns:
  * The function has return type void.
  */
-void createProcess(){
-    pid_t pid;
-    int status;
+void read_heredocs(Reader *in){
+    char *line, *body;
+    size_t len;
+    FILE *text;
+    int i, quoted;
 
-    if ((pid = fork()) < 0) {  /* Fork a child process. */
-        perror("Error");
-        exit(1);
-    }
-    else if (pid == 0) {  /* For the child process.. */
-        if (execvp(cmdStr[0], cmdStr) < 0) { /* .. execute the command. */
-            perror("Error");
-            exit(1);
+    for(i = 1; cmdStr[i] != NULL; i++){
+        if(strcmp(cmdStr[i - 1], "<<") != 0)
+            continue;
+        quoted = heredoc_quoted(cmdStr[i]);
+        text = open_memstream(&body, &len);
+        while((line = interactive ? edit_line(in) : read_line(in)) != NULL && strcmp(line, cmdStr[i]) != 0){
+            fputs(line, text);
+            fputc('\n', text);
         }
-    }
-    else {   /* For the parent.. */
-        while (wait(&status) != pid) /* .. wait for completion. */
-            ;
+        fclose(text);
+        cmdStr[i] = arena_strdup(&line_arena, body);
+        free(body);
+        if(!quoted)
+            cmdStr[i] = expand_vars(cmdStr[i]);
     }
 }
 
 /* Synopsis:
- * void commands()
+ * void copy_heredocs(Reader *in, const char *line, FILE *block)
  *
  * Description:
- * The function compares user input to different command names,
- * checks if enough and not too many arguments provided for each
- * command and then invokes appropriate function which
- * executes command from input line.
+ * The function copies the here-documents started by line from in to
+ * block, delimiter lines included, without looking at their lines,
+ * so a body line such as 'done' does not end a block being read.
  *
  * Returns:
  * The function has return type void.
  */
-void commands(){
-    int count = 0; /* Helper variable for printing out history. */
-    while (1){
-        /* Check if user invoked a command from history. */
-        if (cmdStr[0][0] == '!')
-        {
-            invoke_history();
-            return;
-        }
-        else if( strcmp(cmdStr[0], "history") == 0)
-        {
-            if(!cmdStr[1]){ /* Check if valid number of arguments. */
-                while(count < history_counter){
-                    printf("[%d]> %s\n", count + 1, history[count]);
-                    count++;
-                }
-            } else {
-                puts("HISTORY: Error too many arguments.");
-            }
-        }
-        else if (strcmp(cmdStr[0], "getpath") == 0) {
-            if(!cmdStr[1]){ /* Check if valid number of arguments. */
-                printf("%s\n",getenv("PATH"));
-            }
-            else{
-                puts("GETPATH: Error too many arguments.");
-            }
-        }
-        else if (strcmp(cmdStr[0], "setpath") == 0) {
-            if(!cmdStr[1]){ /* Check if enough arguments. */
-                puts("SETPATH: Not enough arguments.");
-            }
-            else if(!cmdStr[2]){ /* Check if valid number of arguments. */
-                const char *path=cmdStr[1];
-                if(setenv("PATH",path,1)<0)
-                    perror("Error setting path: ");
-            }
-            else{
-                puts("SETPATH: Error too many arguments");
-            }
-        }
-        else if (strcmp(cmdStr[0], "pwd") == 0) {
-            if(!cmdStr[1]){ /* Check if valid number of arguments. */
-                pwd();
-            }
-            else{
-                puts("PWD: Error too many arguments.");
+void copy_heredocs(Reader *in, const char *line, FILE *block){
+    char *words = strdup(line), *token, *body;
+    int heredoc = 0;
+    Scanner scan;
+
+    scan_init(&scan, words);
+    while((token = scan_token(&scan)) != NULL){
+        if(heredoc){
+            heredoc_quoted(token);
+            while((body = interactive ? edit_line(in) : read_line(in)) != NULL){
+                fputs(body, block);
+                fputc('\n', block);
+                if(strcmp(body, token) == 0)
+                    break;
             }
         }
-        else if (strcmp(cmdStr[0], "cd") == 0) {
-            cd();
-        }
-        else if(strcmp(cmdStr[0], "alias") == 0){
-            alias();
+        heredoc = strcmp(token, "<<") == 0;
+    }
+    free(words);
+}
 
-        } 
-	else if(strcmp(cmdStr[0], "unalias") == 0){
-            remove_alias();
-        }
-        else{
-            createProcess();
-        }
-        return;
+/* Synopsis:
+ * void run_block(Reader *in, char *line)
+ *
+ * Description:
+ * The function reads the rest of the if, while, until or for
+ * statement which line starts, up to its matching fi or done, and
+ * runs it as one compiled script. Typing or reading the same block
+ * again uses the compiled form kept from the first time.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void run_block(Reader *in, char *line){
+    char *text;
+    size_t len;
+    FILE *block = open_memstream(&text, &len);
+    int depth = 0, keyword;
+
+    while(line != NULL){
+        keyword = script_keyword(line);
+        if(keyword == KW_IF || keyword == KW_WHILE || keyword == KW_UNTIL || keyword == KW_FOR)
+            depth++;
+        else if(keyword == KW_FI || keyword == KW_DONE)
+            depth--;
+        fputs(line, block);
+        fputc('\n', block);
+        if(strstr(line, "<<") != NULL)
+            copy_heredocs(in, line, block);
+        if(depth <= 0)
+            break;
+        line = interactive ? edit_line(in) : read_line(in);
     }
+    fclose(block);
+    run_text(text, len);
+    free(text);
 }
 
 /* Synopsis:
- * void user_input()
+ * void user_input(Reader *in)
  *
  * Description:
- * The function works with user input, checks it has valid length,
+ * The function works with user input, reads each line from in,
  * whether or not exit command received, invokes input string tokenising
  * and checks whether to add command to commands history or if it is
- * history invocation.
+ * history invocation. The prompt and history are only used when the
+ * shell is interactive.
  *
  * Returns:
  * The function has return type void.
  */
-void user_input(){
+void user_input(Reader *in){
     /* Declare local variables and initialise. */
-    char input[MAX_LEN], *cmd = NULL, copy[MAX_LEN];
-    int i, return_val;
+    char *input, *copy;
+    int return_val, heredocs;
+    uint64_t started;
     while(1){
         reset_cmdstr();
-        i=0;
-        printf(prompt);
+        arena_reset(&line_arena); /* Everything from the last line is finished with. */
+        report_jobs(); /* Tell the user about finished background jobs. */
+        TRACE_START(started);
+        if (interactive)
+            input = edit_line(in);
+        else
+            input = read_line(in);
+        TRACE_END(started, "read", input, input != NULL ? (long)strlen(input) : -1);
 
-        if (fgets(input, MAX_LEN, stdin) == NULL){
-            puts("Exit code received");
+        if (input == NULL){
+            if (interactive)
+                puts("Exit code received");
             return;
         }
 
-        if (strlen(input)>(MAX_LEN-2)){
-            puts(": file name too big\n");
-            FLUSH_STDIN(i)
-            continue;
-        }
-
         /* Checking user has not just hit enter. */
-        if (input[0] == '\n')
+        if (input[0] == '\0')
             continue;
 
-        if ((cmd = strchr(input, '\n')) != NULL)
-            *cmd = '\0';
+        /* A statement of the script language is compiled and run whole. */
+        if (script_keyword(input) >= 0) {
+            run_block(in, input);
+            if (shell_exit)
+                return;
+            continue;
+        }
 
         /* Get copy of the string before tokenising. */
-        strcpy(copy, input);
-        
+        TRACE_START(started);
+        copy = arena_strdup(&line_arena, input);
+        heredocs = strstr(input, "<<") != NULL;
+        if (heredocs) /* Reading their bodies moves the reader on from the line. */
+            input = arena_strdup(&line_arena, input);
+
         return_val = tokenise(input);
 
         if (return_val == 0)
             continue;
         else if (return_val == 2)
             puts("Error: Tokenise Fault.");
+        if (heredocs && cmdStr[0][0] != '!')
+            read_heredocs(in);
 
         /* Add the input to the history if it is not history invocation. */
-        if(copy[0] != '!')
+        if(interactive && copy[0] != '!')
             add_history(copy);
 
 		/* Exit command received. */
         if (strcmp(cmdStr[0],"exit") == 0){
-            puts("Exiting the Shell");
+            if (cmdStr[1] != NULL)
+                last_status = atoi(cmdStr[1]);
+            if (interactive)
+                puts("Exiting the Shell");
             return;
         }
         else {
+            /* Nothing after the last command of -c or a script, it can replace the shell. */
+            exec_last = tail_calls && reader_at_end(in);
             commands();
+            TRACE_END(started, "line", copy, last_status);
+            if (shell_exit) /* exit in a sourced script. */
+                return;
+        }
+    }
+}
+
+/* Server Mode */
+
+/* Synopsis:
+ * int server_socket(const char *path, int listening)
+ *
+ * Description:
+ * The function opens a Unix domain stream socket at path. A client
+ * connects to it. A server binds it with a umask which leaves it to
+ * the owner only, replacing a socket left behind by an earlier
+ * server, and listens on it.
+ *
+ * Returns:
+ * The socket.
+ * -1 on error, which has been reported.
+ */
+int server_socket(const char *path, int listening){
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0){
+        perror("socket() error");
+        return -1;
+    }
+    if(!listening){
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* Only ever remove a socket, never a file given by mistake. */
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    mask = umask(077);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+    return fd;
+}
+
+/* Synopsis:
+ * int send_request(int sock, const char *commands)
+ *
+ * Description:
+ * The function sends commands to a server as a ServerRequest
+ * carrying this process's stdin, stdout and stderr as SCM_RIGHTS,
+ * followed by the working directory, each environment string and
+ * an empty string, all NUL terminated, and then the commands.
+ *
+ * Returns:
+ * 0 if the request was sent.
+ * -1 on error.
+ */
+int send_request(int sock, const char *commands){
+    ServerRequest req;
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    char cwd[PATH_MAX], *payload;
+    size_t len;
+    FILE *stream;
+    int i, result;
+
+    if(getcwd(cwd, sizeof(cwd)) == NULL){
+        perror("getcwd() error");
+        return -1;
+    }
+    stream = open_memstream(&payload, &len);
+    fwrite(cwd, 1, strlen(cwd) + 1, stream);
+    for(i = 0; environ[i] != NULL; i++)
+        fwrite(environ[i], 1, strlen(environ[i]) + 1, stream);
+    fputc('\0', stream);
+    fputs(commands, stream);
+    fclose(stream);
+
+    if(len > SERVER_MAX_REQUEST){
+        fprintf(stderr, "Error: request of %zu bytes is too large\n", len);
+        free(payload);
+        return -1;
+    }
+    req.magic = SERVER_MAGIC;
+    req.length = len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    result = sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(req) && write_all(sock, payload, len) == 0 ? 0 : -1;
+    free(payload);
+    return result;
+}
+
+/* Synopsis:
+ * char *recv_request(int sock, int fds[3], size_t *len)
+ *
+ * Description:
+ * The function receives a request sent by send_request(), storing
+ * the descriptors it carries in fds and the length of its payload
+ * in len. The payload is NUL terminated.
+ *
+ * Returns:
+ * The payload, which the caller frees.
+ * NULL if the request was not well formed.
+ */
+char *recv_request(int sock, int fds[3], size_t *len){
+    ServerRequest req;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    char *payload;
+    size_t got = 0;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    while((n = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if(n != sizeof(req) || req.magic != SERVER_MAGIC || req.length > SERVER_MAX_REQUEST)
+        return NULL;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return NULL;
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    payload = malloc(req.length + 1);
+    while(got < req.length){
+        n = read(sock, payload + got, req.length - got);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0){
+            free(payload);
+            return NULL;
+        }
+        got += n;
+    }
+    payload[got] = '\0';
+    *len = got;
+    return payload;
+}
+
+/* Synopsis:
+ * void server_worker(int listen_fd, int ready_fd, int signal_fd)
+ *
+ * Description:
+ * The function is run by a worker forked from a warmed up server.
+ * It waits for one connection, tells the server it is busy through
+ * ready_fd so another worker is started in its place, then takes
+ * on the working directory, environment, stdin, stdout and stderr
+ * of the request, runs its commands and sends back the exit status
+ * of the last one. Only the user running the server may connect.
+ * The worker exits afterwards, so nothing a request changes is
+ * seen by any other request.
+ *
+ * Returns:
+ * The function does not return.
+ */
+void server_worker(int listen_fd, int ready_fd, int signal_fd){
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    sigset_t mask;
+    int sock, fds[3], i, status = 1;
+    char *payload, *end, *cwd, *entry, *path;
+    size_t len;
+    pid_t pid = getpid();
+    Reader in;
+
+    close(signal_fd);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    /* An idle worker goes when the server does. */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    events_forget();
+    path = strdup(getenv("PATH") ? getenv("PATH") : "");
+
+    while((sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+        if(errno != EINTR && errno != ECONNABORTED)
+            _exit(1);
+    prctl(PR_SET_PDEATHSIG, 0);
+    write(ready_fd, &pid, sizeof(pid));
+    close(ready_fd);
+    close(listen_fd);
+
+    if(getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != getuid())
+        _exit(1);
+    if((payload = recv_request(sock, fds, &len)) == NULL)
+        _exit(1);
+
+    for(i = 0; i < 3; i++){
+        dup2(fds[i], i);
+        if(fds[i] != i)
+            close(fds[i]);
+    }
+
+    /* The working directory, then the environment up to an empty string. */
+    end = payload + len;
+    cwd = payload;
+    entry = cwd + strlen(cwd) + 1;
+    clearenv();
+    while(entry < end && *entry != '\0'){
+        if(strchr(entry, '=') != NULL)
+            putenv(entry);
+        entry += strlen(entry) + 1;
+    }
+    env_changed();
+    if(strcmp(getenv("PATH") ? getenv("PATH") : "", path) != 0)
+        hash_clear();
+
+    if(entry >= end)
+        fputs("server: malformed request\n", stderr);
+    else if(chdir(cwd) < 0)
+        fprintf(stderr, "server: %s: %s\n", cwd, strerror(errno));
+    else{
+        reader_string(&in, entry + 1);
+        user_input(&in);
+        status = last_status;
+    }
+
+    fflush(stdout);
+    write_all(sock, (char *)&status, sizeof(status));
+    exit(0);
+}
+
+/* Synopsis:
+ * pid_t start_worker(int listen_fd, int ready[2], int signal_fd)
+ *
+ * Description:
+ * The function forks a worker from the server, which shares
+ * everything the server has warmed up.
+ *
+ * Returns:
+ * The process id of the worker.
+ * -1 if it could not be forked.
+ */
+pid_t start_worker(int listen_fd, int ready[2], int signal_fd){
+    pid_t pid;
+
+    if((pid = fork()) == 0){
+        close(ready[0]);
+        server_worker(listen_fd, ready[1], signal_fd);
+    }
+    if(pid < 0)
+        perror("fork() error");
+    return pid;
+}
+
+/* Synopsis:
+ * int server_main(int argc, char *argv[])
+ *
+ * Description:
+ * The function runs 'bashshell --server socket [-j workers]
+ * [-c commands | script]'. The shell warms up once, running the
+ * commands or script given to define aliases, fill the command
+ * lookup cache and so on, then listens on socket and keeps a pool
+ * of workers, one per online core by default, forked and waiting
+ * for a connection, so a request is served without starting a
+ * process. Each busy worker is replaced at once and idle workers
+ * which die are restarted. SIGINT, SIGTERM or SIGHUP stop the
+ * server, letting busy workers finish their requests.
+ *
+ * Returns:
+ * The exit status of the server.
+ */
+int server_main(int argc, char *argv[]){
+    const char *path = argv[2];
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN), listen_fd, signal_fd, ready[2], i, fd;
+    struct signalfd_siginfo info;
+    struct pollfd polls[2];
+    pid_t *idle, pid;
+    sigset_t mask;
+    Reader in;
+
+    for(i = 3; i < argc && strcmp(argv[i], "-j") == 0; i += 2){
+        if(i + 1 >= argc || (workers = atoi(argv[i + 1])) < 1){
+            fprintf(stderr, "%s: -j: expected a number of workers\n", argv[0]);
+            return 2;
+        }
+    }
+
+    builtins_init();
+    events_init();
+    if(i < argc){
+        if(strcmp(argv[i], "-c") == 0){
+            if(i + 1 >= argc){
+                fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+                return 2;
+            }
+            reader_string(&in, argv[i + 1]);
+        }
+        else{
+            if((fd = open(argv[i], O_RDONLY | O_CLOEXEC)) < 0){
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+                return 127;
+            }
+            reader_open(&in, fd);
+        }
+        user_input(&in);
+    }
+    fflush(stdout);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if((signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0){
+        perror("signalfd() error");
+        return 1;
+    }
+    if(pipe2(ready, O_CLOEXEC) < 0){
+        perror("pipe2() error");
+        return 1;
+    }
+    if((listen_fd = server_socket(path, 1)) < 0)
+        return 1;
+
+    idle = calloc(workers, sizeof(pid_t));
+    polls[0].fd = signal_fd;
+    polls[1].fd = ready[0];
+    polls[0].events = polls[1].events = POLLIN;
+    while(1){
+        for(i = 0; i < workers; i++)
+            if(idle[i] <= 0)
+                idle[i] = start_worker(listen_fd, ready, signal_fd);
+        /* Try again shortly if a worker could not be forked. */
+        for(i = 0; i < workers && idle[i] > 0; i++)
+            ;
+        if(poll(polls, 2, i < workers ? 1000 : -1) < 0 && errno != EINTR)
+            break;
+
+        /* A busy worker no longer waits for connections. */
+        if(polls[1].revents & POLLIN){
+            while(read(ready[0], &pid, sizeof(pid)) == sizeof(pid)){
+                for(i = 0; i < workers; i++)
+                    if(idle[i] == pid)
+                        idle[i] = 0;
+                if(poll(&polls[1], 1, 0) <= 0)
+                    break;
+            }
+        }
+        if(polls[0].revents & POLLIN){
+            if(read(signal_fd, &info, sizeof(info)) != sizeof(info))
+                continue;
+            if(info.ssi_signo != SIGCHLD)
+                break;
+            /* Restart idle workers which died, busy ones are finished. */
+            while((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+                for(i = 0; i < workers; i++)
+                    if(idle[i] == pid)
+                        idle[i] = 0;
         }
     }
+
+    close(listen_fd);
+    unlink(path);
+    for(i = 0; i < workers; i++)
+        if(idle[i] > 0)
+            kill(idle[i], SIGTERM);
+    free(idle);
+    return 0;
 }
 
+/* Synopsis:
+ * int client_main(int argc, char *argv[])
+ *
+ * Description:
+ * The function runs 'bashshell --connect socket (-c commands | script)',
+ * sending the commands to a server together with this process's
+ * working directory, environment, stdin, stdout and stderr.
+ *
+ * Returns:
+ * The exit status of the last command run by the server.
+ * 1 if the request failed.
+ */
+int client_main(int argc, char *argv[]){
+    int sock, status, fd;
+    char *commands;
+    struct stat st;
+    size_t got = 0;
+    ssize_t n;
+
+    signal(SIGPIPE, SIG_IGN); /* A server going away is reported instead. */
+    if(argc < 4 || (strcmp(argv[3], "-c") == 0 && argc < 5)){
+        fprintf(stderr, "usage: %s --connect socket (-c commands | script)\n", argv[0]);
+        return 2;
+    }
+    if(strcmp(argv[3], "-c") == 0)
+        commands = strdup(argv[4]);
+    else{
+        if((fd = open(argv[3], O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0){
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[3], strerror(errno));
+            return 127;
+        }
+        commands = malloc(st.st_size + 1);
+        while(got < (size_t)st.st_size && (n = read(fd, commands + got, st.st_size - got)) > 0)
+            got += n;
+        commands[got] = '\0';
+        close(fd);
+    }
+
+    if((sock = server_socket(argv[2], 0)) < 0)
+        return 1;
+    if(send_request(sock, commands) < 0){
+        fprintf(stderr, "%s: %s: request failed\n", argv[0], argv[2]);
+        return 1;
+    }
+    free(commands);
+
+    got = 0;
+    while(got < sizeof(status)){
+        n = read(sock, (char *)&status + got, sizeof(status) - got);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0){
+            fprintf(stderr, "%s: %s: connection closed\n", argv[0], argv[2]);
+            return 1;
+        }
+        got += n;
+    }
+    return status;
+}
 
-int main()
+#ifndef SHELL_NO_MAIN
+int main(int argc, char *argv[])
 {
     char cwd[1024]; /* Variable to hold the path name of working directory. */
     const char *path; /* Variable to store the environment string. */
-    int i = 0;
+    int i = 0, fd;
+    Reader in; /* Where commands are read from. */
+
+    history_counter = 0;
+    alias_counter = 0;
+
+    reset_cmdstr();
+    trace_env();
+
+    if(argc > 2 && strcmp(argv[1], "--server") == 0)
+        return server_main(argc, argv);
+    if(argc > 2 && strcmp(argv[1], "--connect") == 0)
+        return client_main(argc, argv);
+
+    /* Non-interactive modes: run the commands and report the last status. */
+    if(argc > 1){
+        if(strcmp(argv[1], "-c") == 0){
+            if(argc < 3){
+                fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+                return 2;
+            }
+            reader_string(&in, argv[2]);
+        }
+        else{
+            if((fd = open(argv[1], O_RDONLY | O_CLOEXEC)) < 0){
+                fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+                return 127;
+            }
+            reader_open(&in, fd);
+        }
+        /* Reading ahead of a pipe could wait on the command itself. */
+        tail_calls = 1;
+    }
+    else
+        reader_open(&in, STDIN_FILENO);
+
+    if(argc > 1 || !isatty(STDIN_FILENO)){
+        events_init();
+        user_input(&in);
+        fflush(stdout);
+        return last_status;
+    }
 
     path = getenv("PATH"); /* Get system path. */
     printf("%s\n",path); /* Print system path. */
@@ -756,18 +10021,17 @@ int main()
 
     chdir(getenv("HOME")); /* Change to HOME directory. */
 
-    history_counter = 0;
-    alias_counter = 0;
-
-	while(i < SIZE(alias_array)){
-		alias_array[i].alias_name = malloc(sizeof(alias_array[i].alias_name));
-		alias_array[i].alias_cmd = malloc(sizeof(alias_array[i].alias_cmd));
-		i++;
-	}
+    interactive = 1;
+    /* Keyboard signals go to the foreground job, not the shell.
+     * SIGTTOU is ignored so the terminal can be taken back from jobs. */
+    for(i = 0; i < (int)SIZE(job_signals); i++)
+        signal(job_signals[i], SIG_IGN);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    events_init();
 
     open_history();
     pwd();
-    user_input();
+    user_input(&in);
     chdir(getenv("HOME")); /* Change to HOME directory. */
     save_history();
     setenv("PATH",path,1); /* Restore original value of PATH environment parameter. */
@@ -775,5 +10039,6 @@ int main()
     chdir(cwd); /* Change back to original working directory. */
     pwd();
 
-    return 0;
+    return last_status;
 }
+#endif
@@ -0,0 +1,527 @@
+/***************************************************************************
+ *
+ * Filename: bench.c
+ *
+ * Synopsis:
+ * bench <path to bashshell>
+ *
+ * Benchmark suite for the hot paths of the shell. The shell's own source
+ * is compiled in with its main() left out, so tokenise(), alias_check(),
+ * completion, glob expansion, the script engine and the history
+ * functions are timed directly, while start-up and batch throughput are
+ * timed by running the shell binary given as argument.
+ * Results are written to stdout as one JSON object.
+ *
+ **************************************************************************/
+
+#define SHELL_NO_MAIN
+#include "../bashshell.c"
+
+/* Number of shell start-ups timed */
+#define STARTUP_RUNS 200
+/* Number of commands fed through batch input */
+#define BATCH_COMMANDS 20000
+#define BATCH_EXTERNAL 2000
+/* Sizes used by the microbenchmarks */
+#define TOKENISE_RUNS 200000
+#define ALIAS_COUNT 100000
+#define ALIAS_LOOKUPS 1000000
+#define HISTORY_ADDS 200000
+#define COMPLETE_EXECUTABLES 5000
+#define COMPLETE_RUNS 10000
+#define GLOB_ENTRIES 100000
+#define GLOB_RUNS 20
+#define SCRIPT_ITERATIONS 100000
+
+/* Directory the benchmark files are made in */
+char bench_dir[] = "/tmp/bashshell-bench-XXXXXX";
+
+/* Synopsis:
+ * double now()
+ *
+ * Description:
+ * The function reads the monotonic clock.
+ *
+ * Returns:
+ * The time in seconds.
+ */
+double now(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Synopsis:
+ * double run_shell(const char *shell, char **args, const char *input)
+ *
+ * Description:
+ * The function runs the shell with args, its stdin taken from the
+ * file input or /dev/null and its stdout thrown away, and waits
+ * for it.
+ *
+ * Returns:
+ * Seconds from starting the shell until it exited.
+ */
+double run_shell(const char *shell, char **args, const char *input){
+    posix_spawn_file_actions_t actions;
+    double start;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input ? input : "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    args[0] = (char *)shell;
+    start = now();
+    if(posix_spawn(&pid, shell, &actions, NULL, args, environ) != 0){
+        perror("posix_spawn");
+        exit(1);
+    }
+    waitpid(pid, NULL, 0);
+    posix_spawn_file_actions_destroy(&actions);
+    return now() - start;
+}
+
+/* Synopsis:
+ * void bench_startup(const char *shell)
+ *
+ * Description:
+ * The function times STARTUP_RUNS runs of 'bashshell -c true'.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_startup(const char *shell){
+    char *args[] = {NULL, "-c", "true", NULL};
+    double times[STARTUP_RUNS], total = 0;
+    int i;
+
+    for(i = 0; i < STARTUP_RUNS; i++){
+        times[i] = run_shell(shell, args, NULL);
+        total += times[i];
+    }
+    qsort(times, STARTUP_RUNS, sizeof(double), compare_latency);
+    printf("  \"startup\": {\"runs\": %d, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f},\n",
+           STARTUP_RUNS, total / STARTUP_RUNS * 1e6, times[STARTUP_RUNS / 2] * 1e6,
+           times[STARTUP_RUNS * 99 / 100] * 1e6);
+}
+
+/* Synopsis:
+ * double bench_batch(const char *shell, const char *command, int count)
+ *
+ * Description:
+ * The function pipes count copies of command into the shell's
+ * batch mode through a file.
+ *
+ * Returns:
+ * Commands run per second.
+ */
+double bench_batch(const char *shell, const char *command, int count){
+    char *args[] = {NULL, NULL}, path[256];
+    FILE *file;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/batch", bench_dir);
+    file = fopen(path, "w");
+    for(i = 0; i < count; i++)
+        fprintf(file, "%s\n", command);
+    fclose(file);
+    return count / run_shell(shell, args, path);
+}
+
+/* Synopsis:
+ * void bench_tokenise()
+ *
+ * Description:
+ * The function times tokenise() on a typical command line and on
+ * one with a thousand words.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_tokenise(){
+    const char *line = "grep -rn --include=*.c pattern src include | sort | uniq -c";
+    char *long_line = malloc(1000 * 8 + 1), *p = long_line;
+    double start, short_ns, long_ns;
+    int i;
+
+    for(i = 0; i < 1000; i++)
+        p += sprintf(p, "word%03d ", i);
+
+    start = now();
+    for(i = 0; i < TOKENISE_RUNS; i++){
+        arena_reset(&line_arena);
+        tokenise(arena_strdup(&line_arena, line));
+    }
+    short_ns = (now() - start) / TOKENISE_RUNS * 1e9;
+
+    start = now();
+    for(i = 0; i < TOKENISE_RUNS / 100; i++){
+        arena_reset(&line_arena);
+        tokenise(arena_strdup(&line_arena, long_line));
+    }
+    long_ns = (now() - start) / (TOKENISE_RUNS / 100) * 1e9;
+
+    printf("  \"tokenise\": {\"runs\": %d, \"ns_per_line\": %.1f, \"ns_per_1000_word_line\": %.1f},\n",
+           TOKENISE_RUNS, short_ns, long_ns);
+    free(long_line);
+}
+
+/* Synopsis:
+ * void bench_script()
+ *
+ * Description:
+ * The function times a for loop of SCRIPT_ITERATIONS runs of an
+ * assignment and a builtin run by the script engine, against the
+ * same two lines tokenised and run one at a time, and times
+ * compiling the loop and finding it again in the cache.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_script(){
+    size_t size = SCRIPT_ITERATIONS * 8 + 64, len;
+    char *text = malloc(size), *p = text, line[32];
+    double start, compile_ms, cached_us, loop_ns, lines_ns;
+    int i;
+
+    p += sprintf(p, "for i in");
+    for(i = 0; i < SCRIPT_ITERATIONS; i++)
+        p += sprintf(p, " %d", i);
+    p += sprintf(p, "\n    x=$i\n    true $x\ndone\n");
+    len = p - text;
+
+    start = now();
+    compile_script(text, len);
+    compile_ms = (now() - start) * 1e3;
+    start = now();
+    for(i = 0; i < 1000; i++)
+        compile_script(text, len);
+    cached_us = (now() - start) / 1000 * 1e6;
+
+    start = now();
+    run_text(text, len);
+    loop_ns = (now() - start) / SCRIPT_ITERATIONS * 1e9;
+
+    start = now();
+    for(i = 0; i < SCRIPT_ITERATIONS; i++){
+        arena_reset(&line_arena);
+        sprintf(line, "x=%d", i);
+        tokenise(arena_strdup(&line_arena, line));
+        commands();
+        arena_reset(&line_arena);
+        tokenise(arena_strdup(&line_arena, "true $x"));
+        commands();
+    }
+    lines_ns = (now() - start) / SCRIPT_ITERATIONS * 1e9;
+
+    printf("  \"script\": {\"iterations\": %d, \"compile_ms\": %.3f, \"cached_lookup_us\": %.2f, "
+           "\"ns_per_compiled_iteration\": %.1f, \"ns_per_tokenised_iteration\": %.1f},\n",
+           SCRIPT_ITERATIONS, compile_ms, cached_us, loop_ns, lines_ns);
+    free(text);
+}
+
+/* Synopsis:
+ * void bench_alias()
+ *
+ * Description:
+ * The function fills the alias table with ALIAS_COUNT aliases and
+ * times alias_check() on names which are and are not aliases.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_alias(){
+    char name[32], miss[32];
+    double start, fill_ms, hit_ns, miss_ns;
+    int i, found = 0;
+
+    start = now();
+    for(i = 0; i < ALIAS_COUNT; i++){
+        arena_reset(&line_arena);
+        reset_cmdstr();
+        snprintf(name, sizeof(name), "a%d", i);
+        push_cmdstr("alias");
+        push_cmdstr(arena_strdup(&line_arena, name));
+        push_cmdstr("ls");
+        push_cmdstr("-l");
+        set_alias(alias_slot(cmdStr[1]));
+    }
+    fill_ms = (now() - start) * 1e3;
+
+    start = now();
+    for(i = 0; i < ALIAS_LOOKUPS; i++){
+        snprintf(name, sizeof(name), "a%d", i % ALIAS_COUNT);
+        found += alias_check(name) >= 0;
+    }
+    hit_ns = (now() - start) / ALIAS_LOOKUPS * 1e9;
+
+    start = now();
+    for(i = 0; i < ALIAS_LOOKUPS; i++){
+        snprintf(miss, sizeof(miss), "b%d", i % ALIAS_COUNT);
+        found += alias_check(miss) >= 0;
+    }
+    miss_ns = (now() - start) / ALIAS_LOOKUPS * 1e9;
+
+    printf("  \"alias_check\": {\"aliases\": %d, \"fill_ms\": %.1f, \"hit_ns\": %.1f, \"miss_ns\": %.1f, \"found\": %d},\n",
+           ALIAS_COUNT, fill_ms, hit_ns, miss_ns, found);
+}
+
+/* Synopsis:
+ * void bench_complete()
+ *
+ * Description:
+ * The function puts a directory of COMPLETE_EXECUTABLES executables on
+ * PATH and times command completion: the first one, which builds the
+ * executable index, and later ones, which only check that each PATH
+ * directory is unchanged, for a prefix matching one name and for a
+ * prefix matching a thousand.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_complete(){
+    char dir[256], path[512], *old_path = strdup(getenv("PATH")), *new_path;
+    double start, build_us, one_us, many_us;
+    int i, found = 0;
+
+    snprintf(dir, sizeof(dir), "%s/bin", bench_dir);
+    mkdir(dir, 0755);
+    for(i = 0; i < COMPLETE_EXECUTABLES; i++){
+        snprintf(path, sizeof(path), "%s/tool%04d", dir, i);
+        close(open(path, O_WRONLY | O_CREAT, 0755));
+    }
+    new_path = malloc(strlen(dir) + strlen(old_path) + 2);
+    sprintf(new_path, "%s:%s", dir, old_path);
+    setenv("PATH", new_path, 1);
+    exec_index_reset();
+
+    start = now();
+    found += find_completions("tool1234", 1);
+    build_us = (now() - start) * 1e6;
+
+    start = now();
+    for(i = 0; i < COMPLETE_RUNS; i++){
+        arena_reset(&line_arena);
+        found += find_completions("tool1234", 1);
+    }
+    one_us = (now() - start) / COMPLETE_RUNS * 1e6;
+
+    start = now();
+    for(i = 0; i < COMPLETE_RUNS / 10; i++){
+        arena_reset(&line_arena);
+        found += find_completions("tool1", 1);
+    }
+    many_us = (now() - start) / (COMPLETE_RUNS / 10) * 1e6;
+
+    setenv("PATH", old_path, 1);
+    exec_index_reset();
+    free(new_path);
+    free(old_path);
+    printf("  \"complete\": {\"executables\": %d, \"first_us\": %.1f, \"one_match_us\": %.2f, \"1000_matches_us\": %.1f, \"found\": %d},\n",
+           COMPLETE_EXECUTABLES, build_us, one_us, many_us, found);
+}
+
+/* Synopsis:
+ * double time_glob(const char *pattern, int *matches)
+ *
+ * Description:
+ * The function times tokenise() expanding pattern GLOB_RUNS times.
+ *
+ * Returns:
+ * Milliseconds per expansion, with the number of paths in *matches.
+ */
+double time_glob(const char *pattern, int *matches){
+    double start = now();
+    int i;
+
+    for(i = 0; i < GLOB_RUNS; i++){
+        arena_reset(&line_arena);
+        tokenise(arena_strdup(&line_arena, pattern));
+    }
+    *matches = cmd_len - 1;
+    return (now() - start) / GLOB_RUNS * 1e3;
+}
+
+/* Synopsis:
+ * void bench_glob()
+ *
+ * Description:
+ * The function fills a directory with GLOB_ENTRIES files and times
+ * expanding a pattern matching a handful of them, one matching half
+ * of them with a bracket expression and '*' matching all of them.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_glob(){
+    char dir[256], path[512];
+    double few_ms, half_ms, all_ms;
+    int few, half, all, i;
+
+    snprintf(dir, sizeof(dir), "%s/glob", bench_dir);
+    mkdir(dir, 0755);
+    for(i = 0; i < GLOB_ENTRIES; i++){
+        snprintf(path, sizeof(path), "%s/file%06d.dat", dir, i);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    chdir(dir);
+    few_ms = time_glob("echo file0012*.dat", &few);
+    half_ms = time_glob("echo *[13579].dat", &half);
+    all_ms = time_glob("echo *", &all);
+    chdir(bench_dir);
+
+    printf("  \"glob\": {\"entries\": %d, \"few_ms\": %.2f, \"few\": %d, \"half_ms\": %.2f, \"half\": %d, \"all_ms\": %.2f, \"all\": %d},\n",
+           GLOB_ENTRIES, few_ms, few, half_ms, half, all_ms, all);
+}
+
+/* Synopsis:
+ * void reset_history()
+ *
+ * Description:
+ * The function closes the history and drops every entry, so it can
+ * be opened again with another size.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void reset_history(){
+    int i;
+
+    save_history();
+    for(i = 0; i < history_counter; i++)
+        free_history(history_entry(i));
+    free(history);
+    free(history_path);
+    history = NULL;
+    history_counter = history_head = 0;
+    history_lines = 0;
+    history_seen = 0;
+    rebuild_index(trigram_capacity);
+}
+
+/* Synopsis:
+ * void bench_add_history()
+ *
+ * Description:
+ * The function times add_history() for HISTORY_ADDS commands into a
+ * history keeping half that many, so entries are evicted, appended to
+ * the file, synced and compacted as they would be in use.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_add_history(){
+    char line[256];
+    double start, ns;
+    int i;
+
+    /* An existing file keeps open_history() from announcing it. */
+    snprintf(line, sizeof(line), "%s/%s", bench_dir, HISTORY_FILE);
+    close(open(line, O_WRONLY | O_CREAT | O_TRUNC, 0600));
+    snprintf(line, sizeof(line), "%d", HISTORY_ADDS / 2);
+    setenv("HISTSIZE", line, 1);
+    open_history();
+    start = now();
+    for(i = 0; i < HISTORY_ADDS; i++){
+        arena_reset(&line_arena);
+        snprintf(line, sizeof(line), "make -j8 target%d CFLAGS=-O2", i);
+        add_history(line);
+    }
+    ns = (now() - start) / HISTORY_ADDS * 1e9;
+    reset_history();
+
+    printf("  \"add_history\": {\"commands\": %d, \"histsize\": %d, \"ns_per_add\": %.1f},\n",
+           HISTORY_ADDS, HISTORY_ADDS / 2, ns);
+}
+
+/* Synopsis:
+ * void bench_history_file(int lines, int last)
+ *
+ * Description:
+ * The function writes a history file of lines records and times
+ * loading it with open_history() and closing it with save_history(),
+ * both with the default history size and with one holding every line.
+ *
+ * Returns:
+ * The function has return type void.
+ */
+void bench_history_file(int lines, int last){
+    char path[256], size[32];
+    double start, load_ms, save_ms, full_load_ms, full_save_ms;
+    FILE *file;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s", bench_dir, HISTORY_FILE);
+    unlink(path);
+    file = fopen(path, "w");
+    for(i = 0; i < lines; i++)
+        fprintf(file, ": %ld:1;git commit -m \"change number %d\" --author=bench\n", 1700000000L + i, i);
+    fclose(file);
+
+    unsetenv("HISTSIZE");
+    start = now();
+    open_history();
+    load_ms = (now() - start) * 1e3;
+    start = now();
+    save_history();
+    save_ms = (now() - start) * 1e3;
+    reset_history();
+
+    snprintf(size, sizeof(size), "%d", lines);
+    setenv("HISTSIZE", size, 1);
+    start = now();
+    open_history();
+    full_load_ms = (now() - start) * 1e3;
+    start = now();
+    save_history();
+    full_save_ms = (now() - start) * 1e3;
+    reset_history();
+
+    printf("    \"%d\": {\"load_ms\": %.3f, \"save_ms\": %.3f, \"full_load_ms\": %.3f, \"full_save_ms\": %.3f}%s\n",
+           lines, load_ms, save_ms, full_load_ms, full_save_ms, last ? "" : ",");
+}
+
+int main(int argc, char *argv[]){
+    const char *shell = argc > 1 ? argv[1] : "./bashshell";
+    int lines[] = {10000, 100000, 1000000}, i;
+    char cwd[1024];
+
+    if(access(shell, X_OK) < 0){
+        fprintf(stderr, "bench: %s: %s\n", shell, strerror(errno));
+        return 1;
+    }
+    if(mkdtemp(bench_dir) == NULL){
+        perror("mkdtemp");
+        return 1;
+    }
+    if(shell[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL){ /* Keep the path valid after chdir. */
+        char *full = malloc(strlen(cwd) + strlen(shell) + 2);
+        sprintf(full, "%s/%s", cwd, shell);
+        shell = full;
+    }
+    setenv("HOME", bench_dir, 1);
+    chdir(bench_dir);
+    reset_cmdstr();
+
+    printf("{\n  \"version\": \"%.*s\",\n", (int)strcspn(VERSION, ","), VERSION);
+    bench_startup(shell);
+    printf("  \"batch\": {\"builtin_per_sec\": %.0f, \"external_per_sec\": %.0f},\n",
+           bench_batch(shell, "true", BATCH_COMMANDS), bench_batch(shell, "/bin/true", BATCH_EXTERNAL));
+    fflush(stdout);
+    bench_tokenise();
+    bench_script();
+    bench_complete();
+    bench_glob();
+    bench_alias();
+    bench_add_history();
+
+    printf("  \"history_file\": {\n");
+    for(i = 0; i < (int)SIZE(lines); i++)
+        bench_history_file(lines[i], i == (int)SIZE(lines) - 1);
+    printf("  }\n}\n");
+
+    snprintf(cwd, sizeof(cwd), "rm -rf '%s'", bench_dir);
+    chdir("/");
+    return system(cwd) != 0;
+}
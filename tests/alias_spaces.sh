@@ -0,0 +1,17 @@
+# A variable holding spaces stays one word of an alias, whether the
+# alias is set from a compiled statement or from a plain line.
+SPACES=1\ 2\ 3\ 4\ 5\ 6\ 7\ 8
+for n in 1 2
+do
+alias words$n echo $SPACES
+done
+words1
+words2
+if true
+then
+alias more echo $SPACES end
+fi
+more
+alias plain echo $SPACES
+plain
+alias
@@ -0,0 +1,85 @@
+# The utilities built into the shell and the argument counts checked
+# for every builtin.
+echo plain words
+echo -n no newline
+echo
+echo -e tab\there
+echo -E raw\tslash
+echo -n -e a\nb
+echo
+echo -x
+echo
+
+test 1 -lt 2
+echo lt $?
+test 10 -gt 9
+echo gt $?
+test abc = abc
+echo = $?
+test abc != abc
+echo != $?
+test -z
+echo one arg $?
+test -n abc
+echo n $?
+test -d tests
+echo d $?
+test -f tests
+echo f $?
+test -e nosuchfile
+echo e $?
+test ! -e nosuchfile
+echo not $?
+[ 3 -eq 3 ]
+echo [ $?
+[ 3 -eq 3
+echo missing ] $?
+test 1 -lt x
+echo not a number $?
+test
+echo empty $?
+
+printf %s,%d,%x,%o\n str 42 255 8
+printf [%5s][%-5s][%05d]\n ab cd 7
+printf %s\n one two three
+printf %c%c\n xyz
+printf 100%%\n
+printf \x41\101\n
+printf %d\n nan
+echo status $?
+
+TESTVAR=shell
+export TESTVAR
+printenv TESTVAR
+unset TESTVAR
+printenv TESTVAR
+echo unset $?
+export NEWVAR=direct
+printenv NEWVAR
+unset NEWVAR
+echo after unset: $NEWVAR.
+
+type cd
+type /bin/sh
+type nosuchcommand
+echo status $?
+alias ll ls -l
+type ll
+unalias ll
+
+pwd extra
+echo status $?
+cd one two
+echo status $?
+unalias
+echo status $?
+printf
+echo status $?
+type
+echo status $?
+cp one
+echo status $?
+setpath
+echo status $?
+stats a b
+echo status $?
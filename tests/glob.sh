@@ -0,0 +1,39 @@
+# Wildcards expand to the matching paths in sorted order, and a word
+# matching nothing is left as typed. A '\' makes the next character of
+# a pattern literal, and a word with no other wildcard is left as typed.
+rm -rf tests/scratch.glob
+mkdir tests/scratch.glob
+cd tests/scratch.glob > /dev/null
+touch a.c b.c c.c ab.c d.h x.h .hidden.c 1.c
+mkdir src src/lib doc
+touch src/main.c src/util.c src/lib/list.c doc/a.txt
+touch star*name
+
+echo *
+echo *.c
+echo ?.c
+echo ??.c
+echo [a-c].c
+echo [!a].c
+echo [ab]*
+echo .*.c
+echo .*
+echo */*.c
+echo */*
+echo src/*/*.c
+echo s?c/[m-z]*.c
+echo *.none
+echo src/*.none
+echo none/*.c
+echo star\*name
+echo star\**
+echo *\*name
+echo \*.c
+echo a\?c
+ls *.h
+echo [
+echo [a-
+echo *.c x.h *.h
+
+cd ../.. > /dev/null
+rm -rf tests/scratch.glob
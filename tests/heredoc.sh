@@ -0,0 +1,66 @@
+# Here-documents and here-strings, fed to builtins and programs.
+rm -rf tests/scratch.heredoc
+mkdir tests/scratch.heredoc
+cd tests/scratch.heredoc > /dev/null
+
+name=world
+cat <<EOF
+hello $name
+  indented ${name}s
+EOF
+cat <<'EOF'
+hello $name
+EOF
+cat <<"EOF"
+hello ${name}
+EOF
+tr a-z A-Z <<END
+program $name
+END
+cat <<EOF
+EOF
+echo empty body: $?
+
+cat <<EOF | tr a-z A-Z | rev
+piped $name
+EOF
+cat <<EOF > file
+into a file
+EOF
+cat file
+
+for i in 1 2
+do
+cat <<EOF
+loop $i
+EOF
+done
+n=0
+while test $n != 000
+do
+n=${n}0
+wc -c <<EOF
+$n
+EOF
+done
+
+cat <<< $name
+tr a-z A-Z <<< $name
+wc -c <<< word
+cat <<< one | tr a-z A-Z
+
+# A body larger than a pipe holds is passed in a memfd.
+seq 20000 > body
+printf cat\x20\x3c\x3cEND\n > big.sh
+cat body >> big.sh
+echo END >> big.sh
+source big.sh > big.out
+cmp body big.out
+echo big body: $?
+printf tr\x20\x30-9\x20a-j\x20\x3c\x3cEND\n > big.sh
+cat body >> big.sh
+echo END >> big.sh
+source big.sh | tail -1
+
+cd ../.. > /dev/null
+rm -rf tests/scratch.heredoc
@@ -0,0 +1,3 @@
+# A session sees the commands of another one that compacts the shared
+# history file, once each and in the order they are in the file.
+sh tests/history_sessions.pty
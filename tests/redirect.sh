@@ -0,0 +1,61 @@
+# Redirections of builtins and programs, and the cat and cp builtins.
+rm -rf tests/scratch.redirect
+mkdir tests/scratch.redirect
+cd tests/scratch.redirect > /dev/null
+
+echo one > out
+echo two >> out
+cat out
+cat < out
+wc -l < out
+/bin/echo program > prog
+cat prog
+printf %s-%s\n a b > fmt
+cat fmt
+cat out | tr a-z A-Z > upper
+cat upper
+echo replaced > out
+cat out
+
+echo missing file name >
+echo status $?
+cat < nosuchfile
+echo status $?
+echo x > nosuchdir/file
+echo status $?
+
+cat nosuchfile
+echo status $?
+cat out nosuchfile prog
+echo status $?
+cat out >> out
+echo status $?
+cat out
+echo from stdin | cat - prog
+seq 100000 > big
+cat big > big.cat
+cmp big big.cat
+echo cat big: $?
+
+cp big big.cp
+cmp big big.cp
+echo cp big: $?
+chmod 640 prog
+cp prog prog.cp
+stat -c %a prog.cp
+cat prog.cp
+echo newer > prog.cp
+cp prog prog.cp
+cat prog.cp
+mkdir dir
+cp out prog dir
+cat dir/out dir/prog
+cp out prog fmt
+echo status $?
+cp nosuchfile copy
+echo status $?
+cp out
+echo status $?
+
+cd ../.. > /dev/null
+rm -rf tests/scratch.redirect
@@ -0,0 +1,118 @@
+# The script language: conditionals, loops, $?, source and the cache of
+# compiled scripts.
+rm -rf tests/scratch.script
+mkdir tests/scratch.script
+cd tests/scratch.script > /dev/null
+
+n=2
+if test $n = 1
+then
+echo if
+elif test $n = 2
+then
+echo elif
+else
+echo else
+fi
+if false
+then
+echo if
+elif false
+then
+echo elif
+else
+echo else
+fi
+if ! false
+then
+echo negated
+fi
+if false
+then
+echo never
+fi
+echo if without else: $?
+
+touch a.c b.c c.h
+for f in *.c
+do
+echo for $f
+done
+for f in *.none
+do
+echo no match: $f
+done
+
+n=0
+while test $n != 3
+do
+echo while $n
+n=${n}x
+test $n = 0xxx
+if test $? = 0
+then
+n=3
+fi
+done
+until test -f stop
+do
+echo until
+touch stop
+done
+
+for i in 1 2 3
+do
+for j in a b c
+do
+if test $j = b
+then
+continue
+fi
+if test $i = 2
+then
+break 2
+fi
+echo $i$j
+done
+done
+echo after loops
+
+words=two\ \ words
+echo [$words]
+for w in $words a\ b\|c
+do
+echo [$w]
+done
+
+false
+echo status $?
+true
+echo status $?
+nosuchcommand
+echo status $?
+
+echo echo sourced > lib.sh
+echo sourced=yes >> lib.sh
+source lib.sh
+echo $sourced
+. lib.sh
+echo echo cached > cached.sh
+trace on trace.out
+source cached.sh
+source cached.sh
+trace off
+echo compiled:
+grep -c name.:.compile. trace.out
+echo echo changed > lib.sh
+source lib.sh
+
+echo for i in a b; do > semi.sh
+echo done >> semi.sh
+source semi.sh
+echo if true; then > semi.sh
+echo fi >> semi.sh
+source semi.sh
+echo status $?
+
+cd ../.. > /dev/null
+rm -rf tests/scratch.script